@@ -0,0 +1,4 @@
+# Imported targets: mhs5200::libmhs5200_shared and mhs5200::libmhs5200_static
+include(CMakeFindDependencyMacro)
+find_dependency(Threads)
+include(${CMAKE_CURRENT_LIST_DIR}/mhs5200Targets.cmake)
@@ -1,4 +1,11 @@
 #include "mhs5200.hpp"
+#include "mhs5200hop.hpp"
+#include "mhs5200bank.hpp"
+#include "mhs5200sync.hpp"
+#include "mhs5200wave.hpp"
+#include "mhs5200loadtest.hpp"
+#include "mhs5200stream.hpp"
+#include "mhs5200events.hpp"
 #include <malloc.h>
 #include <iostream>
 #include <iomanip>
@@ -8,10 +15,19 @@
 #include <string>
 #include <string.h>
 #include <stdlib.h>
-#include <fstream>
+#include <memory>
 #include <sstream>
+#include <algorithm>
+#include <signal.h>
+#include <sys/time.h>
 using namespace std;
 
+static volatile sig_atomic_t g_stopRequested = 0;
+
+static void requestStop(int) {
+    g_stopRequested = 1;
+}
+
 const char *waveToString( MHS5200Driver::WaveType wave ) {
     switch ( wave ) {
         case MHS5200Driver::WaveType::Sine: return "Sine";
@@ -59,6 +75,20 @@ bool parseDouble(const char *str, double &value) {
     return true;
 };
 
+bool parseDuration(const char *str, int64_t &micros) {
+    // Accepts a number with an optional us, ms or s suffix, milliseconds when no suffix is given.
+    char *p = nullptr;
+    double d = strtod(str, &p);
+    if ( p == nullptr || p == str || d <= 0 ) return false;
+    double scale;
+    if ( *p == 0 || strcmp(p, "ms") == 0 ) scale = 1000.0;
+    else if ( strcmp(p, "us") == 0 ) scale = 1.0;
+    else if ( strcmp(p, "s") == 0 ) scale = 1000000.0;
+    else return false;
+    micros = (int64_t)(d*scale);
+    return micros > 0;
+}
+
 void raise_expected_more_argments( const char *command ) {
     stringstream ss;
     ss << "Error: ";
@@ -73,23 +103,200 @@ void raise_expected_argument( const char *command, const char *argnickname, cons
     throw ss.str();
 }
 
-void raise_error_parsing_file( const char *command, const char *fileName ) {
+string frequencyRange( const MHS5200ModelLimits &limits ) {
     stringstream ss;
-    ss << "Error: Parsing file "<< fileName << " in "  << command << ".";
-    throw ss.str();
+    ss << limits.minFrequency << " to " << limits.maxFrequency/1000000.0 << "MHz on " << limits.name;
+    return ss.str();
 }
 
+string amplitudeRange( const MHS5200ModelLimits &limits ) {
+    stringstream ss;
+    ss << limits.minAmplitude << " to " << limits.maxAmplitude << "V exclusive on " << limits.name;
+    return ss.str();
+}
 
 
 
+struct WatchItem {
+    const char *name;
+    int channel;
+    MHS5200Driver::StateField field;
+    unsigned mask;
+    int wireBytes;
+    int64_t lastPolled;
+    bool known;
+};
+
+static void printWatchValue( const WatchItem &item, const MHS5200Driver::DeviceState &state ) {
+    struct timeval tv;
+    gettimeofday(&tv, nullptr);
+    printf("{\"time\":%ld.%03ld,", (long)tv.tv_sec, (long)tv.tv_usec/1000);
+    if ( item.channel ) printf("\"channel\":%d,", item.channel);
+    printf("\"field\":\"%s\",\"value\":", item.name);
+    
+    const MHS5200Driver::ChannelState &ch = state.channels[item.channel ? item.channel-1 : 0];
+    switch ( item.field ) {
+        case MHS5200Driver::FieldInverted: printf("%s", ch.inverted ? "true" : "false"); break;
+        case MHS5200Driver::FieldWave: {
+            const char *name = waveToString(ch.wave);
+            if ( name ) printf("\"%s\"", name);
+            else printf("%d", (int)ch.wave);
+            break;
+        }
+        case MHS5200Driver::FieldDutyCycle: printf("%.1f", ch.dutyCycle); break;
+        case MHS5200Driver::FieldOffset: printf("%d", ch.offset); break;
+        case MHS5200Driver::FieldPhaseOffset: printf("%d", ch.phaseOffset); break;
+        case MHS5200Driver::FieldAmplitude: printf("%.3f", ch.amplitude); break;
+        case MHS5200Driver::FieldFrequency: printf("%.2f", ch.frequency); break;
+        case MHS5200Driver::FieldCurrentChannel: printf("%d", state.currentChannel); break;
+        case MHS5200Driver::FieldChannelStatus: printf("%s", state.currentChannelStatus ? "true" : "false"); break;
+        default: printf("null"); break;
+    }
+    printf("}\n");
+}
+
+static bool watchValueChanged( const WatchItem &item, const MHS5200Driver::DeviceState &a, const MHS5200Driver::DeviceState &b ) {
+    int c = item.channel ? item.channel-1 : 0;
+    switch ( item.field ) {
+        case MHS5200Driver::FieldInverted: return a.channels[c].inverted != b.channels[c].inverted;
+        case MHS5200Driver::FieldWave: return a.channels[c].wave != b.channels[c].wave;
+        case MHS5200Driver::FieldDutyCycle: return a.channels[c].dutyCycle != b.channels[c].dutyCycle;
+        case MHS5200Driver::FieldOffset: return a.channels[c].offset != b.channels[c].offset;
+        case MHS5200Driver::FieldPhaseOffset: return a.channels[c].phaseOffset != b.channels[c].phaseOffset;
+        case MHS5200Driver::FieldAmplitude: return a.channels[c].amplitude != b.channels[c].amplitude;
+        case MHS5200Driver::FieldFrequency: return a.channels[c].frequency != b.channels[c].frequency;
+        case MHS5200Driver::FieldCurrentChannel: return a.currentChannel != b.currentChannel;
+        case MHS5200Driver::FieldChannelStatus: return a.currentChannelStatus != b.currentChannelStatus;
+        default: break;
+    }
+    return false;
+}
+
+void watchDevice( MHS5200Driver &signalGenerator, int64_t intervalMicros ) {
+    static const struct { const char *name; MHS5200Driver::StateField field; } channelFields[] = {
+        { "inverted", MHS5200Driver::FieldInverted }, { "wave", MHS5200Driver::FieldWave },
+        { "duty", MHS5200Driver::FieldDutyCycle }, { "offset", MHS5200Driver::FieldOffset },
+        { "phase", MHS5200Driver::FieldPhaseOffset }, { "amplitude", MHS5200Driver::FieldAmplitude },
+        { "frequency", MHS5200Driver::FieldFrequency }
+    };
+    vector<WatchItem> items;
+    int totalBytes = 0;
+    
+    for ( int channel = 1; channel <= 2; channel++ ) {
+        for ( auto &f : channelFields ) {
+            items.push_back({ f.name, channel, f.field, MHS5200Driver::fieldMask(channel, f.field), MHS5200Driver::fieldWireBytes(f.field), 0, false });
+        }
+    }
+    items.push_back({ "active", 0, MHS5200Driver::FieldCurrentChannel, MHS5200Driver::FieldCurrentChannel, MHS5200Driver::fieldWireBytes(MHS5200Driver::FieldCurrentChannel), 0, false });
+    items.push_back({ "on", 0, MHS5200Driver::FieldChannelStatus, MHS5200Driver::FieldChannelStatus, MHS5200Driver::fieldWireBytes(MHS5200Driver::FieldChannelStatus), 0, false });
+    for ( auto &item : items )
+        totalBytes += item.wireBytes;
+    
+    signal(SIGINT, requestStop);
+    signal(SIGTERM, requestStop);
+    
+    // Cost model for one pipelined batch: fixed round trip latency plus the bytes shifted on the wire.
+    const double microsPerByte = signalGenerator.wireMicrosPerByte();
+    double latencyMicros = 0;
+    bool latencyKnown = false;
+    int64_t tick = 0;
+    int64_t polls = 0, batches = 0, missed = 0;
+    MHS5200Driver::DeviceState state, previous;
+    memset(&state, 0, sizeof(state));
+    memset(&previous, 0, sizeof(previous));
+    
+    int64_t start = MHS5200Driver::monotonicMicros();
+    int64_t next = start;
+    while ( !g_stopRequested && signalGenerator.isConnected() ) {
+        tick++;
+        
+        // Fill the budget in order of staleness per byte so cheap fields refresh every tick
+        // and expensive ones rotate through when everything does not fit the interval.
+        double budget = intervalMicros * 0.8 - latencyMicros;
+        vector<WatchItem*> order;
+        for ( auto &item : items ) order.push_back(&item);
+        sort(order.begin(), order.end(), [tick](const WatchItem *a, const WatchItem *b) {
+            double pa = (double)(tick - a->lastPolled) / a->wireBytes;
+            double pb = (double)(tick - b->lastPolled) / b->wireBytes;
+            return pa > pb;
+        });
+        unsigned fields = 0;
+        int batchBytes = 0;
+        for ( auto *item : order ) {
+            if ( fields != 0 && latencyKnown && (batchBytes + item->wireBytes)*microsPerByte > budget ) continue;
+            fields |= item->mask;
+            batchBytes += item->wireBytes;
+        }
+        
+        int64_t batchStart = MHS5200Driver::monotonicMicros();
+        unsigned readFields = signalGenerator.readState(state, fields);
+        int64_t batchTime = MHS5200Driver::monotonicMicros() - batchStart;
+        batches++;
+        
+        if ( readFields == fields ) {
+            double observed = batchTime - batchBytes*microsPerByte;
+            if ( observed < 0 ) observed = 0;
+            latencyMicros = latencyKnown ? latencyMicros*0.8 + observed*0.2 : observed;
+            latencyKnown = true;
+        }
+        
+        for ( auto &item : items ) {
+            if ( !(fields & item.mask) ) continue;
+            if ( !(readFields & item.mask) ) {
+                missed++;
+                continue;
+            }
+            polls++;
+            item.lastPolled = tick;
+            if ( !item.known || watchValueChanged(item, state, previous) )
+                printWatchValue(item, state);
+            item.known = true;
+        }
+        previous = state;
+        fflush(stdout);
+        
+        next += intervalMicros;
+        int64_t now = MHS5200Driver::monotonicMicros();
+        if ( next > now ) {
+            usleep((useconds_t)(next - now));
+        } else {
+            next = now;
+        }
+    }
+    
+    double elapsed = (MHS5200Driver::monotonicMicros() - start) / 1000000.0;
+    double fullCycle = latencyMicros + totalBytes*microsPerByte;
+    struct timeval tv;
+    gettimeofday(&tv, nullptr);
+    printf("{\"time\":%ld.%03ld,\"summary\":{\"batches\":%lld,\"fields_read\":%lld,\"fields_missed\":%lld,\"elapsed\":%.3f,"
+           "\"latency_ms\":%.3f,\"full_poll_ms\":%.3f,\"max_poll_hz\":%.2f}}\n",
+           (long)tv.tv_sec, (long)tv.tv_usec/1000, (long long)batches, (long long)polls, (long long)missed, elapsed,
+           latencyMicros/1000.0, fullCycle/1000.0, fullCycle > 0 ? 1000000.0/fullCycle : 0.0);
+    fflush(stdout);
+}
+
 int main( int argc, const char *argv[] ) 
 {
     const char *deviceName;
+    MHS5200FakeDevice fakeDevice;
     MHS5200Driver signalGenerator;
     int currentChannel = -1;
+    bool staging = false;
+    MHS5200Driver::DeviceState staged;
+    unsigned stagedFields = 0;
     int argp = 1;
     vector< function<void()> > commandChain;
     map<string, function<void(int argc, const char *argv[])> > commandParser;
+    bool inBegin = false;
+    const char *eventsFile = nullptr;
+    const char *traceOutputFile = nullptr;
+    bool probeModel = false;
+    vector<const char *> syncDeviceNames;
+    bool dryRun = false;
+    double dryRunLatency[2] = { 1.0, 2.0 };
+    vector< unique_ptr<MHS5200Driver> > syncGenerators;
+    const char *slotIndexFile = nullptr;
+    bool commitViaSlots = false;
     
     try {
         commandParser["-?"] = [](int argc, const char *argv[])->void {
@@ -98,11 +305,18 @@ int main( int argc, const char *argv[] )
             printf("\t-?, --help\t\tShows this information and terminate.\n");
             printf("\tchannel 1/2\t\tSet channel to use for subsequent commands.\n");
             printf("\tdebug\t\t\tOutput debug trace information.\n");
+            printf("\t--model <name>\t\tLimits of MHS-5206A, 5212A, 5220A or 5225A (default),\n\t\t\t\tauto asks the device. Give it before the settings.\n");
+            printf("\ttrace <file>\t\tRecord the serial traffic to a binary trace file.\n");
+            printf("\tevents <file>\t\tWrite the binary hot path events on exit (***).\n");
             printf("\tstatus\t\t\tShows this command information.\n");
+            printf("\tstats\t\t\tShows link error and retry counters.\n");
+            printf("\tqueue <timeout>\t\tWhen other mhs5200 commands use the device wait up to\n\t\t\t\tthis long for them in turn instead of failing.\n");
+            printf("\tverify <policy>\t\tRead settings back after setting them: none, always,\n\t\t\t\tcritical (frequency, amplitude, offset, on/off) or n for\n\t\t\t\tone set in n. The reads are batched.\n");
+            printf("\tfaults <rate>\t\tDrop this fraction of responses to test recovery.\n");
+            printf("\treconnect <timeout>\tWhen the device goes away wait this long for it to come\n\t\t\t\tback, then restore the settings and carry on.\n");
             printf("\tfreq, frequency <hz>\tSet frequency in hz.\n");
             printf("\tduty <percent>\t\tSet duty cycle percent.\n");
             printf("\tamplitude <volts>\tSet peek to peek amplitude of the wave.\n");
-            printf("\tprogram <0-15> <file>\tProgram arbitrary wave form using file.\n");
             printf("\toffset <+/-120>\t\tSets the voltage offset from -120%% and +120%%.\n");
             printf("\tphase <0-359>\t\tSets the phase angle offset.\n");
             printf("\ton/off\t\t\tTurn the channel on or off (*).\n");
@@ -111,20 +325,47 @@ int main( int argc, const char *argv[] )
             printf("\tstore <0-9>\t\tSave channel settings to memory slot 0-9.\n");
             printf("\tload <0-9>\t\tLoad channel settings from memory slot 0-9.\n");
             printf("\tprogram <0-15> <file>\tProgram arbitrary wave form.\n");
+            printf("\tprogram <0-15> \"load <file> | <step> | ...\"\n\t\t\t\tProgram a wave form derived from files, steps are\n\t\t\t\tscale <factor>, offset <fraction>, invert, reverse,\n\t\t\t\twindow [hann|hamming|blackman], shift <degrees>,\n\t\t\t\tmix <file> [weight] and dither <bits>.\n");
+            printf("\tprogram-bank <manifest> [--window <n>]\n\t\t\t\tProgram the slots listed in the manifest.\n");
             printf("\tsine\t\t\tSine wave output (**).\n");
             printf("\tsquare\t\t\tSquare wave output (**).\n");
             printf("\ttriangle\t\tTriangle wave output (**).\n");
             printf("\tsaw\t\t\tSawtooth / upward slope wave output (**).\n");
             printf("\treversesaw\t\tReverse sawtooth / downward ramp waveform (**).\n");
-            printf("\tarb <0-15>\t\tArbitrary waveform 0-15 (**).\n\n");
+            printf("\tarb <0-15>\t\tArbitrary waveform 0-15 (**).\n");
+            printf("\tbegin ... commit\tCollect the settings in between and apply them to both\n\t\t\t\tchannels with a single write.\n");
+            printf("\tbegin ... commit --slots\tThe same, loading an indexed memory slot first when that\n\t\t\t\tneeds fewer frames. Settings not given take the slot's.\n");
+            printf("\t--dry-run [--latency <read ms,set ms>]\n\t\t\t\tList the frames the commands send and estimate their\n\t\t\t\tcost without opening the device. Latencies as measured\n\t\t\t\tby stats, default 1,2.\n");
+            printf("\t--slot-index <file>\tKeep an index of what the memory slots hold in this file,\n\t\t\t\tstores update it and commit --slots uses it.\n");
+            printf("\t--sync <tty device>\tAlso apply begin ... commit to this generator, the writes\n\t\t\t\tof all generators are released at once. May be repeated.\n");
+            printf("\tstream <file> <segment time> [--slots <first-last>]\n\t\t\t\tPlay a file of several 1024 sample segments, each for\n\t\t\t\tthe given time, uploading the next while one plays.\n\t\t\t\tSlots 14-15 by default.\n");
+            printf("\tfsk [--realtime] <rate> <hz,hz,...> <symbols>\n\t\t\t\tStep the frequency through the list at rate symbols/s,\n\t\t\t\tsymbols 0-9a-z index the list.\n");
+            printf("\tloadtest [--duration <t>] [--ops <n>] [--mix <reads,sets,uploads>]\n\t\t\t\tDrive a mix of reads, sets and arbitrary wave uploads\n\t\t\t\t(to slot 15) for 10s or the given time or count and\n\t\t\t\treport rates, latencies and errors. Mix 80,18,2 default.\n");
+            printf("\twatch [--interval <t>]\tPoll both channels and print changes as JSON lines\n\t\t\t\tuntil interrupted. Interval in ms, or with us/ms/s suffix.\n\n");
             
             printf(" (*) Will also change the displayed channel on the device.\n");
-            printf(" (**) Using a wave form command turns off inverse.\n\n");
+            printf(" (**) Using a wave form command turns off inverse.\n");
+            printf(" (***) Requires a build configured with -DMHS5200_TRACE=BINARY.\n\n");
             
             printf("Arbitrary wave form programming:\n");
             printf("The file is 1024 lines, each line with a value. The value range depends \n");
             printf("on the signal generator and is 0-4095 for MHS-5225A (12bit samples).\n\n");
             
+            printf("Testing without a generator:\n");
+            printf("%s fake <command list>\n", argv[0]);
+            printf("Runs the commands against a fake device emulating the generator at 57600 baud.\n");
+            printf("%s --fake [--loss <rate>]\n", argv[0]);
+            printf("Creates the fake device for other programs and prints its tty name.\n\n");
+            
+            printf("Finding generators:\n");
+            printf("%s --discover [<tty device> ...]\n", argv[0]);
+            printf("Probes the devices (default /dev/ttyUSB* and /dev/ttyACM*) at the same time and\nlists those answering like an MHS-5200. Use auto as tty device to take the first.\n\n");
+            
+            printf("Replaying a trace:\n");
+            printf("%s --replay <file> [--speed <factor>]\n", argv[0]);
+            printf("Creates a fake device playing back a recorded trace and prints its tty name.\n");
+            printf("Speed 1 keeps the recorded timing, 0 responds without delay.\n\n");
+            
             printf("General instructions:\n");
             printf("Most commands are executed in the order given so commands like channel will\naffect certain subsequent commands.\n\nExample: \n%s /dev/ttyUSB0 channel 1 off square inverse freq 12345678.12 on\n\n", argv[0]);
             printf("The above example turns off channel 1, sets waveform to inverted sine wave of a\ngiven frequency then turns the channel back on.\n");
@@ -139,6 +380,175 @@ int main( int argc, const char *argv[] )
             signalGenerator.setDebugOutput(true);
         };
         
+        commandParser["trace"] = [&](int argc, const char *argv[])->void {
+            int cmdarg = argp++;
+            if ( argp < argc ) {
+                traceOutputFile = argv[argp++];
+            } else {
+                raise_expected_more_argments(argv[cmdarg]);
+            }
+        };
+        
+        commandParser["events"] = [&](int argc, const char *argv[])->void {
+            int cmdarg = argp++;
+            if ( argp < argc ) {
+                eventsFile = argv[argp++];
+                if ( !mhs5200EventsEnabled() ) {
+                    throw string("Error: events requires a build configured with -DMHS5200_TRACE=BINARY.");
+                }
+            } else {
+                raise_expected_more_argments(argv[cmdarg]);
+            }
+        };
+        
+        commandParser["--model"] = [&](int argc, const char *argv[])->void {
+            int cmdarg = argp++;
+            if ( argp < argc ) {
+                const char *arg = argv[argp++];
+                MHS5200Model model;
+                if ( strcmp(arg, "auto") == 0 ) {
+                    probeModel = true;
+                } else if ( mhs5200ParseModel(arg, model) ) {
+                    signalGenerator.setModel(model);
+                } else {
+                    raise_expected_argument(argv[cmdarg], "<model>", "MHS-5206A, MHS-5212A, MHS-5220A, MHS-5225A or auto", arg);
+                }
+            } else {
+                raise_expected_more_argments(argv[cmdarg]);
+            }
+        };
+        
+        commandParser["--dry-run"] = [&](int argc, const char *argv[])->void {
+            int cmdarg = argp++;
+            dryRun = true;
+            if ( argp < argc && strcmp(argv[argp], "--latency") == 0 ) {
+                argp++;
+                if ( argp >= argc ) {
+                    raise_expected_more_argments(argv[cmdarg]);
+                }
+                const char *arg = argv[argp++];
+                char end;
+                if ( sscanf(arg, "%lf,%lf%c", &dryRunLatency[0], &dryRunLatency[1], &end) != 2 || dryRunLatency[0] < 0 || dryRunLatency[1] < 0 ) {
+                    raise_expected_argument(argv[cmdarg], "<read ms,set ms>", "two latencies such as 1.5,2.4", arg);
+                }
+            }
+        };
+        
+        commandParser["--sync"] = [&](int argc, const char *argv[])->void {
+            int cmdarg = argp++;
+            if ( argp < argc ) {
+                if ( commitViaSlots ) {
+                    throw string("Error: commit --slots does not cover --sync.");
+                }
+                syncDeviceNames.push_back(argv[argp++]);
+            } else {
+                raise_expected_more_argments(argv[cmdarg]);
+            }
+        };
+        
+        commandParser["reconnect"] = [&](int argc, const char *argv[])->void {
+            int cmdarg = argp++;
+            if ( argp < argc ) {
+                const char *arg = argv[argp++];
+                int64_t timeout;
+                if ( !parseDuration(arg, timeout) || timeout < 1000 ) {
+                    raise_expected_argument(argv[cmdarg], "<timeout>", "a duration such as 30s", arg);
+                }
+                signalGenerator.setAutoReconnect((int)(timeout/1000));
+            } else {
+                raise_expected_more_argments(argv[cmdarg]);
+            }
+        };
+        
+        commandParser["queue"] = [&](int argc, const char *argv[])->void {
+            int cmdarg = argp++;
+            if ( argp < argc ) {
+                const char *arg = argv[argp++];
+                int64_t timeout;
+                if ( !parseDuration(arg, timeout) || timeout < 1000 ) {
+                    raise_expected_argument(argv[cmdarg], "<timeout>", "a duration such as 30s", arg);
+                }
+                signalGenerator.setQueuedAccess((int)(timeout/1000));
+            } else {
+                raise_expected_more_argments(argv[cmdarg]);
+            }
+        };
+        
+        commandParser["verify"] = [&](int argc, const char *argv[])->void {
+            int cmdarg = argp++;
+            if ( argp < argc ) {
+                const char *arg = argv[argp++];
+                int every;
+                if ( strcmp(arg, "none") == 0 ) {
+                    signalGenerator.setVerifyPolicy(MHS5200Driver::VerifyNone);
+                } else if ( strcmp(arg, "always") == 0 ) {
+                    signalGenerator.setVerifyPolicy(MHS5200Driver::VerifyAlways);
+                } else if ( strcmp(arg, "critical") == 0 ) {
+                    signalGenerator.setVerifyPolicy(MHS5200Driver::VerifyCritical);
+                } else if ( parseInt(arg, every) && every >= 1 ) {
+                    signalGenerator.setVerifyPolicy(MHS5200Driver::VerifySampled, every);
+                } else {
+                    raise_expected_argument(argv[cmdarg], "<policy>", "none, always, critical or n for one set in n", arg);
+                }
+            } else {
+                raise_expected_more_argments(argv[cmdarg]);
+            }
+        };
+        
+        commandParser["faults"] = [&](int argc, const char *argv[])->void {
+            int cmdarg = argp++;
+            if ( argp < argc ) {
+                const char *arg = argv[argp++];
+                double rate;
+                if ( !parseDouble(arg, rate) || rate < 0 || rate >= 1 ) {
+                    raise_expected_argument(argv[cmdarg], "<loss rate>", "0 to 0.99", arg);
+                }
+                signalGenerator.setFaultInjection(rate);
+            } else {
+                raise_expected_more_argments(argv[cmdarg]);
+            }
+        };
+        
+        commandParser["stats"] = [&](int argc, const char *argv[])->void {
+            argp++;
+            commandChain.push_back([&]() {
+                const MHS5200Driver::LinkStatistics &stats = signalGenerator.getStatistics();
+                printf("Link: %llu commands, %llu retries, %llu timeouts, %llu discarded, %llu flushes, %llu failures, %llu injected faults, %llu reconnects\n",
+                       (unsigned long long)stats.commands, (unsigned long long)stats.retries, (unsigned long long)stats.timeouts,
+                       (unsigned long long)stats.discardedFrames, (unsigned long long)stats.flushes, (unsigned long long)stats.failures,
+                       (unsigned long long)stats.injectedFaults, (unsigned long long)stats.reconnects);
+                double wireRate = signalGenerator.wireBytesPerSecond();
+                printf("Transmit: %llu bytes in %llu writes, %llu partial, %llu drains, ", (unsigned long long)stats.bytesWritten,
+                       (unsigned long long)stats.writes, (unsigned long long)stats.partialWrites, (unsigned long long)stats.drains);
+                if ( wireRate < 0 ) printf("wire rate not measured (line speed %.0f bytes/s)\n", 1000000.0 / signalGenerator.wireMicrosPerByte());
+                else printf("%.0f bytes/s on the wire (line speed %.0f bytes/s)\n", wireRate, 1000000.0 / signalGenerator.wireMicrosPerByte());
+                if ( stats.lockWaits )
+                    printf("Lock: waited %.1fms for other users of the device\n", stats.lockWaitMicros/1000.0);
+                if ( stats.verified )
+                    printf("Verify: %llu settings read back, %llu mismatches\n", (unsigned long long)stats.verified,
+                           (unsigned long long)stats.verifyMismatches);
+                const char *classNames[] = { "read", "set", "arb" };
+                const char *classCommands[] = { ":r1f\n", ":s1f1\n", ":a00\n" };
+                for ( int i = 0; i < MHS5200Driver::CommandClasses; i++ ) {
+                    double p50 = signalGenerator.latencyQuantile(i, 0.5);
+                    double p999 = signalGenerator.latencyQuantile(i, 0.999);
+                    double timeout = signalGenerator.responseTimeoutMicros(classCommands[i]) / 1000.0;
+                    if ( p50 < 0 )
+                        printf("Latency %-4s: too few samples, timeout %.1fms\n", classNames[i], timeout);
+                    else
+                        printf("Latency %-4s: p50 %.2fms, p99.9 %.2fms, timeout %.1fms\n", classNames[i], p50/1000, p999/1000, timeout);
+                }
+                const char *priorityNames[] = { "urgent", "normal", "bulk" };
+                for ( int i = 0; i < MHS5200Driver::PriorityClasses; i++ ) {
+                    const MHS5200Driver::SchedulerStatistics &queue = signalGenerator.getSchedulerStatistics(i);
+                    if ( queue.commands == 0 ) continue;
+                    printf("Queue %-6s: %llu commands, mean %.2fms, max %.2fms, %llu past deadline\n", priorityNames[i],
+                           (unsigned long long)queue.commands, queue.totalQueueMicros/1000.0/queue.commands,
+                           queue.maxQueueMicros/1000.0, (unsigned long long)queue.deadlineMisses);
+                }
+            });
+        };
+        
         commandParser["channel"] = [&](int argc, const char *argv[])->void {
             int cmdarg = argp++;
             if ( argp < argc ) {
@@ -201,6 +611,11 @@ int main( int argc, const char *argv[] )
         commandParser["inverse"] = [&](int argc, const char *argv[])->void {
             argp++;
             commandChain.push_back([&]() {
+                if ( staging ) {
+                    staged.channels[currentChannel-1].inverted = true;
+                    stagedFields |= MHS5200Driver::fieldMask(currentChannel, MHS5200Driver::FieldInverted);
+                    return;
+                }
                 if ( !signalGenerator.getInverted(currentChannel) ) 
                     signalGenerator.setInverted(currentChannel, true);
             });
@@ -209,6 +624,12 @@ int main( int argc, const char *argv[] )
         commandParser["sine"] = [&](int argc, const char *argv[])->void {
             argp++;
             commandChain.push_back([&]() {
+                if ( staging ) {
+                    staged.channels[currentChannel-1].wave = MHS5200Driver::WaveType::Sine;
+                    staged.channels[currentChannel-1].inverted = false;
+                    stagedFields |= MHS5200Driver::fieldMask(currentChannel, MHS5200Driver::FieldWave) | MHS5200Driver::fieldMask(currentChannel, MHS5200Driver::FieldInverted);
+                    return;
+                }
                 if ( signalGenerator.getInverted(currentChannel) ) 
                     signalGenerator.setInverted(currentChannel, false);
                 
@@ -219,6 +640,12 @@ int main( int argc, const char *argv[] )
         commandParser["square"] = [&](int argc, const char *argv[])->void {
             argp++;
             commandChain.push_back([&]() {
+                if ( staging ) {
+                    staged.channels[currentChannel-1].wave = MHS5200Driver::WaveType::Square;
+                    staged.channels[currentChannel-1].inverted = false;
+                    stagedFields |= MHS5200Driver::fieldMask(currentChannel, MHS5200Driver::FieldWave) | MHS5200Driver::fieldMask(currentChannel, MHS5200Driver::FieldInverted);
+                    return;
+                }
                 if ( signalGenerator.getInverted(currentChannel) ) 
                     signalGenerator.setInverted(currentChannel, false);
                 
@@ -229,6 +656,12 @@ int main( int argc, const char *argv[] )
         commandParser["triangle"] = [&](int argc, const char *argv[])->void {
             argp++;
             commandChain.push_back([&]() {
+                if ( staging ) {
+                    staged.channels[currentChannel-1].wave = MHS5200Driver::WaveType::Triangle;
+                    staged.channels[currentChannel-1].inverted = false;
+                    stagedFields |= MHS5200Driver::fieldMask(currentChannel, MHS5200Driver::FieldWave) | MHS5200Driver::fieldMask(currentChannel, MHS5200Driver::FieldInverted);
+                    return;
+                }
                 if ( signalGenerator.getInverted(currentChannel) ) 
                     signalGenerator.setInverted(currentChannel, false);
                 
@@ -239,6 +672,12 @@ int main( int argc, const char *argv[] )
         commandParser["saw"] = [&](int argc, const char *argv[])->void {
             argp++;
             commandChain.push_back([&]() {
+                if ( staging ) {
+                    staged.channels[currentChannel-1].wave = MHS5200Driver::WaveType::Sawtooth;
+                    staged.channels[currentChannel-1].inverted = false;
+                    stagedFields |= MHS5200Driver::fieldMask(currentChannel, MHS5200Driver::FieldWave) | MHS5200Driver::fieldMask(currentChannel, MHS5200Driver::FieldInverted);
+                    return;
+                }
                 if ( signalGenerator.getInverted(currentChannel) ) 
                     signalGenerator.setInverted(currentChannel, false);
                 
@@ -249,13 +688,19 @@ int main( int argc, const char *argv[] )
         commandParser["sawreverse"] = [&](int argc, const char *argv[])->void {
             argp++;
             commandChain.push_back([&]() {
+                if ( staging ) {
+                    staged.channels[currentChannel-1].wave = MHS5200Driver::WaveType::SawtoothReverse;
+                    staged.channels[currentChannel-1].inverted = false;
+                    stagedFields |= MHS5200Driver::fieldMask(currentChannel, MHS5200Driver::FieldWave) | MHS5200Driver::fieldMask(currentChannel, MHS5200Driver::FieldInverted);
+                    return;
+                }
                 if ( signalGenerator.getInverted(currentChannel) ) 
                     signalGenerator.setInverted(currentChannel, false);
                 
                 signalGenerator.setWaveType(currentChannel, MHS5200Driver::WaveType::SawtoothReverse);
             });
         };        
-
+        
         commandParser["arb"] = [&](int argc, const char *argv[])->void {
             int cmdarg = argp++;
             if ( argp < argc ) {
@@ -265,9 +710,15 @@ int main( int argc, const char *argv[] )
                 if ( !parseInt(arg, arb) || arb < 0 || arb > 15 ) {
                     raise_expected_argument(argv[cmdarg], "<slot #>", "0-15", arg);
                 }
-        
+                
                 MHS5200Driver::WaveType wave = (MHS5200Driver::WaveType)((int)MHS5200Driver::WaveType::Arbitrary0+arb);
                 commandChain.push_back([&,wave]() {
+                    if ( staging ) {
+                        staged.channels[currentChannel-1].wave = wave;
+                        staged.channels[currentChannel-1].inverted = false;
+                        stagedFields |= MHS5200Driver::fieldMask(currentChannel, MHS5200Driver::FieldWave) | MHS5200Driver::fieldMask(currentChannel, MHS5200Driver::FieldInverted);
+                        return;
+                    }
                     if ( signalGenerator.getInverted(currentChannel) ) 
                         signalGenerator.setInverted(currentChannel, false);
                     signalGenerator.setWaveType(currentChannel, wave);
@@ -286,8 +737,13 @@ int main( int argc, const char *argv[] )
                 if ( !parseInt(arg, val) || val < -120 || val > 120 ) {
                     raise_expected_argument(argv[cmdarg], "<relative percent>", "-120 to 120", arg);
                 }
-        
+                
                 commandChain.push_back([&,val]() {
+                    if ( staging ) {
+                        staged.channels[currentChannel-1].offset = val;
+                        stagedFields |= MHS5200Driver::fieldMask(currentChannel, MHS5200Driver::FieldOffset);
+                        return;
+                    }
                     signalGenerator.setOffset(currentChannel, val);
                 });
             } else {
@@ -300,12 +756,17 @@ int main( int argc, const char *argv[] )
             if ( argp < argc ) {
                 const char *arg = argv[argp++];
                 int val;
-
+                
                 if ( !parseInt(arg, val) || val < 0 || val > 359 ) {
                     raise_expected_argument(argv[cmdarg], "<phase angle>", "0-359", arg);
                 }
-        
+                
                 commandChain.push_back([&,val]() {
+                    if ( staging ) {
+                        staged.channels[currentChannel-1].phaseOffset = val;
+                        stagedFields |= MHS5200Driver::fieldMask(currentChannel, MHS5200Driver::FieldPhaseOffset);
+                        return;
+                    }
                     signalGenerator.setPhaseOffset(currentChannel, val);
                 });
             } else {
@@ -318,12 +779,19 @@ int main( int argc, const char *argv[] )
             if ( argp < argc ) {
                 const char *arg = argv[argp++];
                 double val;
-
-                if ( !parseDouble(arg, val) || val < 0.005 || val > 20.00 ) {
-                    raise_expected_argument(argv[cmdarg], "<peak to peak volts>", "0.005 to 20.00", arg);
+                
+                // The range is exclusive, as in the driver's check.
+                const MHS5200ModelLimits &limits = signalGenerator.getLimits();
+                if ( !parseDouble(arg, val) || val <= limits.minAmplitude || val >= limits.maxAmplitude ) {
+                    raise_expected_argument(argv[cmdarg], "<peak to peak volts>", amplitudeRange(limits).c_str(), arg);
                 }
                 
                 commandChain.push_back([&,val]() {
+                    if ( staging ) {
+                        staged.channels[currentChannel-1].amplitude = val;
+                        stagedFields |= MHS5200Driver::fieldMask(currentChannel, MHS5200Driver::FieldAmplitude);
+                        return;
+                    }
                     signalGenerator.setAmplitude(currentChannel, val);
                 });
             } else {
@@ -336,30 +804,41 @@ int main( int argc, const char *argv[] )
             if ( argp < argc ) {
                 const char *arg = argv[argp++];
                 double val;
-
+                
                 if ( !parseDouble(arg, val) || val < 0.1 || val > 99.9 ) {
                     raise_expected_argument(argv[cmdarg], "<duty percentage>", "0.1 to 99.9", arg);
                 }
                 
                 commandChain.push_back([&,val]() {
+                    if ( staging ) {
+                        staged.channels[currentChannel-1].dutyCycle = val;
+                        stagedFields |= MHS5200Driver::fieldMask(currentChannel, MHS5200Driver::FieldDutyCycle);
+                        return;
+                    }
                     signalGenerator.setDutyCycle(currentChannel, val);
                 });
             } else {
                 raise_expected_more_argments(argv[cmdarg]);
             }            
         };
-
+        
         commandParser["frequency"] = [&](int argc, const char *argv[])->void {
             int cmdarg = argp++;
             if ( argp < argc ) {
                 const char *arg = argv[argp++];
                 double val;
-
-                if ( !parseDouble(arg, val) || val < 0.01 || val > 25000000.0 ) {
-                    raise_expected_argument(argv[cmdarg], "<frequency in hz>", "0.01 to 25MHz", arg);
+                
+                const MHS5200ModelLimits &limits = signalGenerator.getLimits();
+                if ( !parseDouble(arg, val) || val < limits.minFrequency || val > limits.maxFrequency ) {
+                    raise_expected_argument(argv[cmdarg], "<frequency in hz>", frequencyRange(limits).c_str(), arg);
                 }
                 
                 commandChain.push_back([&,val]() {
+                    if ( staging ) {
+                        staged.channels[currentChannel-1].frequency = val;
+                        stagedFields |= MHS5200Driver::fieldMask(currentChannel, MHS5200Driver::FieldFrequency);
+                        return;
+                    }
                     signalGenerator.setFrequency(currentChannel, val);
                 });
             } else {
@@ -373,34 +852,23 @@ int main( int argc, const char *argv[] )
                 const char *arg0 = argv[argp++];
                 const char *arg1 = argv[argp++];                
                 int arb;
-                int values[1024];
+                shared_ptr< vector<int> > values = make_shared< vector<int> >(MHS5200_ARB_VALUES);
                 if ( !parseInt(arg0, arb) || arb < 0 || arb > 15 ) {
                     raise_expected_argument(argv[cmdarg], "<slot #>", "0-15", arg0);
                 }
-
-                try
-                {
-                    std::ifstream csvfile(arg1);
-                    std::string line;
-                    int p = 0;
-                    while (std::getline(csvfile, line) && p < 1024)
-                    {
-                        std::istringstream iss(line);
-                        int value;
-                        if ( iss >> value ) {
-                            values[p++] = value;
-                        } else {
-                            throw line;
-                        }
+                
+                std::string error;
+                int maxSample = signalGenerator.getLimits().maxSample;
+                if ( MHS5200WavePipeline::isExpression(arg1) ) {
+                    if ( !MHS5200WavePipeline::evaluate(arg1, values->data(), error, maxSample) ) {
+                        throw error;
                     }
-                }
-                catch(...) 
-                {
-                    raise_error_parsing_file(argv[cmdarg], arg1);
+                } else if ( !MHS5200Bank::parseWaveform(arg1, values->data(), error, maxSample) ) {
+                    throw error;
                 }
                 
                 commandChain.push_back([&,arb,values]() {
-                    signalGenerator.setArbitrary(arb, values);
+                    signalGenerator.setArbitrary(arb, values->data());
                 });
             } else {
                 raise_expected_more_argments(argv[cmdarg]);
@@ -409,6 +877,310 @@ int main( int argc, const char *argv[] )
         
         commandParser["freq"] = commandParser["frequency"];
         
+        commandParser["program-bank"] = [&](int argc, const char *argv[])->void {
+            int cmdarg = argp++;
+            if ( argp < argc ) {
+                const char *arg = argv[argp++];
+                int window = 2;
+                if ( argp < argc && strcmp(argv[argp], "--window") == 0 ) {
+                    argp++;
+                    if ( argp >= argc ) {
+                        raise_expected_more_argments(argv[cmdarg]);
+                    }
+                    if ( !parseInt(argv[argp], window) || window < 1 || window > 16 ) {
+                        raise_expected_argument(argv[cmdarg], "<chunks in flight>", "1 to 16", argv[argp]);
+                    }
+                    argp++;
+                }
+                
+                // Files are parsed and validated now, in parallel, so errors are reported before anything is sent.
+                shared_ptr<MHS5200Bank> bank = make_shared<MHS5200Bank>();
+                std::string error;
+                if ( !bank->loadManifest(arg, error) || !bank->parseFiles(0, error) ) {
+                    throw error;
+                }
+                
+                commandChain.push_back([&,bank,window]() {
+                    MHS5200Bank::Report report;
+                    bool ok = bank->upload(signalGenerator, window, report);
+                    printf("Bank: %d slots, %d bytes, parse %.1fms, upload %.1fms (%.0f bytes/s)%s\n", report.slots, report.bytes, 
+                           report.parseMillis, report.uploadMillis, report.bytesPerSecond, ok ? "" : ", FAILED");
+                    for ( int i = 0; i < MHS5200_BANK_SLOTS; i++ ) {
+                        const MHS5200Bank::Slot &slot = bank->slot(i);
+                        if ( !slot.used ) continue;
+                        printf("  %2d: parse %6.2fms  encode %6.3fms  upload %7.1fms  %5d bytes  %s\n", i, slot.parseMillis, 
+                               slot.encodeMillis, slot.uploadMillis, slot.bytes, slot.fileName.c_str());
+                    }
+                });
+            } else {
+                raise_expected_more_argments(argv[cmdarg]);
+            }
+        };
+        
+        commandParser["stream"] = [&](int argc, const char *argv[])->void {
+            int cmdarg = argp++;
+            if ( (argp+1) < argc ) {
+                const char *arg0 = argv[argp++];
+                const char *arg1 = argv[argp++];
+                int64_t segmentMicros;
+                int firstSlot = 14, slots = 2;
+                if ( argp < argc && strcmp(argv[argp], "--slots") == 0 ) {
+                    argp++;
+                    if ( argp >= argc ) {
+                        raise_expected_more_argments(argv[cmdarg]);
+                    }
+                    char end;
+                    if ( sscanf(argv[argp], "%d-%d%c", &firstSlot, &slots, &end) != 2 || firstSlot < 0 || slots <= firstSlot || slots > 15 ) {
+                        raise_expected_argument(argv[cmdarg], "<first-last>", "a range of at least two slots such as 12-15", argv[argp]);
+                    }
+                    slots = slots - firstSlot + 1;
+                    argp++;
+                }
+                
+                shared_ptr<MHS5200ArbitraryStream> stream = make_shared<MHS5200ArbitraryStream>(signalGenerator);
+                std::string error;
+                if ( !stream->load(arg0, error) ) {
+                    throw error;
+                }
+                if ( !parseDuration(arg1, segmentMicros) ) {
+                    raise_expected_argument(argv[cmdarg], "<segment time>", "a duration such as 2s", arg1);
+                }
+                stream->setSlots(firstSlot, slots);
+                
+                commandChain.push_back([&,stream,segmentMicros,slots]() {
+                    MHS5200ArbitraryStream::Report report;
+                    int64_t upload = stream->segmentUploadMicros();
+                    if ( upload > segmentMicros )
+                        printf("Warning: a segment takes about %.0fms to upload, segments after the first %d will be late.\n", upload/1000.0, slots);
+                    signal(SIGINT, requestStop);
+                    signal(SIGTERM, requestStop);
+                    bool ok = stream->run(currentChannel, segmentMicros, report, &g_stopRequested);
+                    printf("Stream: %d/%d segments on air, %d underruns, %.3f segments/s achieved, %.3f requested\n", report.switched,
+                           report.segments, report.underruns, report.achievedRate, report.targetRate);
+                    printf("Upload: %.1fms per segment, switch acknowledged %.1fms after its time on average, %.1fms at most\n",
+                           report.uploadMeanMillis, report.lateMeanMillis, report.lateMaxMillis);
+                    if ( !ok ) printf("Stream incomplete.\n");
+                });
+            } else {
+                raise_expected_more_argments(argv[cmdarg]);
+            }
+        };
+        
+        commandParser["fsk"] = [&](int argc, const char *argv[])->void {
+            int cmdarg = argp++;
+            bool realtime = false;
+            if ( argp < argc && strcmp(argv[argp], "--realtime") == 0 ) {
+                realtime = true;
+                argp++;
+            }
+            if ( (argp+2) < argc ) {
+                const char *arg0 = argv[argp++];
+                const char *arg1 = argv[argp++];
+                const char *arg2 = argv[argp++];
+                double rate;
+                vector<double> alphabet;
+                vector<int> symbols;
+                
+                if ( !parseDouble(arg0, rate) || rate <= 0 || rate > 10000 ) {
+                    raise_expected_argument(argv[cmdarg], "<symbols per second>", "0 to 10000", arg0);
+                }
+                
+                std::istringstream list(arg1);
+                std::string item;
+                while ( std::getline(list, item, ',') ) {
+                    double hz;
+                    const MHS5200ModelLimits &limits = signalGenerator.getLimits();
+                    if ( !parseDouble(item.c_str(), hz) || hz < limits.minFrequency || hz > limits.maxFrequency ) {
+                        raise_expected_argument(argv[cmdarg], "<hz,hz,...>", (frequencyRange(limits) + " each").c_str(), arg1);
+                    }
+                    alphabet.push_back(hz);
+                }
+                if ( alphabet.empty() || alphabet.size() > MHS5200_HOP_MAX_SYMBOLS ) {
+                    raise_expected_argument(argv[cmdarg], "<hz,hz,...>", "1 to 36 frequencies", arg1);
+                }
+                
+                for ( const char *p = arg2; *p; p++ ) {
+                    int symbol = isdigit(*p) ? *p-'0' : (isalpha(*p) ? tolower(*p)-'a'+10 : -1);
+                    if ( symbol < 0 || symbol >= (int)alphabet.size() ) {
+                        raise_expected_argument(argv[cmdarg], "<symbols>", "digits/letters indexing the frequency list", arg2);
+                    }
+                    symbols.push_back(symbol);
+                }
+                
+                commandChain.push_back([&,rate,alphabet,symbols,realtime]() {
+                    MHS5200HopEngine hop(signalGenerator);
+                    MHS5200HopEngine::Report report;
+                    if ( !hop.setAlphabet(currentChannel, alphabet.data(), (int)alphabet.size()) ) return;
+                    if ( rate > hop.maxSymbolRate() )
+                        printf("Warning: %.1f symbols/s exceeds the link capacity of about %.1f symbols/s.\n", rate, hop.maxSymbolRate());
+                    bool ok = hop.run(symbols.data(), (int)symbols.size(), rate, realtime, report);
+                    printf("FSK: %d/%d symbols sent, %d acknowledged, %d overruns%s\n", report.symbolsSent, (int)symbols.size(), report.acknowledged, report.overruns, report.realtime ? ", SCHED_FIFO" : "");
+                    printf("Rate: %.2f symbols/s achieved, %.2f requested\n", report.achievedRate, report.targetRate);
+                    printf("Timing error: mean %.0fus, p50 %.0fus, p99 %.0fus, max %.0fus\n", report.errorMeanMicros, report.errorP50Micros, report.errorP99Micros, report.errorMaxMicros);
+                    printf("Acknowledgement latency: p50 %.0fus, p99 %.0fus\n", report.ackLatencyP50Micros, report.ackLatencyP99Micros);
+                    if ( !ok ) printf("FSK run incomplete.\n");
+                });
+            } else {
+                raise_expected_more_argments(argv[cmdarg]);
+            }
+        };
+        
+        commandParser["begin"] = [&](int argc, const char *argv[])->void {
+            argp++;
+            if ( inBegin ) {
+                throw string("Error: begin inside begin.");
+            }
+            inBegin = true;
+            commandChain.push_back([&]() {
+                staging = true;
+                stagedFields = 0;
+            });
+        };
+        
+        commandParser["commit"] = [&](int argc, const char *argv[])->void {
+            argp++;
+            if ( !inBegin ) {
+                throw string("Error: commit without begin.");
+            }
+            inBegin = false;
+            bool viaSlots = false;
+            if ( argp < argc && strcmp(argv[argp], "--slots") == 0 ) {
+                argp++;
+                if ( !syncDeviceNames.empty() ) {
+                    throw string("Error: commit --slots does not cover --sync.");
+                }
+                viaSlots = true;
+                commitViaSlots = true;
+            }
+            commandChain.push_back([&,viaSlots]() {
+                MHS5200Driver::CommitReport report;
+                staging = false;
+                if ( !syncGenerators.empty() ) {
+                    MHS5200SyncGroup group;
+                    MHS5200SyncGroup::Report syncReport;
+                    group.add(signalGenerator);
+                    for ( auto &generator : syncGenerators )
+                        group.add(*generator);
+                    for ( int unit = 0; unit < group.units(); unit++ ) {
+                        if ( !group.prepare(unit, staged, stagedFields) ) {
+                            printf("Commit failed.\n");
+                            return;
+                        }
+                    }
+                    bool ok = group.trigger(syncReport);
+                    printf("Commit: %d generators, %d/%d frames acknowledged, release spread %.0fus, skew %.0fus, all acknowledged within %.0fus\n",
+                           syncReport.units, syncReport.acknowledged, syncReport.frames, syncReport.releaseSpreadMicros,
+                           syncReport.skewMicros, syncReport.ackSpreadMicros);
+                    if ( !ok ) printf("Commit failed.\n");
+                    return;
+                }
+                bool ok;
+                if ( viaSlots ) {
+                    MHS5200Driver::ProfilePlan plan;
+                    ok = signalGenerator.applyProfile(staged, stagedFields, &plan, &report);
+                    if ( plan.slot >= 0 )
+                        printf("Profile: load slot %d and %d frames, estimated %.1fms instead of %.1fms with sets only\n", plan.slot,
+                               plan.frames, plan.estimatedMicros/1000.0, plan.directMicros/1000.0);
+                    else
+                        printf("Profile: %d frames, estimated %.1fms, no indexed slot is cheaper\n", plan.frames, plan.estimatedMicros/1000.0);
+                    if ( ok && plan.fields == 0 ) return;
+                } else {
+                    ok = signalGenerator.commit(staged, stagedFields, &report);
+                }
+                if ( !ok ) {
+                    printf("Commit failed.\n");
+                } else if ( report.retried ) {
+                    printf("Commit: %d frames, %d bytes, resent after missing acknowledgements.\n", report.frames, report.bytes);
+                } else {
+                    printf("Commit: %d frames, %d bytes, channel skew %.0fus (wire %.0fus), all updates within %.0fus\n",
+                           report.frames, report.bytes, report.skewMicros, report.estimatedSkewMicros, report.spanMicros);
+                }
+            });
+        };
+        
+        commandParser["watch"] = [&](int argc, const char *argv[])->void {
+            int cmdarg = argp++;
+            int64_t interval = 100000;
+            if ( argp < argc && strcmp(argv[argp], "--interval") == 0 ) {
+                argp++;
+                if ( argp >= argc ) {
+                    raise_expected_more_argments(argv[cmdarg]);
+                }
+                const char *arg = argv[argp++];
+                if ( !parseDuration(arg, interval) ) {
+                    raise_expected_argument(argv[cmdarg], "<interval>", "a duration such as 100ms", arg);
+                }
+            }
+            
+            commandChain.push_back([&,interval]() {
+                watchDevice(signalGenerator, interval);
+            });
+        };
+        
+        commandParser["loadtest"] = [&](int argc, const char *argv[])->void {
+            int cmdarg = argp++;
+            int64_t duration = 0;
+            int operations = 0;
+            int mix[MHS5200LoadTest::OpTypes] = { 80, 18, 2 };
+            while ( argp < argc && strncmp(argv[argp], "--", 2) == 0 ) {
+                const char *option = argv[argp++];
+                if ( argp >= argc ) {
+                    raise_expected_more_argments(argv[cmdarg]);
+                }
+                const char *arg = argv[argp++];
+                if ( strcmp(option, "--duration") == 0 ) {
+                    if ( !parseDuration(arg, duration) ) {
+                        raise_expected_argument(argv[cmdarg], "<duration>", "a duration such as 60s", arg);
+                    }
+                } else if ( strcmp(option, "--ops") == 0 ) {
+                    if ( !parseInt(arg, operations) || operations < 1 ) {
+                        raise_expected_argument(argv[cmdarg], "<operations>", "1 or more", arg);
+                    }
+                } else if ( strcmp(option, "--mix") == 0 ) {
+                    if ( sscanf(arg, "%d,%d,%d", &mix[0], &mix[1], &mix[2]) != 3 || mix[0] < 0 || mix[1] < 0 || mix[2] < 0 ||
+                         mix[0] + mix[1] + mix[2] == 0 ) {
+                        raise_expected_argument(argv[cmdarg], "<reads,sets,uploads>", "three weights such as 80,18,2", arg);
+                    }
+                } else {
+                    argp -= 2;
+                    break;
+                }
+            }
+            if ( duration == 0 && operations == 0 ) duration = 10000000;
+            
+            commandChain.push_back([&,duration,operations,mix]() {
+                MHS5200LoadTest test(signalGenerator);
+                MHS5200LoadTest::Report report;
+                test.setMix(mix[0], mix[1], mix[2]);
+                signal(SIGINT, requestStop);
+                signal(SIGTERM, requestStop);
+                bool ok = test.run(duration, operations, report, &g_stopRequested);
+                printf("Loadtest: %llu operations in %.2fs, %.1f ops/s, %.0f bytes/s on the wire\n", (unsigned long long)report.operations,
+                       report.seconds, report.operationsPerSecond, report.bytesPerSecond);
+                printf("Errors: %llu (%.2f%%), %llu timeouts, %llu retries\n", (unsigned long long)report.errors,
+                       report.operations ? 100.0*report.errors/report.operations : 0.0, (unsigned long long)report.timeouts,
+                       (unsigned long long)report.retries);
+                const char *typeNames[] = { "read", "set", "arb" };
+                for ( int i = 0; i < MHS5200LoadTest::OpTypes; i++ ) {
+                    const MHS5200LoadTest::OpReport &op = report.types[i];
+                    if ( op.operations == 0 ) continue;
+                    printf("  %-4s: %7llu ops, %5llu errors, %9llu bytes, p50 %.2fms, p90 %.2fms, p99 %.2fms, max %.2fms\n", typeNames[i],
+                           (unsigned long long)op.operations, (unsigned long long)op.errors, (unsigned long long)op.bytes,
+                           op.p50Micros/1000, op.p90Micros/1000, op.p99Micros/1000, op.maxMicros/1000);
+                }
+                if ( !ok ) printf("Loadtest: not every operation succeeded.\n");
+            });
+        };
+        
+        commandParser["--slot-index"] = [&](int argc, const char *argv[])->void {
+            int cmdarg = argp++;
+            if ( argp < argc ) {
+                slotIndexFile = argv[argp++];
+            } else {
+                raise_expected_more_argments(argv[cmdarg]);
+            }
+        };
+        
         commandParser["store"] = [&](int argc, const char *argv[])->void {
             int cmdarg = argp++;
             if ( argp < argc ) {
@@ -418,7 +1190,7 @@ int main( int argc, const char *argv[] )
                 if ( !parseInt(arg, val) || val < 0 || val > 9 ) {
                     raise_expected_argument(argv[cmdarg], "<slot #>", "0 to 9", arg);
                 }
-        
+                
                 commandChain.push_back([&,val]() {
                     signalGenerator.saveSettings(val);
                 });
@@ -436,7 +1208,7 @@ int main( int argc, const char *argv[] )
                 if ( !parseInt(arg, val) || val < 0 || val > 9 ) {
                     raise_expected_argument(argv[cmdarg], "<slot #>", "0 to 9", arg);
                 }
-        
+                
                 commandChain.push_back([&,val]() {
                     signalGenerator.loadSettings(val);
                 });
@@ -445,9 +1217,83 @@ int main( int argc, const char *argv[] )
             }
         };        
         
+        if ( argp < argc && strcmp(argv[argp], "--replay") == 0 ) {
+            argp++;
+            if ( argp >= argc ) {
+                raise_expected_more_argments("--replay");
+            }
+            const char *traceFile = argv[argp++];
+            double speed = 1.0;
+            if ( argp < argc && strcmp(argv[argp], "--speed") == 0 ) {
+                argp++;
+                if ( argp >= argc ) {
+                    raise_expected_more_argments("--speed");
+                }
+                if ( !parseDouble(argv[argp], speed) || speed < 0 ) {
+                    raise_expected_argument("--speed", "<factor>", "1 for recorded timing, 0 for no delay", argv[argp]);
+                }
+                argp++;
+            }
+            
+            MHS5200Replay replay;
+            if ( !replay.open(traceFile) ) return 1;
+            printf("%s\n", replay.deviceName());
+            fflush(stdout);
+            long mismatches = replay.run(speed);
+            if ( mismatches != 0 ) {
+                fprintf(stderr, "Replay: %ld bytes differ from the recording.\n", mismatches);
+                return 1;
+            }
+            return 0;
+        }
+        
+        if ( argp < argc && strcmp(argv[argp], "--fake") == 0 ) {
+            argp++;
+            double loss = 0;
+            if ( argp < argc && strcmp(argv[argp], "--loss") == 0 ) {
+                argp++;
+                if ( argp >= argc ) {
+                    raise_expected_more_argments("--loss");
+                }
+                if ( !parseDouble(argv[argp], loss) || loss < 0 || loss >= 1 ) {
+                    raise_expected_argument("--loss", "<rate>", "0 to 0.99", argv[argp]);
+                }
+                argp++;
+            }
+            
+            if ( !fakeDevice.open() ) return 1;
+            fakeDevice.setLossRate(loss);
+            printf("%s\n", fakeDevice.deviceName());
+            fflush(stdout);
+            return fakeDevice.run() < 0 ? 1 : 0;
+        }
+        
+        if ( argp < argc && strcmp(argv[argp], "--discover") == 0 ) {
+            argp++;
+            vector<string> candidates(argv + argp, argv + argc);
+            auto found = MHS5200Driver::discover(candidates);
+            for ( auto &device : found ) {
+                printf("%s\t%s\t%.1fms\n", device.deviceName.c_str(), device.identity.c_str(), device.latencyMicros/1000.0);
+            }
+            return found.empty() ? 1 : 0;
+        }
+        
+        string discovered;
         if ( argp < argc ) {
-            if ( argv[argp][0] != '-' )
+            if ( argv[argp][0] != '-' ) {
                 deviceName = argv[argp++];
+                if ( strcmp(deviceName, "fake") == 0 ) {
+                    if ( !fakeDevice.open() || !fakeDevice.start() ) return 1;
+                    deviceName = fakeDevice.deviceName();
+                } else if ( strcmp(deviceName, "auto") == 0 ) {
+                    auto found = MHS5200Driver::discover();
+                    if ( found.empty() ) {
+                        throw string("Error: No signal generator found.");
+                    }
+                    discovered = found[0].deviceName;
+                    deviceName = discovered.c_str();
+                }
+            }
         } else {
             throw string("Error: Expected device name as first parameter.");
         }
@@ -463,10 +1309,68 @@ int main( int argc, const char *argv[] )
             i->second(argc, argv);
         }
         
-        if ( signalGenerator.connect(deviceName) ) {
+        if ( inBegin ) {
+            throw string("Error: begin without commit.");
+        }
+        
+        // Opening the trace truncates it, an error further on the line must not cost an earlier recording.
+        if ( traceOutputFile && !signalGenerator.setTraceFile(traceOutputFile) ) {
+            raise_expected_argument("trace", "<file>", "a writable file name", traceOutputFile);
+        }
+        
+        // A dry run uses the slot index without recording stores.
+        if ( slotIndexFile && !signalGenerator.setSlotIndex(slotIndexFile, !dryRun) ) {
+            return 1;
+        }
+        
+        if ( dryRun ) {
+            // The commands run against the fake device, so every frame including the reads hidden in the commands
+            // is the one the driver would send. Values read are the fake's, commands that only send a frame when
+            // the device differs (inverse, the wave forms) may send one more or less on the real device.
+            if ( !syncDeviceNames.empty() ) {
+                throw string("Error: --dry-run does not cover --sync.");
+            }
+            if ( !fakeDevice.open() ) return 1;
+            fakeDevice.setInstant(true);
+            fakeDevice.setTiming(MHS5200_FAKE_BAUD, (int)(dryRunLatency[0]*1000), (int)(dryRunLatency[1]*1000));
+            fakeDevice.setLog(stdout);
+            if ( !fakeDevice.start() ) return 1;
+            printf("Dry run of %s:\n", deviceName);
+            deviceName = fakeDevice.deviceName();
+        }
+        
+        if ( !signalGenerator.connect(deviceName) ) {
+            return 1;
+        } else {
+            if ( probeModel && !signalGenerator.probeModel() ) {
+                fprintf(stderr, "Model not reported by the device, using the %s limits.\n", signalGenerator.getLimits().name);
+            }
+            for ( auto name : syncDeviceNames ) {
+                unique_ptr<MHS5200Driver> generator(new MHS5200Driver());
+                generator->setModel(signalGenerator.getLimits().model);
+                if ( !generator->connect(name) ) return 1;
+                syncGenerators.push_back(move(generator));
+            }
             currentChannel = signalGenerator.getCurrentChannel();            
             for ( auto &cmd : commandChain )
                 cmd();
+            if ( signalGenerator.verifyPending() != 0 ) {
+                printf("Verify: not all settings read back as set.\n");
+                return 1;
+            }
+            if ( dryRun ) {
+                fakeDevice.stop();
+                const MHS5200FakeDevice::Statistics &plan = fakeDevice.getStatistics();
+                printf("Plan: %llu frames (%llu queries, %llu sets, %llu wave chunks), %llu bytes sent, %llu received, %llu round trips\n",
+                       (unsigned long long)plan.frames, (unsigned long long)plan.queries,
+                       (unsigned long long)(plan.frames - plan.queries - plan.chunks), (unsigned long long)plan.chunks,
+                       (unsigned long long)plan.bytesReceived, (unsigned long long)plan.bytesSent, (unsigned long long)plan.roundTrips);
+                printf("Estimated time: %.1fms at %d baud with %.2fms per query and %.2fms per set\n", plan.linkMicros/1000.0,
+                       MHS5200_FAKE_BAUD, dryRunLatency[0], dryRunLatency[1]);
+            }
+        }
+        if ( eventsFile && !mhs5200EventsDump(eventsFile) ) {
+            return 1;
         }
     } catch ( string &s ) {
         cout << s.c_str() << endl;
@@ -0,0 +1,268 @@
+// Command line front end of the minimal build profile (-DMHS5200_MINIMAL=ON) for small controllers.
+// A static command table and a fixed array of steps replace the parser of main.cpp. There are no exceptions
+// and no iostreams, and the front end allocates nothing after parsing the command line. The driver still does on
+// every command, its requests carry a std::string and a std::function in a std::deque.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "mhs5200.hpp"
+
+#define MHS5200_MINIMAL_MAX_STEPS 64
+
+struct Step;
+
+struct Context {
+    MHS5200Driver driver;
+    int currentChannel;
+};
+
+typedef bool (*StepHandler)(Context &context, const Step &step);
+
+struct Step {
+    StepHandler run;
+    int intValue;
+    double doubleValue;
+};
+
+enum ArgumentKind { ArgumentNone, ArgumentInt, ArgumentDouble, ArgumentFrequency, ArgumentAmplitude };
+
+struct Command {
+    const char *name;
+    ArgumentKind argument;
+    double minimum;
+    double maximum;
+    const char *expected;   // Shown when the argument is invalid.
+    StepHandler run;
+    int parameter;          // Added to an int argument, the value of commands without argument.
+};
+
+static char s_stdoutBuffer[BUFSIZ];
+static Step s_steps[MHS5200_MINIMAL_MAX_STEPS];
+
+static const char *waveName( int wave, char *buffer, size_t size ) {
+    static const char *names[] = { "Sine", "Square", "Tri", "Saw", "SawRev" };
+    if ( wave >= 0 && wave <= 4 ) return names[wave];
+    int arbitrary = wave - (int)MHS5200Driver::WaveType::Arbitrary0;
+    // Unknown is what a failed read returns.
+    if ( arbitrary < 0 || arbitrary > 15 ) return "Unknown";
+    snprintf(buffer, size, "Arb%d", arbitrary);
+    return buffer;
+}
+
+static bool runChannel( Context &context, const Step &step ) {
+    context.currentChannel = step.intValue;
+    return true;
+}
+
+static bool runStatus( Context &context, const Step & ) {
+    MHS5200Driver &driver = context.driver;
+    for ( int channel = 1; channel <= 2; channel++ ) {
+        char buffer[8];
+        printf("%d: %c%-6s %6.3fV  %11.2fHz  %4.1f%% Duty  %3d° Phase  %4d%% Offset\n", channel, driver.getInverted(channel) ? '~' : ' ',
+               waveName((int)driver.getWaveType(channel), buffer, sizeof(buffer)), driver.getAmplitude(channel), driver.getFrequency(channel),
+               driver.getDutyCycle(channel), driver.getPhaseOffset(channel), driver.getOffset(channel));
+    }
+    return true;
+}
+
+static bool runOutput( Context &context, const Step &step ) {
+    MHS5200Driver &driver = context.driver;
+    int activeChannel = driver.getCurrentChannel();
+    if ( context.currentChannel != activeChannel && !driver.setCurrentChannel(context.currentChannel) ) return false;
+    bool ok = driver.setCurrentChannelStatus(step.intValue != 0);
+    if ( context.currentChannel != activeChannel ) driver.setCurrentChannel(activeChannel);
+    return ok;
+}
+
+static bool runActive( Context &context, const Step & ) {
+    if ( context.driver.getCurrentChannel() == context.currentChannel ) return true;
+    return context.driver.setCurrentChannel(context.currentChannel);
+}
+
+static bool runInverse( Context &context, const Step & ) {
+    if ( context.driver.getInverted(context.currentChannel) ) return true;
+    return context.driver.setInverted(context.currentChannel, true);
+}
+
+static bool runWave( Context &context, const Step &step ) {
+    if ( context.driver.getInverted(context.currentChannel) && !context.driver.setInverted(context.currentChannel, false) ) return false;
+    return context.driver.setWaveType(context.currentChannel, (MHS5200Driver::WaveType)step.intValue);
+}
+
+static bool runOffset( Context &context, const Step &step ) {
+    return context.driver.setOffset(context.currentChannel, step.intValue);
+}
+
+static bool runPhase( Context &context, const Step &step ) {
+    return context.driver.setPhaseOffset(context.currentChannel, step.intValue);
+}
+
+static bool runAmplitude( Context &context, const Step &step ) {
+    return context.driver.setAmplitude(context.currentChannel, step.doubleValue);
+}
+
+static bool runDuty( Context &context, const Step &step ) {
+    return context.driver.setDutyCycle(context.currentChannel, step.doubleValue);
+}
+
+static bool runFrequency( Context &context, const Step &step ) {
+    return context.driver.setFrequency(context.currentChannel, step.doubleValue);
+}
+
+static bool runStore( Context &context, const Step &step ) {
+    return context.driver.saveSettings(step.intValue);
+}
+
+static bool runLoad( Context &context, const Step &step ) {
+    return context.driver.loadSettings(step.intValue);
+}
+
+static const Command s_commands[] = {
+    { "channel", ArgumentInt, 1, 2, "1/2", runChannel, 0 },
+    { "status", ArgumentNone, 0, 0, nullptr, runStatus, 0 },
+    { "on", ArgumentNone, 0, 0, nullptr, runOutput, 1 },
+    { "off", ArgumentNone, 0, 0, nullptr, runOutput, 0 },
+    { "active", ArgumentNone, 0, 0, nullptr, runActive, 0 },
+    { "inverse", ArgumentNone, 0, 0, nullptr, runInverse, 0 },
+    { "sine", ArgumentNone, 0, 0, nullptr, runWave, (int)MHS5200Driver::WaveType::Sine },
+    { "square", ArgumentNone, 0, 0, nullptr, runWave, (int)MHS5200Driver::WaveType::Square },
+    { "triangle", ArgumentNone, 0, 0, nullptr, runWave, (int)MHS5200Driver::WaveType::Triangle },
+    { "saw", ArgumentNone, 0, 0, nullptr, runWave, (int)MHS5200Driver::WaveType::Sawtooth },
+    { "sawreverse", ArgumentNone, 0, 0, nullptr, runWave, (int)MHS5200Driver::WaveType::SawtoothReverse },
+    { "arb", ArgumentInt, 0, 15, "0-15", runWave, (int)MHS5200Driver::WaveType::Arbitrary0 },
+    { "offset", ArgumentInt, -120, 120, "-120 to 120", runOffset, 0 },
+    { "phase", ArgumentInt, 0, 359, "0-359", runPhase, 0 },
+    { "amplitude", ArgumentAmplitude, 0, 0, nullptr, runAmplitude, 0 },
+    { "duty", ArgumentDouble, 0.1, 99.9, "0.1 to 99.9", runDuty, 0 },
+    { "freq", ArgumentFrequency, 0, 0, nullptr, runFrequency, 0 },
+    { "frequency", ArgumentFrequency, 0, 0, nullptr, runFrequency, 0 },
+    { "store", ArgumentInt, 0, 9, "0 to 9", runStore, 0 },
+    { "load", ArgumentInt, 0, 9, "0 to 9", runLoad, 0 }
+};
+
+static void usage( const char *program ) {
+    printf("Usage: %s <tty device> [--model <name|auto>] [debug] <command list>\n\n", program);
+    printf("Minimal build, commands:");
+    for ( auto &command : s_commands )
+        printf(" %s", command.name);
+    printf("\nSee the full build for their description.\n");
+}
+
+static bool parseNumber( const char *str, double &value ) {
+    char *p = nullptr;
+    value = strtod(str, &p);
+    return p != nullptr && p != str && *p == 0;
+}
+
+int main( int argc, const char *argv[] )
+{
+    static Context context;
+    int steps = 0;
+    bool probeModel = false;
+    
+    // Output goes through a static buffer, stdio would allocate one on the first printf.
+    setvbuf(stdout, s_stdoutBuffer, _IOLBF, sizeof(s_stdoutBuffer));
+    
+    if ( argc < 2 || strcmp(argv[1], "-?") == 0 || strcmp(argv[1], "--help") == 0 ) {
+        usage(argv[0]);
+        return argc < 2 ? 1 : 0;
+    }
+    const char *deviceName = argv[1];
+    
+    // Everything is validated before the device is touched, like the full command line.
+    for ( int argp = 2; argp < argc; ) {
+        const char *name = argv[argp++];
+        if ( strcmp(name, "debug") == 0 ) {
+            context.driver.setDebugOutput(true);
+            continue;
+        }
+        if ( strcmp(name, "--model") == 0 ) {
+            MHS5200Model model;
+            // The settings are checked against the limits of the model as they are parsed.
+            if ( steps > 0 ) {
+                printf("Error: --model must come before the commands.\n");
+                return 1;
+            }
+            if ( argp >= argc ) {
+                printf("Error: --model Expected more arguments.\n");
+                return 1;
+            }
+            const char *arg = argv[argp++];
+            if ( strcmp(arg, "auto") == 0 ) {
+                probeModel = true;
+            } else if ( mhs5200ParseModel(arg, model) ) {
+                context.driver.setModel(model);
+            } else {
+                printf("Error: Invalid argument for --model. Expected MHS-5206A, MHS-5212A, MHS-5220A, MHS-5225A or auto. %s not accepted.\n", arg);
+                return 1;
+            }
+            continue;
+        }
+        
+        const Command *command = nullptr;
+        for ( auto &candidate : s_commands ) {
+            if ( strcmp(candidate.name, name) == 0 ) {
+                command = &candidate;
+                break;
+            }
+        }
+        if ( !command ) {
+            printf("Error: Invalid argument %s\n", name);
+            return 1;
+        }
+        if ( steps >= MHS5200_MINIMAL_MAX_STEPS ) {
+            printf("Error: More than %d commands.\n", MHS5200_MINIMAL_MAX_STEPS);
+            return 1;
+        }
+        
+        Step &step = s_steps[steps++];
+        step.run = command->run;
+        step.intValue = command->parameter;
+        step.doubleValue = 0;
+        if ( command->argument == ArgumentNone ) continue;
+        if ( argp >= argc ) {
+            printf("Error: %s Expected more arguments.\n", name);
+            return 1;
+        }
+        const char *arg = argv[argp++];
+        const MHS5200ModelLimits &limits = context.driver.getLimits();
+        double minimum = command->minimum, maximum = command->maximum;
+        if ( command->argument == ArgumentFrequency ) {
+            minimum = limits.minFrequency;
+            maximum = limits.maxFrequency;
+        }
+        double value;
+        bool valid = parseNumber(arg, value);
+        // The amplitude range is exclusive, as in the driver's check.
+        if ( command->argument == ArgumentAmplitude ) valid = valid && value > limits.minAmplitude && value < limits.maxAmplitude;
+        else valid = valid && value >= minimum && value <= maximum;
+        if ( valid && command->argument == ArgumentInt ) valid = value == (int)value;
+        if ( !valid ) {
+            if ( command->argument == ArgumentFrequency )
+                printf("Error: Invalid argument for %s. Expected %g to %gMHz on %s. %s not accepted.\n", name, minimum,
+                       maximum/1000000.0, limits.name, arg);
+            else if ( command->argument == ArgumentAmplitude )
+                printf("Error: Invalid argument for %s. Expected %g to %gV exclusive on %s. %s not accepted.\n", name,
+                       limits.minAmplitude, limits.maxAmplitude, limits.name, arg);
+            else
+                printf("Error: Invalid argument for %s. Expected %s. %s not accepted.\n", name, command->expected, arg);
+            return 1;
+        }
+        step.intValue += (int)value;
+        step.doubleValue = value;
+    }
+    
+    if ( !context.driver.connect(deviceName) ) return 1;
+    if ( probeModel && !context.driver.probeModel() ) {
+        fprintf(stderr, "Model not reported by the device, using the %s limits.\n", context.driver.getLimits().name);
+    }
+    context.currentChannel = context.driver.getCurrentChannel();
+    for ( int i = 0; i < steps; i++ ) {
+        if ( !s_steps[i].run(context, s_steps[i]) ) {
+            printf("Error: Command %d failed.\n", i+1);
+            return 1;
+        }
+    }
+    return 0;
+}
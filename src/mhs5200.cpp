@@ -8,17 +8,43 @@
 #include <unistd.h>
 #include <ctype.h>
 #include <stdarg.h>
+#include <time.h>
+#include <poll.h>
 #include <sys/ioctl.h>
+#include <sys/eventfd.h>
 #include "mhs5200.hpp"
+#include "mhs5200events.hpp"
 
-MHS5200Driver::MHS5200Driver() : m_fileDescriptor(0), m_maxAmplitude(20), m_attenuationMax(2), 
-    m_minAmplitude(0.005), m_baudRate(B57600), m_outputDebugInfo(false) 
+MHS5200Driver::MHS5200Driver() : m_fileDescriptor(0), m_readLength(0), m_needResync(false), 
+    m_maxRetries(3), m_attemptTimeoutMs(1000), m_backoffInitialMs(10), m_backoffMaxMs(200), m_faultRate(0), m_faultSeed(1), 
+    m_limits(mhs5200ModelLimits(MHS5200Model::MHS5225A)), m_baudRate(B57600), m_outputDebugInfo(false), 
+    m_unsentFrames(0), m_outputOffset(0), m_queueSampleMicros(0), m_queueSampleBytes(0), m_queueSampleLeft(0), m_resumeMicros(0), m_pipelineDepth(1), m_holdOutput(false), m_lastResponseMicros(0), 
+    m_timeoutFactor(4), m_timeoutFloorMs(20), m_failFastMisses(4), m_consecutiveMisses(0), 
+    m_reconnectTimeoutMs(0), m_verifyPolicy(VerifyNone), m_verifySampleEvery(10), m_verifyBatch(8), m_verifyCounter(0), 
+    m_bulkClearMicros(0), m_queueWaitMs(0), m_lockDirectory("/tmp"), m_lockFd(-1), m_slotIndexUpdate(false),
+    m_slotLoadMicros(-1), m_knownFields(0), m_loopDepth(0)
 {
+    memset(&m_statistics, 0, sizeof(m_statistics));
+    memset(m_latency, 0, sizeof(m_latency));
+    memset(m_latencySamples, 0, sizeof(m_latencySamples));
+    memset(m_scheduler, 0, sizeof(m_scheduler));
+    memset(m_slotStates, 0, sizeof(m_slotStates));
+    memset(m_slotFields, 0, sizeof(m_slotFields));
+    memset(&m_knownState, 0, sizeof(m_knownState));
+    m_deadlineMicros[PriorityUrgent] = 20000;
+    m_deadlineMicros[PriorityNormal] = 1000000;
+    m_deadlineMicros[PriorityBulk] = 10000000;
+    m_wakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    // There are fewer distinct settings than this, so the vectors never grow. The command path still allocates:
+    // a cached frame longer than the short string buffer, and every Request carries its command in a std::string
+    // and its completion in a std::function, queued in a std::deque.
+    m_settingsCache.reserve(32);
+    m_verifyPending.reserve(32);
 }
 
 MHS5200Driver::~MHS5200Driver() {
     if ( m_fileDescriptor ) disconnect();
-    
+    if ( m_wakeFd >= 0 ) close(m_wakeFd);
 }
 
 void MHS5200Driver::systemError(const char* fn, const char* msgFormat, ...) {
@@ -57,6 +83,9 @@ void MHS5200Driver::debugInfo(const char *type, int bufferLen, const char *buffe
 
 void MHS5200Driver::disconnect() {  
     if ( m_fileDescriptor ) {
+        failAll();
+        // Frames still in the output queue go out at the line settings they were written for.
+        drainOutput();
         if (tcsetattr(m_fileDescriptor, TCSANOW, &saveTTY) != 0) {
             systemError("tcsetattr", "Error from tcsetattr: %s\n", strerror(errno));
         }
@@ -65,10 +94,27 @@ void MHS5200Driver::disconnect() {
         }
         m_fileDescriptor = 0;
     }
+    // The TTY is closed before the next process in the queue is woken.
+    releaseDeviceLock();
+    m_deviceName.clear();
 }
 
 bool MHS5200Driver::connect(const char *deviceName) {
-    int fd = open(deviceName, O_RDWR | O_NOCTTY);
+    if ( m_queueWaitMs > 0 && !acquireDeviceLock(deviceName) ) return false;
+    if ( !openDevice(deviceName) ) {
+        releaseDeviceLock();
+        return false;
+    }
+    m_deviceName = deviceName;
+    m_settingsCache.clear();
+    m_verifyPending.clear();
+    return true;
+}
+
+bool MHS5200Driver::openDevice(const char *deviceName) {
+    // The event driven core needs non-blocking reads and writes, the blocking API waits with poll(). It
+    // also keeps open() from hanging on a port waiting for carrier while probing.
+    int fd = open(deviceName, O_RDWR | O_NOCTTY | O_NONBLOCK);
     if (fd < 0) {
         systemError("open", "Error opening %s: %s\n", deviceName, strerror(errno));
         return false;
@@ -81,9 +127,9 @@ bool MHS5200Driver::connect(const char *deviceName) {
         }
         return false;
     }
-
+    
     struct termios tty;
-
+    
     if (tcgetattr(fd, &saveTTY) < 0) {
         systemError("tcgetattr", "Error getting tty attributes from %s: %s\n", deviceName, strerror(errno));
         if ( close(fd) != 0 ) {
@@ -93,15 +139,15 @@ bool MHS5200Driver::connect(const char *deviceName) {
     }
     
     memcpy(&tty,&saveTTY,sizeof(tty));
-
-
+    
+    
     tty.c_cflag = CS8 | HUPCL | CREAD | CLOCAL | CRTSCTS;
     tty.c_iflag = IGNBRK;
     tty.c_lflag = 0;
     tty.c_oflag = 0;
     tty.c_cc[VMIN] = 1;
     tty.c_cc[VTIME] = 1;
-
+    
     cfsetospeed(&tty, (speed_t)m_baudRate);
     cfsetispeed(&tty, (speed_t)m_baudRate);
     
@@ -114,6 +160,10 @@ bool MHS5200Driver::connect(const char *deviceName) {
     }
     
     m_fileDescriptor = fd;
+    m_readLength = 0;
+    m_needResync = false;
+    // The device may have been switched off and on or changed by hand while it was closed.
+    m_knownFields = 0;
     return true;
 }
 
@@ -121,238 +171,741 @@ bool MHS5200Driver::isConnected() {
     return m_fileDescriptor != 0;
 }
 
+int MHS5200Driver::getFileDescriptor() {
+    return m_fileDescriptor;
+}
+
+bool MHS5200Driver::beginDirectAccess() {
+    if ( !m_fileDescriptor ) return false;
+    if ( pendingRequests() > 0 ) {
+        systemError("beginDirectAccess", "Error: %d commands are still pending\n", pendingRequests());
+        return false;
+    }
+    if ( !drainOutput() ) return false;
+    flushInput();
+    return true;
+}
+
+void MHS5200Driver::endDirectAccess(bool answered) {
+    if ( !m_fileDescriptor ) return;
+    drainOutput();
+    flushInput();
+    // A late ok would otherwise be matched to the next set.
+    if ( !answered ) m_needResync = true;
+}
+
+void MHS5200Driver::noteDirectWrite(const char *command, int len) {
+    cacheSetting(command, len);
+}
+
 bool MHS5200Driver::rawCommand(const char *command) {
     int len = strlen(command);
-    debugInfo("write", len, command);
-    if ( write(m_fileDescriptor, command, len) != len ) {
-        systemError("write", "Error from write, %s\n", strerror(errno));
-        return false;
+    int done = 0;
+    MHS5200_TRACE_IO(EventWrite, len, command);
+    while ( done < len ) {
+        sampleOutputQueue(monotonicMicros());
+        int n = write(m_fileDescriptor, command+done, len-done);
+        if ( n < 0 ) {
+            if ( errno == EINTR ) continue;
+            if ( errno == EAGAIN ) {
+                // The tty is opened non-blocking for the event driven core, wait for room in the output queue.
+                struct pollfd pfd;
+                pfd.fd = m_fileDescriptor;
+                pfd.events = POLLOUT;
+                pfd.revents = 0;
+                poll(&pfd, 1, m_attemptTimeoutMs);
+                continue;
+            }
+            systemError("write", "Error from write, %s\n", strerror(errno));
+            return false;
+        }
+        m_statistics.writes++;
+        m_statistics.bytesWritten += n;
+        if ( n < len-done ) m_statistics.partialWrites++;
+        done += n;
     }
-    if ( tcdrain(m_fileDescriptor) < 0 ) {
+    m_trace.record(MHS5200TraceRecord::TX, command, len);
+    // No tcdrain(), the response cannot come before the frame is out and the next frame may queue behind it.
+    return true;
+}
+
+bool MHS5200Driver::drainOutput() {
+    if ( !m_fileDescriptor ) return false;
+    m_statistics.drains++;
+    while ( tcdrain(m_fileDescriptor) < 0 ) {
+        if ( errno == EINTR ) continue;
         systemError("tcdrain", "Error from tcdrain: %s\n", strerror(errno));
         return false;
     }
     return true;
 }
 
-const char *MHS5200Driver::rawResponse(int timeout) {
-    int bytesRead = 0;
-    char buf[MHS5200_BUFFER_SIZE];
-    int ntries = 0;
+double MHS5200Driver::wireBytesPerSecond() {
+    if ( m_statistics.wireMicros == 0 ) return -1;
+    return m_statistics.wireBytes * 1000000.0 / m_statistics.wireMicros;
+}
+
+int64_t MHS5200Driver::monotonicMicros() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec*1000000 + ts.tv_nsec/1000;
+}
+
+bool MHS5200Driver::extractResponse(char *response) {
+    // Responses are framed by \n, anything that is neither :<value> nor ok is line noise and dropped.
+    for (;;) {
+        char *eol = (char *)memchr(m_readBuffer, '\n', m_readLength);
+        if ( !eol ) return false;
+        
+        int lineLen = (int)(eol - m_readBuffer);
+        int frameLen = lineLen + 1;
+        while ( lineLen > 0 && m_readBuffer[lineLen-1] == '\r' ) lineLen--;
+        
+        bool found = false;
+        if ( lineLen > 1 && m_readBuffer[0] == ':' && lineLen-1 < MHS5200_BUFFER_SIZE ) {
+            memcpy(response, &m_readBuffer[1], lineLen-1);
+            response[lineLen-1] = 0;
+            found = true;
+        } else if ( lineLen == 2 && strncmp(m_readBuffer, "ok", 2) == 0 ) {
+            strcpy(response, "ok");
+            found = true;
+        }
+        
+        m_readLength -= frameLen;
+        memmove(m_readBuffer, &m_readBuffer[frameLen], m_readLength);
+        if ( found ) return true;
+    }
+}
+
+bool MHS5200Driver::nextResponse(char *response) {
+    while ( extractResponse(response) ) {
+        if ( m_faultRate > 0 && (double)rand_r(&m_faultSeed)/RAND_MAX < m_faultRate ) {
+            m_statistics.injectedFaults++;
+            continue;
+        }
+        return true;
+    }
+    return false;
+}
+
+bool MHS5200Driver::receiveResponse(char *response, int timeoutMs) {
+    int64_t deadline = monotonicMicros() + (int64_t)timeoutMs*1000;
     
-    timeout *= 10;
-    while (bytesRead < sizeof(buf)-1)
+    for (;;)
     {
-        int rdlen = read(m_fileDescriptor, &buf[bytesRead], sizeof(buf) - 1 - bytesRead);
-        ntries++;        
+        if ( nextResponse(response) ) return true;
+        
+        if ( m_readLength >= (int)sizeof(m_readBuffer) ) {
+            // A full buffer without a frame boundary is garbage.
+            m_readLength = 0;
+        }
+        
+        int waitMs = -1;
+        if ( timeoutMs >= 0 ) {
+            int64_t remaining = deadline - monotonicMicros();
+            if ( remaining <= 0 ) return false;
+            waitMs = (int)((remaining+999)/1000);
+        }
+        
+        struct pollfd pfd;
+        pfd.fd = m_fileDescriptor;
+        pfd.events = POLLIN;
+        pfd.revents = 0;
+        int ready = poll(&pfd, 1, waitMs);
+        if ( ready < 0 ) {
+            if ( errno == EINTR ) continue;
+            systemError("poll", "Error from poll: %s\n", strerror(errno));
+            return false;
+        }
+        if ( ready == 0 ) continue;
+        
+        int rdlen = read(m_fileDescriptor, &m_readBuffer[m_readLength], sizeof(m_readBuffer) - m_readLength);
         if (rdlen > 0) {
-            debugInfo("read", rdlen, &buf[bytesRead]);
+            MHS5200_TRACE_IO(EventRead, rdlen, &m_readBuffer[m_readLength]);
+            m_trace.record(MHS5200TraceRecord::RX, &m_readBuffer[m_readLength], rdlen);
+            m_readLength += rdlen;
+        } else if (rdlen < 0) {
+            if ( errno == EINTR || errno == EAGAIN ) continue;
+            systemError("read", "Error from read: %d: %s\n", rdlen, strerror(errno));
+            return false;
+        } else {
+            systemError("read", "Device closed\n");
+            return false;
+        }
+    }
+}
+
+const char *MHS5200Driver::rawResponse(int timeout) {
+    if ( receiveResponse(m_responseBuffer, timeout < 0 ? -1 : timeout*1000) )
+        return m_responseBuffer;
+    if ( timeout >= 0 )
+        systemError("timeout", "Read failed after %d seconds\n", timeout);
+    return nullptr;
+}
+
+void MHS5200Driver::expectedResponse(const char *command, char *prefix) {
+    // Queries are answered with the query echoed ahead of the value, everything else with ok.
+    if ( command[0] == ':' && command[1] == 'r' && command[2] && command[3] && command[3] != '\n' ) {
+        prefix[0] = 'r';
+        prefix[1] = command[2];
+        prefix[2] = command[3];
+        prefix[3] = 0;
+    } else {
+        strcpy(prefix, "ok");
+    }
+}
+
+bool MHS5200Driver::matchesResponse(const char *response, const char *prefix) {
+    if ( prefix[0] == 'o' ) return strcmp(response, "ok") == 0;
+    return strncmp(response, prefix, 3) == 0;
+}
 
-            bytesRead += rdlen;
-            buf[bytesRead] = 0;
+void MHS5200Driver::flushInput() {
+    MHS5200_TRACE_EVENT(EventFlush, m_readLength);
+    m_statistics.flushes++;
+    m_readLength = 0;
+    if ( tcflush(m_fileDescriptor, TCIFLUSH) < 0 ) {
+        systemError("tcflush", "Error from tcflush: %s\n", strerror(errno));
+    }
+    m_needResync = false;
+}
+
+int MHS5200Driver::backoffMillis(int attempt) {
+    int delayMs = m_backoffInitialMs;
+    for ( int i = 1; i < attempt && delayMs < m_backoffMaxMs; i++ )
+        delayMs *= 2;
+    if ( delayMs > m_backoffMaxMs ) delayMs = m_backoffMaxMs;
+    return delayMs > 0 ? delayMs : 0;
+}
+void MHS5200Driver::setRetryPolicy(int maxRetries, int attemptTimeoutMs, int backoffInitialMs, int backoffMaxMs) {
+    m_maxRetries = maxRetries < 0 ? 0 : maxRetries;
+    m_attemptTimeoutMs = attemptTimeoutMs;
+    m_backoffInitialMs = backoffInitialMs;
+    m_backoffMaxMs = backoffMaxMs;
+}
+
+const MHS5200Driver::LinkStatistics &MHS5200Driver::getStatistics() {
+    return m_statistics;
+}
 
-            if ( sscanf((char *)&buf[0], ":%s\r\n", &m_responseBuffer[0]) > 0 ) {
-                return m_responseBuffer;
+void MHS5200Driver::resetStatistics() {
+    memset(&m_statistics, 0, sizeof(m_statistics));
+    m_queueSampleMicros = 0;
+    memset(m_scheduler, 0, sizeof(m_scheduler));
+}
+
+void MHS5200Driver::setFaultInjection(double responseLossRate, unsigned seed) {
+    m_faultRate = responseLossRate;
+    m_faultSeed = seed;
+}
+
+double MHS5200Driver::wireMicrosPerByte() {
+    int bitsPerSecond;
+    switch ( m_baudRate ) {
+        case B9600: bitsPerSecond = 9600; break;
+        case B19200: bitsPerSecond = 19200; break;
+        case B38400: bitsPerSecond = 38400; break;
+        case B115200: bitsPerSecond = 115200; break;
+        default: bitsPerSecond = 57600; break;
+    }
+    // Start bit, 8 data bits and a stop bit.
+    return 10.0 * 1000000.0 / bitsPerSecond;
+}
+
+unsigned MHS5200Driver::fieldMask(int channel, MHS5200Driver::StateField field) {
+    if ( field & FieldAllDevice ) return field;
+    return (unsigned)field << ((channel-1)*8);
+}
+
+int MHS5200Driver::fieldWireBytes(MHS5200Driver::StateField field) {
+    // Query ":r1x\n" plus response ":r1x<value>\r\n".
+    switch ( field ) {
+        case FieldInverted: return 5 + 7;
+        case FieldWave: return 5 + 8;
+        case FieldDutyCycle: return 5 + 9;
+        case FieldOffset: return 5 + 9;
+        case FieldPhaseOffset: return 5 + 9;
+        case FieldAmplitude: return (5 + 7) + (5 + 10);
+        case FieldFrequency: return 5 + 16;
+        case FieldCurrentChannel: return 5 + 7;
+        case FieldChannelStatus: return 5 + 7;
+        default: break;
+    }
+    return 0;
+}
+
+unsigned MHS5200Driver::readState(MHS5200Driver::DeviceState &state, unsigned fields) {
+    MHS5200_TRACE_CALL(readState);
+    char commands[MHS5200_MAX_BATCH][8];
+    const char *commandList[MHS5200_MAX_BATCH];
+    const char *responses[MHS5200_MAX_BATCH];
+    unsigned commandField[MHS5200_MAX_BATCH];
+    int count = 0;
+    
+    // Queue the queries cheapest first so the short replies come back before the long ones.
+    for ( unsigned field = FieldInverted; field <= FieldFrequency; field <<= 1 ) {
+        for ( int channel = 1; channel <= 2; channel++ ) {
+            unsigned mask = fieldMask(channel, (StateField)field);
+            if ( !(fields & mask) ) continue;
+            switch ( field ) {
+                case FieldInverted: sprintf(commands[count], ":r%cb\n", (channel==1?'a':'b')); break;
+                case FieldWave: sprintf(commands[count], ":r%dw\n", channel); break;
+                case FieldDutyCycle: sprintf(commands[count], ":r%dd\n", channel); break;
+                case FieldOffset: sprintf(commands[count], ":r%do\n", channel); break;
+                case FieldPhaseOffset: sprintf(commands[count], ":r%dp\n", channel); break;
+                case FieldAmplitude:
+                    sprintf(commands[count], ":r%dy\n", channel);
+                    commandField[count++] = mask;
+                    sprintf(commands[count], ":r%da\n", channel);
+                    break;
+                case FieldFrequency: sprintf(commands[count], ":r%df\n", channel); break;
             }
-            else if ( strstr((char *)&buf[0], "ok\r\n") ) {
-                strcpy(m_responseBuffer, "ok");
-                return m_responseBuffer;
+            commandField[count++] = mask;
+        }
+    }
+    if ( fields & FieldCurrentChannel ) {
+        strcpy(commands[count], ":r2b\n");
+        commandField[count++] = FieldCurrentChannel;
+    }
+    if ( fields & FieldChannelStatus ) {
+        strcpy(commands[count], ":r1b\n");
+        commandField[count++] = FieldChannelStatus;
+    }
+    
+    if ( count == 0 ) return 0;
+    for ( int i = 0; i < count; i++ )
+        commandList[i] = commands[i];
+    
+    rawBatch(commandList, count, responses);
+    unsigned result = 0;
+    bool attenuated[2] = { false, false };
+    bool attenuationRead[2] = { false, false };
+    
+    for ( int i = 0; i < count; i++ ) {
+        const char *r = responses[i];
+        if ( !r ) continue;
+        int channel, value, fraction;
+        char ch;
+        
+        if ( sscanf(r, "r%cb%d", &ch, &value) == 2 && (ch == 'a' || ch == 'b') ) {
+            state.channels[ch=='a'?0:1].inverted = value;
+        } else if ( sscanf(r, "r2b%d", &value) == 1 && commandField[i] == FieldCurrentChannel ) {
+            state.currentChannel = value;
+        } else if ( sscanf(r, "r1b%d", &value) == 1 && commandField[i] == FieldChannelStatus ) {
+            state.currentChannelStatus = value;
+        } else if ( sscanf(r, "r%dw%02d", &channel, &value) == 2 && channel >= 1 && channel <= 2 ) {
+            if ( value >= 10 && value <= 25 ) value += 22;
+            state.channels[channel-1].wave = (WaveType)value;
+        } else if ( sscanf(r, "r%dd%03d", &channel, &value) == 2 && channel >= 1 && channel <= 2 ) {
+            state.channels[channel-1].dutyCycle = (double)value/10.0;
+        } else if ( sscanf(r, "r%do%03d", &channel, &value) == 2 && channel >= 1 && channel <= 2 ) {
+            state.channels[channel-1].offset = value-120;
+        } else if ( sscanf(r, "r%dp%03d", &channel, &value) == 2 && channel >= 1 && channel <= 2 ) {
+            state.channels[channel-1].phaseOffset = value;
+        } else if ( sscanf(r, "r%dy%d", &channel, &value) == 2 && channel >= 1 && channel <= 2 ) {
+            attenuated[channel-1] = (value == 0);
+            attenuationRead[channel-1] = true;
+            continue;
+        } else if ( sscanf(r, "r%da%04d", &channel, &value) == 2 && channel >= 1 && channel <= 2 ) {
+            if ( !attenuationRead[channel-1] ) continue;
+            state.channels[channel-1].amplitude = value / (attenuated[channel-1] ? 1000.0 : 100.0);
+        } else if ( sscanf(r, "r%df%08d%02d", &channel, &value, &fraction) == 3 && channel >= 1 && channel <= 2 ) {
+            state.channels[channel-1].frequency = value + (double)fraction/100.0;
+        } else {
+            continue;
+        }
+        result |= commandField[i];
+    }
+    noteKnownState(state, result);
+    return result;
+}
+
+int MHS5200Driver::formatField(char *buffer, int channel, MHS5200Driver::StateField field, const MHS5200Driver::ChannelState &state) {
+    switch ( field ) {
+        case FieldInverted: return formatInverted(buffer, channel, state.inverted);
+        case FieldWave: return formatWaveType(buffer, channel, state.wave);
+        case FieldDutyCycle: return formatDutyCycle(buffer, channel, state.dutyCycle);
+        case FieldOffset: return formatOffset(buffer, channel, state.offset);
+        case FieldPhaseOffset: return formatPhaseOffset(buffer, channel, state.phaseOffset);
+        case FieldAmplitude: {
+            int len = formatAttenuation(buffer, channel, state.amplitude);
+            if ( len == 0 ) return 0;
+            return len + formatAmplitude(buffer+len, channel, state.amplitude);
+        }
+        case FieldFrequency:
+            if ( state.frequency < m_limits.minFrequency || state.frequency > m_limits.maxFrequency ) return 0;
+            return formatFrequency(buffer, channel, state.frequency);
+        default: break;
+    }
+    return 0;
+}
+
+bool MHS5200Driver::sameFieldValue(MHS5200Driver::StateField field, const MHS5200Driver::ChannelState &a, const MHS5200Driver::ChannelState &b) {
+    // Compare at the resolution the device stores.
+    switch ( field ) {
+        case FieldInverted: return a.inverted == b.inverted;
+        case FieldWave: return a.wave == b.wave;
+        case FieldDutyCycle: return (int)(a.dutyCycle*10.0) == (int)(b.dutyCycle*10.0);
+        case FieldOffset: return a.offset == b.offset;
+        case FieldPhaseOffset: return a.phaseOffset == b.phaseOffset;
+        case FieldAmplitude: {
+            double scaleA = a.amplitude < m_limits.attenuationMax ? 1000.0 : 100.0;
+            double scaleB = b.amplitude < m_limits.attenuationMax ? 1000.0 : 100.0;
+            return scaleA == scaleB && (int)(a.amplitude*scaleA+0.5) == (int)(b.amplitude*scaleB+0.5);
+        }
+        case FieldFrequency: return (int64_t)(a.frequency*100.0+0.5) == (int64_t)(b.frequency*100.0+0.5);
+        default: break;
+    }
+    return false;
+}
+
+bool MHS5200Driver::commit(const MHS5200Driver::DeviceState &target, unsigned fields, MHS5200Driver::CommitReport *report, bool skipUnchanged) {
+    MHS5200_TRACE_CALL(commit);
+    // Slow to fast: the frequency and phase frames go last so the two channels change back to back.
+    static const StateField order[] = { FieldWave, FieldInverted, FieldDutyCycle, FieldOffset, FieldAmplitude, FieldFrequency, FieldPhaseOffset };
+    char buffer[MHS5200_MAX_BATCH*MHS5200_BUFFER_SIZE];
+    int frameEnd[MHS5200_MAX_BATCH];
+    int frameChannel[MHS5200_MAX_BATCH];
+    StateField frameField[MHS5200_MAX_BATCH];
+    int64_t ackMicros[MHS5200_MAX_BATCH];
+    int frames = 0, len = 0;
+    CommitReport dummy;
+    
+    // The reads and the write below must not interleave with commands handed over by other threads.
+    bool handedOver;
+    enterLoop(nullptr, PriorityNormal, nullptr, handedOver);
+    struct Leave {
+        MHS5200Driver *driver;
+        ~Leave() { driver->leaveLoop(); }
+    } leave = { this };
+    if ( !report ) report = &dummy;
+    memset(report, 0, sizeof(*report));
+    
+    fields &= fieldMask(1, FieldAllChannel) | fieldMask(2, FieldAllChannel);
+    
+    // All reads happen before the first write, fields the driver knows are not read again.
+    if ( skipUnchanged ) {
+        DeviceState current = m_knownState;
+        unsigned known = m_knownFields & fields;
+        if ( known != fields ) known |= readState(current, fields & ~known);
+        for ( int channel = 1; channel <= 2; channel++ ) {
+            for ( unsigned field = FieldInverted; field <= FieldFrequency; field <<= 1 ) {
+                unsigned mask = fieldMask(channel, (StateField)field);
+                if ( (known & mask) && sameFieldValue((StateField)field, current.channels[channel-1], target.channels[channel-1]) ) {
+                    fields &= ~mask;
+                    report->skippedFields |= mask;
+                }
             }
-        } else if (rdlen < 0) {
-            systemError("read", "Error from read: %d: %s\n", rdlen, strerror(errno));
-            break;
-        } else if ( timeout >= 0 && ntries >= timeout )
-        {
-            systemError("timeout", "Read failed after %d seconds", timeout/10);
+        }
+    }
+    
+    for ( auto field : order ) {
+        for ( int channel = 1; channel <= 2; channel++ ) {
+            if ( !(fields & fieldMask(channel, field)) ) continue;
+            int start = len;
+            int flen = formatField(&buffer[len], channel, field, target.channels[channel-1]);
+            if ( flen == 0 ) {
+                systemError("commit", "Invalid value for channel %d\n", channel);
+                return false;
+            }
+            len += flen;
+            // Amplitude encodes two frames, each gets its own acknowledgement.
+            for ( int p = start; p < len; p++ ) {
+                if ( buffer[p] != '\n' ) continue;
+                if ( frames >= MHS5200_MAX_BATCH ) return false;
+                frameEnd[frames] = p+1;
+                frameChannel[frames] = channel;
+                frameField[frames] = field;
+                frames++;
+            }
+        }
+    }
+    buffer[len] = 0;
+    cacheSetting(buffer, len);
+    report->frames = frames;
+    report->bytes = len;
+    if ( frames == 0 ) return true;
+    
+    if ( m_needResync ) flushInput();
+    int64_t writeStart = monotonicMicros();
+    if ( !rawCommand(buffer) ) return false;
+    report->writeMicros = monotonicMicros() - writeStart;
+    
+    int acked = 0;
+    // The frames are on the wire already, each one still costs the device its set latency.
+    int64_t waitMicros = responseTimeoutMicros(":s1f\n") * frames;
+    if ( waitMicros > (int64_t)m_attemptTimeoutMs*1000 ) waitMicros = (int64_t)m_attemptTimeoutMs*1000;
+    int64_t deadline = monotonicMicros() + waitMicros;
+    while ( acked < frames ) {
+        int remainingMs = (int)((deadline - monotonicMicros())/1000);
+        if ( remainingMs < 0 ) remainingMs = 0;
+        if ( !receiveResponse(m_responseBuffer, remainingMs) ) {
+            m_statistics.timeouts++;
             break;
         }
-        /* repeat read to get full message */
-    } 
-    return nullptr;
+        if ( strcmp(m_responseBuffer, "ok") != 0 ) {
+            m_statistics.discardedFrames++;
+            continue;
+        }
+        ackMicros[acked++] = monotonicMicros();
+        m_consecutiveMisses = 0;
+        m_statistics.commands++;
+    }
+    
+    if ( acked < frames ) {
+        // Every set is absolute, resending the whole group is safe. The skew is unknown in that case.
+        m_needResync = true;
+        report->retried = true;
+        m_statistics.retries++;
+        const char *commands[MHS5200_MAX_BATCH];
+        const char *responses[MHS5200_MAX_BATCH];
+        char copy[MHS5200_MAX_BATCH][MHS5200_BUFFER_SIZE];
+        int start = 0;
+        for ( int i = 0; i < frames; i++ ) {
+            memcpy(copy[i], &buffer[start], frameEnd[i]-start);
+            copy[i][frameEnd[i]-start] = 0;
+            commands[i] = copy[i];
+            start = frameEnd[i];
+        }
+        if ( rawBatch(commands, frames, responses) != frames ) return false;
+        noteKnownState(target, fields);
+        return true;
+    }
+    
+    noteKnownState(target, fields);
+    noteVerification(buffer, len);
+    verifyIfDue();
+    
+    // The device handles the frames in order, the time between the acknowledgements of the same
+    // parameter on both channels is how long the outputs disagreed.
+    report->spanMicros = (double)(ackMicros[frames-1] - ackMicros[0]);
+    for ( auto field : order ) {
+        int last[2] = { -1, -1 };
+        for ( int i = 0; i < frames; i++ ) {
+            if ( frameField[i] == field ) last[frameChannel[i]-1] = i;
+        }
+        if ( last[0] < 0 || last[1] < 0 ) continue;
+        int first = last[0] < last[1] ? last[0] : last[1];
+        int second = last[0] < last[1] ? last[1] : last[0];
+        double skew = (double)(ackMicros[second] - ackMicros[first]);
+        double wire = (frameEnd[second] - frameEnd[first]) * wireMicrosPerByte();
+        if ( skew > report->skewMicros ) report->skewMicros = skew;
+        if ( wire > report->estimatedSkewMicros ) report->estimatedSkewMicros = wire;
+    }
+    return true;
 }
 
 double MHS5200Driver::getFrequency(int channel) {
-    debugInfo("function", -1, __FUNCTION__);
+    MHS5200_TRACE_CALL(getFrequency);
     char buffer[MHS5200_BUFFER_SIZE];
     sprintf(buffer, ":r%df\n", channel);
-    if ( rawCommand(buffer) ) {
-        if ( rawResponse() ) {
-            int hz, fractHz;
-            if ( sscanf(m_responseBuffer, "r%df%08d%02d", &channel, &hz, &fractHz ) == 3 ) {
-                double result = hz;
-                result += (double)fractHz/100.0;
-                return result;
-            }
+    const char *response = transact(buffer);
+    if ( response ) {
+        int hz, fractHz;
+        if ( sscanf(response, "r%df%08d%02d", &channel, &hz, &fractHz ) == 3 ) {
+            double result = hz;
+            result += (double)fractHz/100.0;
+            return result;
         }
     }
     return 0;
 }
 
+int MHS5200Driver::formatFrequency(char *buffer, int channel, double hz) {
+    return sprintf(buffer, ":s%df%08d%02d\n", channel, (int)hz, (int)((hz-(int)hz)*100.0));
+}
+
 bool MHS5200Driver::setFrequency(int channel, double hz) {
-    debugInfo("function", -1, __FUNCTION__);
+    MHS5200_TRACE_CALL(setFrequency);
+    bool valid = mhs5200WithTraits(m_limits.model, [hz](auto traits) {
+        return decltype(traits)::validFrequency(hz);
+    });
+    if ( !valid ) {
+        systemError("setFrequency", "%.2fHz is out of range for the %s (%.2fHz to %.0fHz)\n", hz, m_limits.name,
+                    m_limits.minFrequency, m_limits.maxFrequency);
+        return false;
+    }
     char buffer[MHS5200_BUFFER_SIZE];
-    sprintf(buffer, ":s%df%08d%02d\n", channel, (int)hz, (int)((hz-(int)hz)*100.0));
-    if ( rawCommand(buffer) ) {
-        if ( rawResponse() ) {
-            if ( strcmp(m_responseBuffer, "ok") == 0 )
-                return true;
-        }
+    formatFrequency(buffer, channel, hz);
+    const char *response = transact(buffer);
+    if ( response ) {
+        if ( strcmp(response, "ok") == 0 )
+            return true;
     }
     return false;
 }
 
 double MHS5200Driver::getDutyCycle(int channel) {
-    debugInfo("function", -1, __FUNCTION__);
+    MHS5200_TRACE_CALL(getDutyCycle);
     char buffer[MHS5200_BUFFER_SIZE];
     sprintf(buffer, ":r%dd\n", channel);
-    if ( rawCommand(buffer) ) {
-        if ( rawResponse() ) {
-            int duty;
-            if ( sscanf(m_responseBuffer, "r%dd%03d", &channel, &duty) == 2 ) {
-                return (double)duty/10.0;
-            }
+    const char *response = transact(buffer);
+    if ( response ) {
+        int duty;
+        if ( sscanf(response, "r%dd%03d", &channel, &duty) == 2 ) {
+            return (double)duty/10.0;
         }
     }
     return -1;
 }
 
+int MHS5200Driver::formatDutyCycle(char *buffer, int channel, double dutyCycle) {
+    return sprintf(buffer, ":s%dd%03d\n", channel, (int)(dutyCycle*10.0));
+}
+
 bool MHS5200Driver::setDutyCycle(int channel, double dutyCycle) {
-    debugInfo("function", -1, __FUNCTION__);
+    MHS5200_TRACE_CALL(setDutyCycle);
     char buffer[MHS5200_BUFFER_SIZE];
-    sprintf(buffer, ":s%dd%03d\n", channel, (int)(dutyCycle*10.0));
-    if ( rawCommand(buffer) ) {
-        if ( rawResponse() ) {
-            if ( strcmp(m_responseBuffer, "ok") == 0 )
-                return true;
-        }
+    formatDutyCycle(buffer, channel, dutyCycle);
+    const char *response = transact(buffer);
+    if ( response ) {
+        if ( strcmp(response, "ok") == 0 )
+            return true;
     }
     return false;
 }
 
 MHS5200Driver::WaveType MHS5200Driver::getWaveType(int channel) {
-    debugInfo("function", -1, __FUNCTION__);
+    MHS5200_TRACE_CALL(getWaveType);
     char buffer[MHS5200_BUFFER_SIZE];
     sprintf(buffer, ":r%dw\n", channel);
-    if ( rawCommand(buffer) ) {
-        if ( rawResponse() ) {
-            MHS5200Driver::WaveType wave;
-            if ( sscanf(m_responseBuffer, "r%dw%02d", &channel, (int*)&wave) == 2 ) {
-                if ( (int)wave >= 10 && (int)wave <= 25 ) wave = (MHS5200Driver::WaveType)((int)wave+22);
-                return wave;
-            }
+    const char *response = transact(buffer);
+    if ( response ) {
+        MHS5200Driver::WaveType wave;
+        if ( sscanf(response, "r%dw%02d", &channel, (int*)&wave) == 2 ) {
+            if ( (int)wave >= 10 && (int)wave <= 25 ) wave = (MHS5200Driver::WaveType)((int)wave+22);
+            return wave;
         }
     }
     return MHS5200Driver::WaveType::Unknown;
 }
 
+int MHS5200Driver::formatWaveType(char *buffer, int channel, MHS5200Driver::WaveType wave) {
+    return sprintf(buffer, ":s%dw%d\n", channel, (int)wave);
+}
+
 bool MHS5200Driver::setWaveType(int channel, MHS5200Driver::WaveType wave) {
-    debugInfo("function", -1, __FUNCTION__);
+    MHS5200_TRACE_CALL(setWaveType);
     char buffer[MHS5200_BUFFER_SIZE];
-    sprintf(buffer, ":s%dw%d\n", channel, (int)wave);
-    if ( rawCommand(buffer) ) {
-        if ( rawResponse() ) {
-            if ( strcmp(m_responseBuffer, "ok") == 0 )
-                return true;
-        }
+    formatWaveType(buffer, channel, wave);
+    const char *response = transact(buffer);
+    if ( response ) {
+        if ( strcmp(response, "ok") == 0 )
+            return true;
     }
     return false;
 }
 
 int MHS5200Driver::getOffset(int channel) {
-    debugInfo("function", -1, __FUNCTION__);
+    MHS5200_TRACE_CALL(getOffset);
     char buffer[MHS5200_BUFFER_SIZE];
     sprintf(buffer, ":r%do\n", channel);
-    if ( rawCommand(buffer) ) {
-        if ( rawResponse() ) {
-            int offset;
-            if ( sscanf(m_responseBuffer, "r%do%03d", &channel, &offset) == 2 ) {
-                return offset-120;
-            }
+    const char *response = transact(buffer);
+    if ( response ) {
+        int offset;
+        if ( sscanf(response, "r%do%03d", &channel, &offset) == 2 ) {
+            return offset-120;
         }
     }
     return 0;
 }
 
+int MHS5200Driver::formatOffset(char *buffer, int channel, int offset) {
+    return sprintf(buffer, ":s%do%03d\n", channel, offset+120);
+}
+
 bool MHS5200Driver::setOffset(int channel, int offset) {
+    MHS5200_TRACE_CALL(setOffset);
     char buffer[MHS5200_BUFFER_SIZE];
-    sprintf(buffer, ":s%do%03d\n", channel, offset+120);
-    if ( rawCommand(buffer) ) {
-        if ( rawResponse() ) {
-            if ( strcmp(m_responseBuffer, "ok") == 0 )
-                return true;
-        }
+    formatOffset(buffer, channel, offset);
+    const char *response = transact(buffer);
+    if ( response ) {
+        if ( strcmp(response, "ok") == 0 )
+            return true;
     }
     return false;
 }
 
 int MHS5200Driver::getPhaseOffset(int channel) {
-    debugInfo("function", -1, __FUNCTION__);
+    MHS5200_TRACE_CALL(getPhaseOffset);
     char buffer[MHS5200_BUFFER_SIZE];
     sprintf(buffer, ":r%dp\n", channel);
-    if ( rawCommand(buffer) ) {
-        if ( rawResponse() ) {
-            int offset;
-            if ( sscanf(m_responseBuffer, "r%dp%03d", &channel, &offset) == 2 ) {
-                return offset;
-            }
+    const char *response = transact(buffer);
+    if ( response ) {
+        int offset;
+        if ( sscanf(response, "r%dp%03d", &channel, &offset) == 2 ) {
+            return offset;
         }
     }
     return 0;
 }
 
+int MHS5200Driver::formatPhaseOffset(char *buffer, int channel, int phaseOffset) {
+    return sprintf(buffer, ":s%dp%03d\n", channel, phaseOffset);
+}
+
 bool MHS5200Driver::setPhaseOffset(int channel, int phaseOffset) {
-    debugInfo("function", -1, __FUNCTION__);
+    MHS5200_TRACE_CALL(setPhaseOffset);
     char buffer[MHS5200_BUFFER_SIZE];
-    sprintf(buffer, ":s%dp%03d\n", channel, phaseOffset);
-    if ( rawCommand(buffer) ) {
-        if ( rawResponse() ) {
-            if ( strcmp(m_responseBuffer, "ok") == 0 )
-                return true;
-        }
+    formatPhaseOffset(buffer, channel, phaseOffset);
+    const char *response = transact(buffer);
+    if ( response ) {
+        if ( strcmp(response, "ok") == 0 )
+            return true;
     }
     return false;
 }
-    
+
 double MHS5200Driver::getAmplitude(int channel) {
-    debugInfo("function", -1, __FUNCTION__);
+    MHS5200_TRACE_CALL(getAmplitude);
     char buffer[MHS5200_BUFFER_SIZE];
     sprintf(buffer, ":r%dy\n", channel);
-    if ( rawCommand(buffer) ) {
-        if ( rawResponse() && strlen(m_responseBuffer) == 4 ) {
-            bool attenuated = (m_responseBuffer[3] == '0');
-            sprintf(buffer, ":r%da\n", channel);
-            if ( rawCommand(buffer) ) {
-                if ( rawResponse() ) {
-                    int volts;
-                    if ( sscanf(m_responseBuffer, "r%da%04d", &channel, &volts) == 2 ) {
-                        double result = volts;
-                        if ( attenuated ) result /= 1000.0;
-                        else result /= 100.0;
-                        return result;
-                    }
-                }
+    const char *response = transact(buffer);
+    if ( response && strlen(response) == 4 ) {
+        bool attenuated = (response[3] == '0');
+        sprintf(buffer, ":r%da\n", channel);
+        response = transact(buffer);
+        if ( response ) {
+            int volts;
+            if ( sscanf(response, "r%da%04d", &channel, &volts) == 2 ) {
+                double result = volts;
+                if ( attenuated ) result /= 1000.0;
+                else result /= 100.0;
+                return result;
             }
         }
-    }    
+    }
     return 0;
 }
 
+int MHS5200Driver::formatAttenuation(char *buffer, int channel, double amplitude) {
+    return mhs5200WithTraits(m_limits.model, [&](auto traits) {
+        typedef decltype(traits) Traits;
+        if ( !Traits::validAmplitude(amplitude) ) return 0;
+        return sprintf(buffer, ":s%dy%d\n", channel, Traits::attenuated(amplitude)?0:1);
+    });
+}
+
+int MHS5200Driver::formatAmplitude(char *buffer, int channel, double amplitude) {
+    return mhs5200WithTraits(m_limits.model, [&](auto traits) {
+        typedef decltype(traits) Traits;
+        if ( !Traits::validAmplitude(amplitude) ) return 0;
+        return sprintf(buffer, ":s%da%04d\n", channel, Traits::amplitudeUnits(amplitude));
+    });
+}
+
 bool MHS5200Driver::setAmplitude(int channel, double amplitude) {
-    debugInfo("function", -1, __FUNCTION__);
+    MHS5200_TRACE_CALL(setAmplitude);
     char buffer[MHS5200_BUFFER_SIZE];
-    if ( amplitude >= m_maxAmplitude || amplitude <= m_minAmplitude ) return false;
-    bool attenuate = amplitude < m_attenuationMax;
-    sprintf(buffer, ":s%dy%d\n", channel, attenuate?0:1);
-    if ( rawCommand(buffer) ) {
-        if ( rawResponse() ) {
-            if ( strcmp(m_responseBuffer, "ok") == 0 ) {
-                sprintf(buffer, ":s%da%04d\n", channel, (int)(amplitude*(attenuate?1000.0:100.0)));
-                if ( rawCommand(buffer) ) {
-                    if ( rawResponse() ) {
-                        if ( strcmp(m_responseBuffer, "ok") == 0 )
-                            return true;
-                    }
-                }
+    if ( !formatAttenuation(buffer, channel, amplitude) ) return false;
+    const char *response = transact(buffer);
+    if ( response ) {
+        if ( strcmp(response, "ok") == 0 ) {
+            formatAmplitude(buffer, channel, amplitude);
+            response = transact(buffer);
+            if ( response ) {
+                if ( strcmp(response, "ok") == 0 )
+                    return true;
             }
         }
     }
@@ -360,140 +913,208 @@ bool MHS5200Driver::setAmplitude(int channel, double amplitude) {
 }
 
 bool MHS5200Driver::getInverted(int channel) {
-    debugInfo("function", -1, __FUNCTION__);
+    MHS5200_TRACE_CALL(getInverted);
     char buffer[MHS5200_BUFFER_SIZE];
     sprintf(buffer, ":r%cb\n", (channel==1?'a':'b'));
-    if ( rawCommand(buffer) ) {
-        if ( rawResponse() ) {
-            int hz, fractHz;
-            char ch;
-            int inverted;
-            if ( sscanf(m_responseBuffer, "r%cb%d", &ch, &inverted) == 2 ) {
-                return inverted;
-            }
+    const char *response = transact(buffer);
+    if ( response ) {
+        int hz, fractHz;
+        char ch;
+        int inverted;
+        if ( sscanf(response, "r%cb%d", &ch, &inverted) == 2 ) {
+            return inverted;
         }
     }
     return false;
 }
 
+int MHS5200Driver::formatInverted(char *buffer, int channel, bool inverted) {
+    return sprintf(buffer, ":s%cb%d\n", (channel==1?'a':'b'), inverted?1:0);
+}
+
 bool MHS5200Driver::setInverted(int channel, bool inverted) {
-    debugInfo("function", -1, __FUNCTION__);
+    MHS5200_TRACE_CALL(setInverted);
     char buffer[MHS5200_BUFFER_SIZE];
-    sprintf(buffer, ":s%cb%d\n", (channel==1?'a':'b'), inverted?1:0);
-    if ( rawCommand(buffer) ) {
-        if ( rawResponse() ) {
-            if ( strcmp(m_responseBuffer, "ok") == 0 )
-                return true;
-        }
+    formatInverted(buffer, channel, inverted);
+    const char *response = transact(buffer);
+    if ( response ) {
+        if ( strcmp(response, "ok") == 0 )
+            return true;
     }
     return false;
 }
 
 int MHS5200Driver::getCurrentChannel() {
-    debugInfo("function", -1, __FUNCTION__);
+    MHS5200_TRACE_CALL(getCurrentChannel);
     char buffer[MHS5200_BUFFER_SIZE];
     strcpy(buffer, ":r2b\n");
-    if ( rawCommand(buffer) ) {
-        if ( rawResponse() ) {
-            int channel;
-            if ( sscanf(m_responseBuffer, "r2b%d", &channel) == 1 ) 
-                return channel;
-        }
+    const char *response = transact(buffer);
+    if ( response ) {
+        int channel;
+        if ( sscanf(response, "r2b%d", &channel) == 1 ) 
+            return channel;
     }
     return 0;
 }
 
 bool MHS5200Driver::setCurrentChannel(int channel) {
-    debugInfo("function", -1, __FUNCTION__);
+    MHS5200_TRACE_CALL(setCurrentChannel);
     char buffer[MHS5200_BUFFER_SIZE];
     sprintf(buffer, ":s2b%d\n", channel);
-    if ( rawCommand(buffer) ) {
-        if ( rawResponse() ) {
-            if ( strcmp(m_responseBuffer, "ok") == 0 )
-                return true;
-        }
+    const char *response = transact(buffer);
+    if ( response ) {
+        if ( strcmp(response, "ok") == 0 )
+            return true;
     }
     return false;
 }
 
 bool MHS5200Driver::getCurrentChannelStatus() {
-    debugInfo("function", -1, __FUNCTION__);
+    MHS5200_TRACE_CALL(getCurrentChannelStatus);
     char buffer[MHS5200_BUFFER_SIZE];
     strcpy(buffer, ":r1b\n");
-    if ( rawCommand(buffer) ) {
-        if ( rawResponse() ) {
-            int status;
-            if ( sscanf(m_responseBuffer, "r1b%d", &status) == 1 ) {
-                return status;
-            }
+    const char *response = transact(buffer);
+    if ( response ) {
+        int status;
+        if ( sscanf(response, "r1b%d", &status) == 1 ) {
+            return status;
         }
     }
     return false;
 }
 
 bool MHS5200Driver::setCurrentChannelStatus(bool onOff) {
-    debugInfo("function", -1, __FUNCTION__);
+    MHS5200_TRACE_CALL(setCurrentChannelStatus);
     char buffer[MHS5200_BUFFER_SIZE];
     sprintf(buffer, ":s1b%d\n", onOff?1:0);
-    if ( rawCommand(buffer) ) {
-        if ( rawResponse() ) {
-            if ( strcmp(m_responseBuffer, "ok") == 0 )
-                return true;
-        }
+    // Turning the output off is the safety command, it must not wait behind a wave form upload.
+    const char *response = transact(buffer, onOff ? PriorityNormal : PriorityUrgent);
+    return response && strcmp(response, "ok") == 0;
+}
+
+// ":a" slot chunk, the samples with a comma between them and "\n" plus the terminating 0.
+static_assert(MHS5200_ARB_MAX_SAMPLE <= 9999 && 4 + MHS5200_ARB_CHUNK_VALUES*5 + 1 <= MHS5200_ARB_CHUNK_SIZE,
+              "a chunk of the largest samples must fit MHS5200_ARB_CHUNK_SIZE");
+
+int MHS5200Driver::formatArbitraryChunk(char *buffer, int arbitrary, int chunk, const int *values) {
+    static const char hex[] = "0123456789ABCDEF";
+    char *p = buffer;
+    *p++ = ':';
+    *p++ = 'a';
+    *p++ = hex[arbitrary & 15];
+    *p++ = hex[chunk & 15];
+    for ( int c = 0; c < MHS5200_ARB_CHUNK_VALUES; c++ ) {
+        if ( c != 0 ) *p++ = ',';
+        // Clamped samples have at most 4 digits, format them without the cost of sprintf.
+        int v = values[c] < 0 ? 0 : (values[c] > MHS5200_ARB_MAX_SAMPLE ? MHS5200_ARB_MAX_SAMPLE : values[c]);
+        char digits[4];
+        int n = 0;
+        do {
+            digits[n++] = (char)('0' + v % 10);
+            v /= 10;
+        } while ( v );
+        while ( n > 0 ) *p++ = digits[--n];
     }
-    return false;
+    *p++ = '\n';
+    *p = 0;
+    return (int)(p - buffer);
 }
 
-bool MHS5200Driver::setArbitrary(int arbitrary, const int values[1024]) {
-    debugInfo("function", -1, __FUNCTION__);
-    char buffer[1024];
-    char buffer2[MHS5200_BUFFER_SIZE];
-    int p = 0;
-    for ( int chunk = 0; chunk < 16; chunk++ ) {
-        sprintf(buffer, ":a%1X%1X", arbitrary, chunk);
-        for ( int c = 0; c < 64; c++ ) {
-            if (c!=0)
-                strcat(buffer, ",");
-            sprintf(buffer2, "%d", (int)values[p++]);
-            strcat(buffer, buffer2);
-        }
-        strcat(buffer, "\n");
-        if ( rawCommand(buffer) ) {
-            if ( rawResponse() ) {
-                if ( strcmp(m_responseBuffer, "ok") != 0 )
-                    return false;
-            }
+bool MHS5200Driver::setArbitrary(int arbitrary, const int values[1024], int window) {
+    MHS5200_TRACE_CALL(setArbitrary);
+    int invalid = mhs5200WithTraits(m_limits.model, [values](auto traits) {
+        for ( int i = 0; i < MHS5200_ARB_VALUES; i++ ) {
+            if ( !decltype(traits)::validSample(values[i]) ) return i;
         }
+        return -1;
+    });
+    if ( invalid >= 0 ) {
+        systemError("setArbitrary", "Sample %d is %d, the %s takes 0 to %d\n", invalid, values[invalid], m_limits.name,
+                    m_limits.maxSample);
+        return false;
     }
-    return true;
+    char chunks[MHS5200_ARB_CHUNKS][MHS5200_ARB_CHUNK_SIZE];
+    for ( int chunk = 0; chunk < MHS5200_ARB_CHUNKS; chunk++ )
+        formatArbitraryChunk(chunks[chunk], arbitrary, chunk, &values[chunk*MHS5200_ARB_CHUNK_VALUES]);
+    
+    return rawPipeline(MHS5200_ARB_CHUNKS, window, [&](int index) -> const char * {
+        return chunks[index];
+    }, std::function<void(int index)>(), PriorityBulk) == MHS5200_ARB_CHUNKS;
 }
 
 bool MHS5200Driver::saveSettings(int slot) {
-    debugInfo("function", -1, __FUNCTION__);
+    MHS5200_TRACE_CALL(saveSettings);
     char buffer[MHS5200_BUFFER_SIZE];
     sprintf(buffer, ":s%du\n", slot);
-    if ( rawCommand(buffer) ) {
-        if ( rawResponse() ) {
-            if ( strcmp(m_responseBuffer, "ok") == 0 )
-                return true;
-        }
-    }
-    return false;
+    const char *response = transact(buffer);
+    if ( !response || strcmp(response, "ok") != 0 ) return false;
+    if ( m_slotIndexFile.empty() || slot < 0 || slot >= MHS5200_MEMORY_SLOTS ) return true;
+    
+    // Record what went into the slot, reading only the settings not known already.
+    unsigned all = fieldMask(1, FieldAllChannel) | fieldMask(2, FieldAllChannel);
+    DeviceState state = m_knownState;
+    unsigned known = m_knownFields & all;
+    if ( known != all ) known |= readState(state, all & ~known);
+    m_slotStates[slot] = state;
+    m_slotFields[slot] = known;
+    if ( m_slotIndexUpdate ) writeSlotIndex();
+    return true;
 }
 
 bool MHS5200Driver::loadSettings(int slot) {
-    debugInfo("function", -1, __FUNCTION__);
+    MHS5200_TRACE_CALL(loadSettings);
     char buffer[MHS5200_BUFFER_SIZE];
     sprintf(buffer, ":s%dv\n", slot);
-    if ( rawCommand(buffer) ) {
-        if ( rawResponse() ) {
-            if ( strcmp(m_responseBuffer, "ok") == 0 )
-                return true;
-        }
+    int64_t start = monotonicMicros();
+    const char *response = transact(buffer);
+    if ( !response || strcmp(response, "ok") != 0 ) return false;
+    
+    // The time the device takes for a load, less the frame and its ok on the wire, for planProfile().
+    double micros = (double)(monotonicMicros() - start) - 9 * wireMicrosPerByte();
+    if ( micros < 0 ) micros = 0;
+    m_slotLoadMicros = m_slotLoadMicros < 0 ? micros : 0.8 * m_slotLoadMicros + 0.2 * micros;
+    
+    // Every setting changed, the indexed ones are known without reading them back.
+    if ( slot >= 0 && slot < MHS5200_MEMORY_SLOTS && m_slotFields[slot] ) {
+        m_knownFields = 0;
+        noteKnownState(m_slotStates[slot], m_slotFields[slot]);
     }
-    return false;
+    return true;
+}
+
+void MHS5200Driver::setModel(MHS5200Model model) {
+    m_limits = mhs5200ModelLimits(model);
+}
+
+bool MHS5200Driver::probeModel() {
+    char buffer[MHS5200_BUFFER_SIZE];
+    strcpy(buffer, ":r0c\n");
+    int maxRetries = m_maxRetries;
+    m_maxRetries = 0;
+    const char *response = transact(buffer);
+    m_maxRetries = maxRetries;
+    
+    // The model number follows the echoed query, ie. r0c5225A...
+    MHS5200Model model;
+    char name[5];
+    if ( !response || strncmp(response, "r0c", 3) != 0 || strlen(response) < 7 ) return false;
+    memcpy(name, response+3, 4);
+    name[4] = 0;
+    if ( !mhs5200ParseModel(name, model) ) return false;
+    setModel(model);
+    return true;
+}
+
+const MHS5200ModelLimits &MHS5200Driver::getLimits() {
+    return m_limits;
 }
 
 void MHS5200Driver::setDebugOutput(bool onOff) {
     m_outputDebugInfo = onOff;
 }
+
+bool MHS5200Driver::setTraceFile(const char *fileName) {
+    m_trace.close();
+    if ( fileName == nullptr ) return true;
+    return m_trace.open(fileName);
+}
@@ -1,6 +1,27 @@
+#pragma once
 #include <termios.h>
+#include <stdint.h>
+#include <functional>
+#include <deque>
+#include <string>
+#include <vector>
+#include <mutex>
+#include <thread>
+#include "mhs5200trace.hpp"
+#include "mhs5200traits.hpp"
 
 #define MHS5200_BUFFER_SIZE 128
+#define MHS5200_READ_BUFFER_SIZE 1024
+#define MHS5200_MAX_BATCH 32
+#define MHS5200_ARB_VALUES 1024
+#define MHS5200_ARB_CHUNKS 16
+#define MHS5200_ARB_CHUNK_VALUES 64
+#define MHS5200_ARB_CHUNK_SIZE 512
+#define MHS5200_ARB_MAX_SAMPLE (DeviceTraits<MHS5200Model::MHS5225A>::maxSample)
+#define MHS5200_LATENCY_BUCKETS 100
+#define MHS5200_LATENCY_MIN_SAMPLES 16
+#define MHS5200_WRITEV_FRAMES 64
+#define MHS5200_MEMORY_SLOTS 10
 
 class MHS5200Driver
 {
@@ -8,13 +29,29 @@ protected:
     struct termios saveTTY;
     int m_fileDescriptor;
     char m_responseBuffer[MHS5200_BUFFER_SIZE];
-    double m_maxAmplitude;
-    double m_attenuationMax;
-    double m_minAmplitude;
+    char m_readBuffer[MHS5200_READ_BUFFER_SIZE];
+    int m_readLength;
+    char m_batchResponses[MHS5200_MAX_BATCH+1][MHS5200_BUFFER_SIZE];
+    bool m_needResync;
+    int m_maxRetries;
+    int m_attemptTimeoutMs;
+    int m_backoffInitialMs;
+    int m_backoffMaxMs;
+    double m_faultRate;
+    unsigned m_faultSeed;
+    MHS5200ModelLimits m_limits;
     int m_baudRate;
     bool m_outputDebugInfo;
-
+    MHS5200Trace m_trace;
+    
     void debugInfo(const char *type, int bufferLen, const char *buffer);
+    bool extractResponse(char *response);
+    bool receiveResponse(char *response, int timeoutMs);
+    bool nextResponse(char *response);
+    void flushInput();
+    int backoffMillis(int attempt);
+    static void expectedResponse(const char *command, char *prefix);
+    static bool matchesResponse(const char *response, const char *prefix);
     void systemError(const char *fn, const char *msgFormat, ...);
 public:
     /**
@@ -24,6 +61,135 @@ public:
                     Arbitrary3, Arbitrary4, Arbitrary5, Arbitrary6, Arbitrary7, Arbitrary8, Arbitrary9, 
                     Arbitrary10, Arbitrary11, Arbitrary12, Arbitrary13, Arbitrary14, Arbitrary15};
     
+    /**
+     * Readable state fields. Channel fields are shifted into place per channel using fieldMask(), 
+     * device fields apply to the generator as a whole. Ordered from cheapest to most expensive on the wire.
+     */
+    enum StateField { FieldInverted=0x01, FieldWave=0x02, FieldDutyCycle=0x04, FieldOffset=0x08, FieldPhaseOffset=0x10,
+                      FieldAmplitude=0x20, FieldFrequency=0x40, FieldAllChannel=0x7f,
+                      FieldCurrentChannel=0x10000, FieldChannelStatus=0x20000, FieldAllDevice=0x30000 };
+    
+    /**
+     * Settings of a single channel.
+     */
+    struct ChannelState {
+        WaveType wave;
+        double frequency;
+        double amplitude;
+        double dutyCycle;
+        int offset;
+        int phaseOffset;
+        bool inverted;
+    };
+    
+    /**
+     * Settings of the whole device.
+     */
+    struct DeviceState {
+        ChannelState channels[2];
+        int currentChannel;
+        bool currentChannelStatus;
+    };
+    
+    /**
+     * Way to reach a configuration chosen by planProfile().
+     */
+    struct ProfilePlan {
+        int slot;                   // Memory slot loaded first, -1 for sets only.
+        unsigned fields;            // Channel fields set, after the load if there is one.
+        int frames;
+        int bytes;
+        double estimatedMicros;     // Wire and device time of the chosen way.
+        double directMicros;        // The same for sets only.
+    };
+    
+    /**
+     * Counters of the link recovery layer.
+     */
+    struct LinkStatistics {
+        uint64_t commands;          // Commands answered.
+        uint64_t retries;           // Commands or batches sent again.
+        uint64_t timeouts;          // Attempts that ran out of time.
+        uint64_t discardedFrames;   // Responses that did not belong to the command waiting for one.
+        uint64_t flushes;           // Input flushes to re-synchronize.
+        uint64_t failures;          // Commands given up on after all retries.
+        uint64_t injectedFaults;    // Responses dropped by fault injection.
+        uint64_t reconnects;        // Links reopened after the device went away.
+        uint64_t verified;          // Settings read back after their set.
+        uint64_t verifyMismatches;  // Settings reading back a different value.
+        uint64_t lockWaits;         // Connects that queued behind another user of the device.
+        uint64_t lockWaitMicros;    // Time spent queueing.
+        uint64_t bytesWritten;      // Bytes handed to the tty.
+        uint64_t writes;            // Calls to write() or writev() that took bytes.
+        uint64_t partialWrites;     // Calls that took only part of the frames offered.
+        uint64_t drains;            // Waits for the output queue to run empty.
+        uint64_t wireBytes;         // Bytes that left the output queue while it was never empty, see wireBytesPerSecond().
+        uint64_t wireMicros;
+    };
+    
+    /**
+     * Which acknowledged sets are read back, see setVerifyPolicy().
+     */
+    enum VerifyPolicy {
+        VerifyNone = 0,
+        VerifyAlways,
+        VerifySampled,          // Every n-th set.
+        VerifyCritical          // Frequency, amplitude, offset and output on/off.
+    };
+    
+    /**
+     * Scheduling classes of queued commands, lower values go first.
+     */
+    enum Priority {
+        PriorityUrgent = 0,     // Safety commands, sent ahead of everything and past a full pipeline.
+        PriorityNormal,         // Settings and queries.
+        PriorityBulk,           // Arbitrary wave form chunks, at most one waits in the transmit queue.
+        PriorityClasses
+    };
+    
+    /**
+     * Queueing of one priority class, time from submit() until the command is written.
+     */
+    struct SchedulerStatistics {
+        uint64_t commands;          // Commands written.
+        uint64_t deadlineMisses;    // Commands written after their deadline.
+        uint64_t totalQueueMicros;  // Sum of the queueing delays.
+        uint64_t maxQueueMicros;    // Longest queueing delay.
+    };
+    
+    /**
+     * A generator found by discover().
+     */
+    struct DiscoveredDevice {
+        std::string deviceName;     // TTY device, ie. /dev/ttyUSB0.
+        std::string identity;       // Response to the identifying query.
+        int64_t latencyMicros;      // Time until the response arrived.
+    };
+    
+    /**
+     * Commands with different costs, each has its own latency distribution and timeout.
+     */
+    enum CommandClass {
+        CommandRead = 0,
+        CommandSet,
+        CommandArbitrary,
+        CommandClasses
+    };
+    
+    /**
+     * Outcome of commit().
+     */
+    struct CommitReport {
+        int frames;                 // Frames sent in the single write.
+        int bytes;
+        unsigned skippedFields;     // Fields already at the target value.
+        int64_t writeMicros;        // Time spent in write().
+        double skewMicros;          // Largest time between the acknowledgements of the same parameter on both channels.
+        double estimatedSkewMicros; // The same from the wire time of the frames in between.
+        double spanMicros;          // First to last acknowledgement.
+        bool retried;               // Acknowledgements went missing and the frames were sent again, timings are not valid.
+    };
+    
     MHS5200Driver();
     ~MHS5200Driver();
     
@@ -47,6 +213,85 @@ public:
      */
     bool isConnected();
     
+    /**
+     * File descriptor of the TTY, for code driving the link directly such as MHS5200HopEngine.
+     * 
+     * @return The file descriptor or 0 when not connected.
+     */
+    int getFileDescriptor();
+    
+    /**
+     * Hand the TTY to code that writes to getFileDescriptor() and reads the responses itself. Waits for
+     * the output to leave and discards any input, including a partly read response.
+     * 
+     * @return False when not connected or submitted commands are still pending.
+     */
+    bool beginDirectAccess();
+    
+    /**
+     * Take the TTY back after beginDirectAccess(). Responses the other code left unread are discarded, so
+     * they are not taken for the answer to the next command.
+     * 
+     * @param answered False when responses may still be on their way, the input is then flushed again before
+     *        the next command.
+     */
+    void endDirectAccess(bool answered = true);
+    
+    /**
+     * Tell the driver about set frames written to getFileDescriptor() by other code. Their settings are no
+     * longer known and the last value of each is replayed after a reconnect, as for sets sent by the driver.
+     * 
+     * @param command The frames written, several may be given at once.
+     * @param len Length of the frames.
+     */
+    void noteDirectWrite(const char *command, int len);
+    
+    /**
+     * Find generators by probing all candidate TTY devices at the same time.
+     * 
+     * Every candidate is opened and sent a harmless query, those answering like an MHS-5200 are returned in
+     * candidate order. Busy or silent devices are skipped.
+     * 
+     * @param candidates TTY devices to probe, empty probes /dev/ttyUSB* and /dev/ttyACM*.
+     * @param timeoutMs Time each candidate has to answer.
+     * @return The generators found.
+     */
+    static std::vector<DiscoveredDevice> discover(const std::vector<std::string> &candidates = std::vector<std::string>(),
+                                                  int timeoutMs = 300);
+    
+    /**
+     * Reopen the TTY after the device went away, ie. a USB serial adapter re-enumerated.
+     * 
+     * Waits for the device node to reappear (inotify on its directory), connects with the same settings and
+     * queues the settings sent since connect() so the generator ends up in the same state. Pending commands
+     * are sent after them.
+     * 
+     * @param timeoutMs Time to wait for the device in milliseconds.
+     * @return True once connected again.
+     */
+    bool reconnect(int timeoutMs);
+    
+    /**
+     * Reconnect automatically when the link is lost while commands are pending.
+     * 
+     * @param timeoutMs Time to wait for the device to come back, 0 disables (default) and fails the commands.
+     */
+    void setAutoReconnect(int timeoutMs);
+    
+    /**
+     * Queue for the device instead of failing when another process has it open.
+     * 
+     * connect() takes a ticket in a queue directory per device and waits until every earlier ticket is gone,
+     * so processes get the device in the order they asked for it. The ticket is a locked file that is removed
+     * by disconnect(), the next process is woken by inotify right away. The lock of a crashed process goes away
+     * with it and its ticket is skipped. Only users of this queue are ordered, other programs opening the
+     * TTY still make connect() fail.
+     * 
+     * @param waitMs Longest time to wait for the device, 0 disables (default).
+     * @param lockDirectory Where the queue directories are created, /tmp when nullptr.
+     */
+    void setQueuedAccess(int waitMs, const char *lockDirectory = nullptr);
+    
     /**
      * Get current frequency setting in Hz.
      * 
@@ -54,15 +299,26 @@ public:
      * @return Frequency in Hz up to 2 decimal places of precision.
      */
     double getFrequency(int channel);
-
+    
     /**
      * Set the current frequency for a given channel in Hz.
      * 
      * @param channel The channel to set the frequency. For MHS-5200 this should be 1 or 2.
      * @param hz Frequency in Hz (decimal 8.2). Example: 10000000.00 = 10MHz
+     * @return False when out of range for the model or not acknowledged.
      */
     bool setFrequency(int channel, double hz);
     
+    /**
+     * Encode the command setFrequency() sends.
+     * 
+     * @param buffer Receives the command, at least MHS5200_BUFFER_SIZE bytes.
+     * @param channel The channel to set the frequency.
+     * @param hz Frequency in Hz (decimal 8.2).
+     * @return Length of the command.
+     */
+    static int formatFrequency(char *buffer, int channel, double hz);
+    
     /**
      * Get duty cycle for a given channel.
      * 
@@ -70,7 +326,7 @@ public:
      * @return 0.1-99.9 if successful or 0 on failure.
      */
     double getDutyCycle(int channel);
-
+    
     /**
      * Get duty cycle for a given channel.
      * 
@@ -79,6 +335,16 @@ public:
      */
     bool setDutyCycle(int channel, double dutyCycle);
     
+    /**
+     * Encode the command setDutyCycle() sends.
+     * 
+     * @param buffer Receives the command, at least MHS5200_BUFFER_SIZE bytes.
+     * @param channel The channel.
+     * @param dutyCycle Duty cycle percent.
+     * @return Length of the command.
+     */
+    static int formatDutyCycle(char *buffer, int channel, double dutyCycle);
+    
     /**
      * Get waveform supplied by the specified channel.
      * 
@@ -86,7 +352,7 @@ public:
      * @return See enumeration MHS5200Driver::WaveType. Returns MHS5200Driver::WaveType::Unknown on error.
      */
     WaveType getWaveType(int channel);
-
+    
     /**
      * Set waveform for a given channel.
      * 
@@ -96,6 +362,16 @@ public:
      */
     bool setWaveType(int channel, WaveType wave);
     
+    /**
+     * Encode the command setWaveType() sends.
+     * 
+     * @param buffer Receives the command, at least MHS5200_BUFFER_SIZE bytes.
+     * @param channel The channel.
+     * @param wave The wave form.
+     * @return Length of the command.
+     */
+    static int formatWaveType(char *buffer, int channel, WaveType wave);
+    
     /**
      * Get the offset for the given channel.
      * 
@@ -113,6 +389,16 @@ public:
      */
     bool setOffset(int channel, int offset);
     
+    /**
+     * Encode the command setOffset() sends.
+     * 
+     * @param buffer Receives the command, at least MHS5200_BUFFER_SIZE bytes.
+     * @param channel The channel.
+     * @param offset The offset between -120 and 120.
+     * @return Length of the command.
+     */
+    static int formatOffset(char *buffer, int channel, int offset);
+    
     /**
      * Get the channel's amplitude in volts between 20.00 and 0.005.
      * 
@@ -130,6 +416,26 @@ public:
      */
     bool setAmplitude(int channel, double amplitude);
     
+    /**
+     * Encode the attenuator frame setAmplitude() sends first.
+     * 
+     * @param buffer Receives the command, at least MHS5200_BUFFER_SIZE bytes.
+     * @param channel The channel.
+     * @param amplitude The amplitude in volts.
+     * @return Length of the command, 0 when the amplitude is out of range.
+     */
+    int formatAttenuation(char *buffer, int channel, double amplitude);
+    
+    /**
+     * Encode the amplitude frame setAmplitude() sends after the attenuator frame.
+     * 
+     * @param buffer Receives the command, at least MHS5200_BUFFER_SIZE bytes.
+     * @param channel The channel.
+     * @param amplitude The amplitude in volts.
+     * @return Length of the command, 0 when the amplitude is out of range.
+     */
+    int formatAmplitude(char *buffer, int channel, double amplitude);
+    
     /**
      * Get the channel's phase offset.
      * 
@@ -147,6 +453,16 @@ public:
      */
     bool setPhaseOffset(int channel, int phaseOffset);
     
+    /**
+     * Encode the command setPhaseOffset() sends.
+     * 
+     * @param buffer Receives the command, at least MHS5200_BUFFER_SIZE bytes.
+     * @param channel The channel.
+     * @param phaseOffset The phase offset between 0 and 360.
+     * @return Length of the command.
+     */
+    static int formatPhaseOffset(char *buffer, int channel, int phaseOffset);
+    
     /**
      * Get the inversion status of the specified channel.
      * 
@@ -163,13 +479,23 @@ public:
      */
     bool setInverted(int channel, bool inverted);
     
+    /**
+     * Encode the command setInverted() sends.
+     * 
+     * @param buffer Receives the command, at least MHS5200_BUFFER_SIZE bytes.
+     * @param channel The channel.
+     * @param inverted True to invert.
+     * @return Length of the command.
+     */
+    static int formatInverted(char *buffer, int channel, bool inverted);
+    
     /**
      * Get currently selected channel.
      * 
      * @return Channel 1, 2, or 0 on failure.
      */
     int getCurrentChannel();
-
+    
     /**
      * Set currently selected channel.
      * 
@@ -197,11 +523,24 @@ public:
      * Set arbitrary wave form pattern.
      * 
      * @param arbitrary The arbitrary wave form to set (0-15).
-     * @param bytes The array of arbitrary wave form data.
+     * @param bytes The array of arbitrary wave form data, samples within the range of the model.
+     * @param window Chunks sent ahead of their acknowledgement, see rawPipeline().
      * @return True on success.
      */
-    bool setArbitrary(int arbitrary, const int values[1024]);
-
+    bool setArbitrary(int arbitrary, const int values[1024], int window = 1);
+    
+    /**
+     * Encode one of the MHS5200_ARB_CHUNKS commands setArbitrary() sends.
+     * 
+     * @param buffer Receives the command, at least MHS5200_ARB_CHUNK_SIZE bytes.
+     * @param arbitrary The arbitrary wave form (0-15).
+     * @param chunk The chunk (0-15).
+     * @param values The MHS5200_ARB_CHUNK_VALUES samples of the chunk, clamped to 0-MHS5200_ARB_MAX_SAMPLE so
+     *        the command always fits. setArbitrary() rejects samples out of range for the model instead.
+     * @return Length of the command.
+     */
+    static int formatArbitraryChunk(char *buffer, int arbitrary, int chunk, const int *values);
+    
     /**
      * Save settings in device memory slot.
      * 
@@ -217,7 +556,252 @@ public:
      * @return True on success.
      */
     bool loadSettings(int slot);
-
+    
+    /**
+     * Keep an index of what the memory slots hold in a file. saveSettings() records the channel settings it
+     * stores, reading only those the driver does not know already, and loadSettings() of an indexed slot makes
+     * them the known state of the device without reading them back. Stores from the front panel are not seen,
+     * the entry of such a slot is stale until it is stored through the driver again.
+     * 
+     * @param fileName The index, read now when it exists. nullptr for no index.
+     * @param update False to use the index without recording stores in it, ie. for a dry run.
+     * @return False when the file exists but could not be read.
+     */
+    bool setSlotIndex(const char *fileName, bool update = true);
+    
+    /**
+     * Indexed content of a memory slot.
+     * 
+     * @param slot Slot 0-9.
+     * @param state Receives the channel settings.
+     * @return Mask of the channel fields known, 0 for a slot not in the index.
+     */
+    unsigned slotContents(int slot, DeviceState &state);
+    
+    /**
+     * Settings of the device the driver knows without reading them: those it read, applied with commit() or
+     * loaded from an indexed slot since connecting. Other sets make their field unknown. commit() only reads
+     * the fields it does not know.
+     * 
+     * @param state Receives the known settings.
+     * @return Mask of the known fields, see fieldMask().
+     */
+    unsigned knownState(DeviceState &state);
+    
+    /**
+     * Forget the known state, ie. after the settings were changed on the front panel or by writing to
+     * getFileDescriptor() directly.
+     */
+    void forgetKnownState();
+    
+    /**
+     * Find the cheapest way to a configuration: sets from the known state, or loading an indexed memory slot
+     * followed by sets for the fields the slot does not have. Costs are the wire time of the frames plus the
+     * measured latency of sets and slot loads. Fields not known count as different.
+     * 
+     * @param target The configuration.
+     * @param fields Mask of channel fields to reach, see fieldMask(). A slot load also changes the others.
+     * @param plan Receives the chosen way.
+     * @return False when a value is out of range.
+     */
+    bool planProfile(const DeviceState &target, unsigned fields, ProfilePlan &plan);
+    
+    /**
+     * Reach a configuration the way planProfile() chooses.
+     * 
+     * @param target The configuration.
+     * @param fields Mask of channel fields to reach, see fieldMask(). A slot load also changes the others.
+     * @param plan Receives the way taken, may be nullptr.
+     * @param report Receives the outcome of the sets, may be nullptr.
+     * @return True when the load and every set were acknowledged.
+     */
+    bool applyProfile(const DeviceState &target, unsigned fields, ProfilePlan *plan = nullptr, CommitReport *report = nullptr);
+    
+    /**
+     * Send a command and wait for its response, recovering from protocol errors.
+     * 
+     * Replies not matching the command (late replies to earlier commands) are skipped. On timeout the input
+     * is flushed and the command is sent again after a capped exponential backoff, see setRetryPolicy().
+     * 
+     * May be called from another thread while one is busy with a long operation such as setArbitrary(), the
+     * command is then handed to that thread and scheduled by priority.
+     * 
+     * @param command Command string including the trailing \n.
+     * @param priority One of Priority.
+     * @return Response in the format of rawResponse() or nullptr once all attempts failed. Valid until the
+     *         next call from the same thread; a command handed over to another thread gets its response in a
+     *         buffer of the calling thread, so use the returned pointer rather than the driver's buffer.
+     */
+    const char *transact(const char *command, int priority = PriorityNormal);
+    
+    /**
+     * Maximum queueing delay of a priority class. A command waiting longer is sent ahead of the higher
+     * non-urgent classes so bulk traffic is not starved either.
+     * 
+     * @param priority One of Priority.
+     * @param deadlineMs Deadline in milliseconds.
+     */
+    void setPriorityDeadline(int priority, int deadlineMs);
+    
+    /**
+     * Queueing counters of a priority class since construction or resetStatistics().
+     * 
+     * @param priority One of Priority.
+     * @return The counters.
+     */
+    const SchedulerStatistics &getSchedulerStatistics(int priority);
+    
+    /**
+     * Configure the recovery used by transact() and rawBatch().
+     * 
+     * @param maxRetries Attempts after the first one before giving up.
+     * @param attemptTimeoutMs Time to wait for a response on each attempt in milliseconds, the upper limit
+     *        of the adaptive timeouts.
+     * @param backoffInitialMs Delay before the first retry, doubled for each further retry.
+     * @param backoffMaxMs Upper limit of the delay between retries.
+     */
+    void setRetryPolicy(int maxRetries, int attemptTimeoutMs, int backoffInitialMs = 10, int backoffMaxMs = 200);
+    
+    /**
+     * Counters of the recovery layer since construction or resetStatistics().
+     * 
+     * @return The counters.
+     */
+    const LinkStatistics &getStatistics();
+    
+    /**
+     * Reset all counters to zero.
+     */
+    void resetStatistics();
+    
+    /**
+     * Drop a random fraction of the received responses to exercise the recovery layer.
+     * 
+     * @param responseLossRate Probability between 0 and 1 of dropping a response, 0 disables.
+     * @param seed Seed for the pseudo random sequence so that runs are repeatable.
+     */
+    void setFaultInjection(double responseLossRate, unsigned seed = 1);
+    
+    /**
+     * Read settings back after the device acknowledged them. The reads are not sent with the set, they are
+     * collected and sent as one pipelined batch once `batch` of them are pending, so verification costs
+     * about one round trip per batch instead of one per set. A later set of the same setting replaces the
+     * pending check of the earlier one. Mismatches are reported on stderr and counted in getStatistics().
+     * 
+     * @param policy One of VerifyPolicy.
+     * @param sampleEvery For VerifySampled, read back one set in this many.
+     * @param batch Pending read backs that trigger a batch, 1 verifies right after each set.
+     */
+    void setVerifyPolicy(int policy, int sampleEvery = 10, int batch = 8);
+    
+    /**
+     * Read back all pending settings now, ie. before relying on them or when an event loop is idle.
+     * 
+     * @return Number of settings reading back a different value, -1 when not all reads were answered.
+     */
+    int verifyPending();
+    
+    /**
+     * Derive the response timeout of each command class from its observed latency.
+     * 
+     * Until enough responses have been seen the attempt timeout of setRetryPolicy() is used. After that the
+     * timeout is the 99.9th percentile latency times factor plus the wire time of the frame and its response,
+     * limited to floorMs and the attempt timeout. After failFastMisses timeouts in a row without any response
+     * the device is considered gone: pending commands fail and further commands get a single short attempt
+     * until it answers again.
+     * 
+     * @param factor Multiple of the 99.9th percentile latency, 0 disables adaptive timeouts.
+     * @param floorMs Lower limit of the timeout in milliseconds.
+     * @param failFastMisses Consecutive timeouts before failing fast, 0 disables.
+     */
+    void setAdaptiveTimeouts(double factor, int floorMs = 20, int failFastMisses = 4);
+    
+    /**
+     * Observed response latency of a command class, excluding the wire time.
+     * 
+     * @param commandClass One of CommandClass.
+     * @param quantile Between 0 and 1, e.g. 0.999.
+     * @return Latency in microseconds or -1 when there are not enough samples yet.
+     */
+    double latencyQuantile(int commandClass, double quantile);
+    
+    /**
+     * Timeout currently used for a command, see setAdaptiveTimeouts().
+     * 
+     * @param command Command string including the trailing \n.
+     * @return Timeout in microseconds.
+     */
+    int64_t responseTimeoutMicros(const char *command);
+    
+    /**
+     * Command class of a command string.
+     * 
+     * @param command Command string.
+     * @return One of CommandClass.
+     */
+    static int commandClass(const char *command);
+    
+    /**
+     * Read several state fields using a single pipelined batch of queries.
+     * 
+     * @param state The state to update, only fields successfully read are modified.
+     * @param fields Mask of fields to read, see fieldMask() and MHS5200Driver::StateField.
+     * @return Mask of the fields that were read.
+     */
+    unsigned readState(DeviceState &state, unsigned fields);
+    
+    /**
+     * Apply settings to both channels with the least time between the channels.
+     * 
+     * All frames are encoded first and sent back to back in a single write, grouped so that the same
+     * parameter of both channels is adjacent. Any reads happen before the write.
+     * 
+     * @param target The settings to apply.
+     * @param fields Mask of channel fields to apply, see fieldMask(). Device fields are ignored.
+     * @param report Receives the frame count and measured skew, may be nullptr.
+     * @param skipUnchanged Read the fields first and leave out the ones already set.
+     * @return True when every frame was acknowledged.
+     */
+    bool commit(const DeviceState &target, unsigned fields, CommitReport *report = nullptr, bool skipUnchanged = true);
+    
+    /**
+     * Encode the command(s) setting one channel field.
+     * 
+     * @param buffer Receives the commands, at least 2*MHS5200_BUFFER_SIZE bytes.
+     * @param channel The channel.
+     * @param field The channel field (unshifted).
+     * @param state Source of the value.
+     * @return Length of the commands, 0 when the value is out of range.
+     */
+    int formatField(char *buffer, int channel, StateField field, const ChannelState &state);
+    
+    /**
+     * Compare a channel field of two states at the resolution the device stores it.
+     * 
+     * @param field The channel field (unshifted).
+     * @param a First state.
+     * @param b Second state.
+     * @return True when setting either value results in the same device setting.
+     */
+    bool sameFieldValue(StateField field, const ChannelState &a, const ChannelState &b);
+    
+    /**
+     * Build a field mask for a channel field or a device field.
+     * 
+     * @param channel The channel (1 or 2), ignored for device fields.
+     * @param field The field.
+     * @return Mask usable with readState().
+     */
+    static unsigned fieldMask(int channel, StateField field);
+    
+    /**
+     * Bytes sent and received on the wire to read a field.
+     * 
+     * @param field The field (channel fields unshifted).
+     * @return Query plus response length in bytes.
+     */
+    static int fieldWireBytes(StateField field);
+    
     /**
      * Send a raw command string to the signal generator.
      * 
@@ -234,11 +818,250 @@ public:
      */
     const char *rawResponse(int timeout = 10);
     
+    /**
+     * Send several commands with a single write then collect their responses in order.
+     * Commands whose responses went missing are sent again using the policy of transact().
+     * 
+     * @param commands Array of command strings, each including the trailing \n.
+     * @param count Number of commands (up to MHS5200_MAX_BATCH).
+     * @param responses Receives the response for each command, same format as rawResponse(), or nullptr when
+     *                  none was received. Valid until the next batch.
+     * @return Number of responses received.
+     */
+    int rawBatch(const char *const commands[], int count, const char *responses[]);
+    
+    /**
+     * Time taken to shift one byte over the serial link at the configured baud rate (8N1).
+     * 
+     * @return Microseconds per byte.
+     */
+    double wireMicrosPerByte();
+    
+    /**
+     * Rate the bytes actually left the tty, measured with TIOCOUTQ between writes while the output queue held
+     * bytes. Adapters that do not report their queue, and pseudo terminals, give no measurement.
+     * 
+     * @return Bytes per second or -1 when not measured yet.
+     */
+    double wireBytesPerSecond();
+    
+    /**
+     * Wait until every byte written so far has left the tty. Frames are otherwise written without waiting,
+     * only code that writes to getFileDescriptor() on its own schedule or changes the line needs this.
+     * 
+     * @return True if successful.
+     */
+    bool drainOutput();
+    
+    /**
+     * Send a sequence of set commands keeping several of them in flight.
+     * 
+     * On a missing acknowledgement every command not yet acknowledged is sent again using the retry policy of transact().
+     * 
+     * @param count Number of commands.
+     * @param window Commands sent ahead of their acknowledgement, 1 waits for each one.
+     * @param command Returns the command with the given index, including the trailing \n; may be called again
+     *                for the same index when resending and may block until it is available.
+     * @param acknowledged Called in order as each command is acknowledged, may be empty.
+     * @param priority One of Priority.
+     * @return Number of commands acknowledged.
+     */
+    int rawPipeline(int count, int window, const std::function<const char *(int index)> &command,
+                    const std::function<void(int index)> &acknowledged = std::function<void(int index)>(),
+                    int priority = PriorityNormal);
+    
+    /**
+     * Monotonic clock.
+     * 
+     * @return Time in microseconds from an arbitrary starting point.
+     */
+    static int64_t monotonicMicros();
+    
+    /**
+     * Select the model whose limits are used to validate and scale values. Default is MHS-5225A.
+     * 
+     * @param model The model.
+     */
+    void setModel(MHS5200Model model);
+    
+    /**
+     * Ask the device for its model with the :r0c query and select it, see setModel().
+     * 
+     * Only one attempt is made, firmware without the query leaves the model unchanged.
+     * 
+     * @return True if the model was recognized.
+     */
+    bool probeModel();
+    
+    /**
+     * Limits of the selected model.
+     * 
+     * @return The limits.
+     */
+    const MHS5200ModelLimits &getLimits();
+    
     /**
      *  Turns debug output on or off.
      * @param onOff True for on, false for off.
      */
     void setDebugOutput( bool onOff );
     
+    /**
+     * Record all bytes sent and received to a binary trace file, see MHS5200Trace.
+     * 
+     * @param fileName The trace file to create or nullptr to stop recording.
+     * @return True on success.
+     */
+    bool setTraceFile( const char *fileName );
+    
+    /**
+     * Called with the response (format of rawResponse()) of a submitted command, or nullptr when it failed.
+     */
+    typedef std::function<void(const char *response)> Completion;
+    
+    /**
+     * Queue a command on the non-blocking core. Retries follow setRetryPolicy(), replies are matched like transact().
+     * The completion may submit further commands.
+     * 
+     * @param command Command string including the trailing \n.
+     * @param done Called once the command completed or failed.
+     * @param priority One of Priority.
+     */
+    void submit(const char *command, const Completion &done, int priority = PriorityNormal);
+    
+    /**
+     * Events to wait for on getFileDescriptor() before calling onReadable() or onWritable().
+     * 
+     * @return Combination of POLLIN and POLLOUT, 0 when idle.
+     */
+    short pollEvents();
+    
+    /**
+     * Time until onTimeout() must be called.
+     * 
+     * @return Milliseconds, -1 when no timeout is pending.
+     */
+    int timeoutMillis();
+    
+    /**
+     * Read and dispatch available responses. Call when the file descriptor is readable.
+     */
+    void onReadable();
+    
+    /**
+     * Send queued commands. Call when the file descriptor is writable.
+     */
+    void onWritable();
+    
+    /**
+     * Handle response timeouts and retry delays. Safe to call early.
+     */
+    void onTimeout();
+    
+    /**
+     * Number of submitted commands not yet completed.
+     * 
+     * @return Queued plus in flight commands.
+     */
+    int pendingRequests();
+    
+    /**
+     * Maximum number of submitted commands sent ahead of their responses.
+     * 
+     * @param depth Commands in flight, 1 waits for each response (default).
+     */
+    void setPipelineDepth(int depth);
+    
+    /**
+     * Drive the non-blocking core with poll() until every submitted command completed.
+     * 
+     * @return False when the connection failed.
+     */
+    bool runPending();
+    
+protected:
+    struct Request {
+        std::string command;
+        char prefix[4];
+        Completion done;
+        int attempt;
+        int commandClass;
+        int priority;
+        int64_t queuedMicros;
+        int64_t sentMicros;
+        int64_t timeoutMicros;
+    };
+    
+    LinkStatistics m_statistics;
+    std::deque<Request> m_queued[PriorityClasses];
+    std::deque<Request> m_inFlight;
+    int m_unsentFrames;             // Requests at the back of m_inFlight not completely written yet.
+    size_t m_outputOffset;          // Bytes of the first of them already written.
+    int64_t m_queueSampleMicros;
+    int m_queueSampleBytes;
+    uint64_t m_queueSampleLeft;
+    int64_t m_resumeMicros;
+    int m_pipelineDepth;
+    bool m_holdOutput;
+    uint32_t m_latency[CommandClasses][MHS5200_LATENCY_BUCKETS];
+    uint32_t m_latencySamples[CommandClasses];
+    int64_t m_lastResponseMicros;
+    double m_timeoutFactor;
+    int m_timeoutFloorMs;
+    int m_failFastMisses;
+    int m_consecutiveMisses;
+    std::string m_deviceName;
+    std::vector<std::string> m_settingsCache;
+    int m_reconnectTimeoutMs;
+    int m_verifyPolicy;
+    int m_verifySampleEvery;
+    int m_verifyBatch;
+    unsigned m_verifyCounter;
+    std::vector<std::string> m_verifyPending;
+    int64_t m_deadlineMicros[PriorityClasses];
+    SchedulerStatistics m_scheduler[PriorityClasses];
+    int64_t m_bulkClearMicros;
+    int m_queueWaitMs;
+    std::string m_lockDirectory;
+    int m_lockFd;
+    std::string m_lockPath;
+    std::string m_slotIndexFile;
+    bool m_slotIndexUpdate;
+    DeviceState m_slotStates[MHS5200_MEMORY_SLOTS];
+    unsigned m_slotFields[MHS5200_MEMORY_SLOTS];
+    double m_slotLoadMicros;        // Measured device time of a slot load, -1 until one was seen.
+    DeviceState m_knownState;
+    unsigned m_knownFields;
+    
+    // Hand over of commands from other threads to the one running the loop.
+    std::recursive_mutex m_loopMutex;
+    std::mutex m_inboxMutex;
+    std::vector<Request> m_inbox;
+    std::thread::id m_loopOwner;
+    int m_loopDepth;
+    int m_wakeFd;
+    
+    void recordLatency(int commandClass, int64_t micros);
+    
+    void requeueInFlight();
+    void failAll();
+    bool openDevice(const char *deviceName);
+    bool waitForDevice(const char *deviceName, int timeoutMs);
+    bool acquireDeviceLock(const char *deviceName);
+    void releaseDeviceLock();
+    void linkLost();
+    void cacheSetting(const char *command, int len);
+    void noteVerification(const char *command, int len);
+    void verifyIfDue();
+    Request makeRequest(const char *command, const Completion &done, int priority);
+    int nextPriority(int64_t now);
+    bool bulkGateOpen(int64_t now);
+    int sampleOutputQueue(int64_t now);
+    void noteKnownState(const DeviceState &state, unsigned fields);
+    static unsigned frameFields(const char *frame);
+    bool writeSlotIndex();
+    size_t unsentBytes();
+    bool enterLoop(const char *command, int priority, char *response, bool &ok);
+    void leaveLoop();
+    void drainInbox();
 };
-
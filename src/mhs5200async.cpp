@@ -0,0 +1,597 @@
+// Non-blocking request/response core of MHS5200Driver. The blocking API drives it with runPending().
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/uio.h>
+#include <termios.h>
+#include <sys/ioctl.h>
+#include <condition_variable>
+#include <algorithm>
+#include "mhs5200.hpp"
+#include "mhs5200events.hpp"
+
+MHS5200Driver::Request MHS5200Driver::makeRequest(const char *command, const MHS5200Driver::Completion &done, int priority) {
+    Request request;
+    request.command = command;
+    expectedResponse(command, request.prefix);
+    request.done = done;
+    request.attempt = 0;
+    request.commandClass = commandClass(command);
+    request.priority = priority < 0 || priority >= PriorityClasses ? PriorityNormal : priority;
+    request.queuedMicros = monotonicMicros();
+    request.sentMicros = 0;
+    request.timeoutMicros = 0;
+    return request;
+}
+
+void MHS5200Driver::submit(const char *command, const MHS5200Driver::Completion &done, int priority) {
+    Request request = makeRequest(command, done, priority);
+    m_queued[request.priority].push_back(request);
+    cacheSetting(command, (int)request.command.size());
+    
+    // Start sending right away, most of the time the tty accepts the whole frame without blocking.
+    if ( m_fileDescriptor && m_resumeMicros == 0 && !m_holdOutput ) onWritable();
+}
+
+int MHS5200Driver::pendingRequests() {
+    size_t pending = m_inFlight.size();
+    for ( auto &queue : m_queued ) pending += queue.size();
+    return (int)pending;
+}
+
+void MHS5200Driver::setPipelineDepth(int depth) {
+    m_pipelineDepth = depth < 1 ? 1 : depth;
+}
+
+void MHS5200Driver::setPriorityDeadline(int priority, int deadlineMs) {
+    if ( priority >= 0 && priority < PriorityClasses ) m_deadlineMicros[priority] = (int64_t)deadlineMs*1000;
+}
+
+const MHS5200Driver::SchedulerStatistics &MHS5200Driver::getSchedulerStatistics(int priority) {
+    return m_scheduler[priority < 0 || priority >= PriorityClasses ? PriorityNormal : priority];
+}
+
+bool MHS5200Driver::bulkGateOpen(int64_t now) {
+    // Only one bulk frame may be on its way to the device, whatever comes after it waits at most that long.
+    // The next one is written when the previous one should have left at the line speed.
+    if ( m_unsentFrames > 0 ) return false;
+    if ( now < m_bulkClearMicros ) return false;
+    
+    // Flow control may have held bytes back, the UART knows how many are still waiting.
+    int queued = m_bulkClearMicros ? sampleOutputQueue(now) : 0;
+    if ( queued > 0 ) {
+        m_bulkClearMicros = now + (int64_t)(queued * wireMicrosPerByte());
+        return false;
+    }
+    m_bulkClearMicros = 0;
+    return true;
+}
+
+int MHS5200Driver::nextPriority(int64_t now) {
+    // Urgent commands go first and past a full pipeline, a window of bulk chunks must not hold them back.
+    if ( !m_queued[PriorityUrgent].empty() ) return PriorityUrgent;
+    if ( (int)m_inFlight.size() >= m_pipelineDepth ) return -1;
+    
+    int chosen = -1;
+    for ( int priority = PriorityUrgent+1; priority < PriorityClasses; priority++ ) {
+        if ( m_queued[priority].empty() ) continue;
+        if ( chosen < 0 ) chosen = priority;
+        if ( now - m_queued[priority].front().queuedMicros > m_deadlineMicros[priority] ) {
+            // Past its deadline, goes ahead of the higher classes.
+            chosen = priority;
+            break;
+        }
+    }
+    if ( chosen == PriorityBulk && !bulkGateOpen(now) ) return -1;
+    return chosen;
+}
+
+int MHS5200Driver::sampleOutputQueue(int64_t now) {
+    int queued = 0;
+    if ( ioctl(m_fileDescriptor, TIOCOUTQ, &queued) != 0 ) return -1;
+    // Samples are taken before every write, so the queue only shrinks between two of them. When the later
+    // one still finds bytes the line was busy all along and the bytes gone in between show its real rate.
+    uint64_t left = m_statistics.bytesWritten - (uint64_t)queued;
+    if ( m_queueSampleMicros && m_queueSampleBytes > 0 && queued > 0 && left >= m_queueSampleLeft ) {
+        m_statistics.wireBytes += left - m_queueSampleLeft;
+        m_statistics.wireMicros += (uint64_t)(now - m_queueSampleMicros);
+    }
+    m_queueSampleMicros = now;
+    m_queueSampleBytes = queued;
+    m_queueSampleLeft = left;
+    return queued;
+}
+
+size_t MHS5200Driver::unsentBytes() {
+    size_t bytes = 0;
+    for ( size_t i = m_inFlight.size() - m_unsentFrames; i < m_inFlight.size(); i++ )
+        bytes += m_inFlight[i].command.size();
+    return bytes - m_outputOffset;
+}
+
+short MHS5200Driver::pollEvents() {
+    short events = 0;
+    if ( !m_inFlight.empty() ) events |= POLLIN;
+    if ( m_unsentFrames > 0 || (m_resumeMicros == 0 && nextPriority(monotonicMicros()) >= 0) )
+        events |= POLLOUT;
+    return events;
+}
+
+int MHS5200Driver::timeoutMillis() {
+    int64_t deadline = -1;
+    if ( m_resumeMicros ) {
+        deadline = m_resumeMicros;
+    } else if ( !m_inFlight.empty() && m_unsentFrames == 0 ) {
+        const Request &head = m_inFlight.front();
+        deadline = std::max(head.sentMicros, m_lastResponseMicros) + head.timeoutMicros;
+    }
+    if ( m_bulkClearMicros && !m_queued[PriorityBulk].empty() && (deadline < 0 || m_bulkClearMicros < deadline) )
+        deadline = m_bulkClearMicros;
+    if ( deadline < 0 ) return -1;
+    int64_t remaining = deadline - monotonicMicros();
+    if ( remaining <= 0 ) return 0;
+    return (int)((remaining + 999) / 1000);
+}
+
+void MHS5200Driver::onWritable() {
+    if ( m_resumeMicros ) return;
+    
+    // Move as many queued requests as the pipeline allows in flight, they go out together in one writev().
+    int64_t now = monotonicMicros();
+    for (;;) {
+        int priority = nextPriority(now);
+        if ( priority < 0 ) break;
+        if ( m_needResync && m_inFlight.empty() ) flushInput();
+        Request request = m_queued[priority].front();
+        m_queued[priority].pop_front();
+        
+        SchedulerStatistics &stats = m_scheduler[priority];
+        uint64_t waited = (uint64_t)(now - request.queuedMicros);
+        stats.commands++;
+        stats.totalQueueMicros += waited;
+        if ( waited > stats.maxQueueMicros ) stats.maxQueueMicros = waited;
+        if ( (int64_t)waited > m_deadlineMicros[priority] ) stats.deadlineMisses++;
+        if ( priority == PriorityBulk )
+            m_bulkClearMicros = now + (int64_t)((unsentBytes() + request.command.size()) * wireMicrosPerByte());
+        
+        request.sentMicros = 0;
+        m_inFlight.push_back(request);
+        m_unsentFrames++;
+    }
+    
+    while ( m_unsentFrames > 0 ) {
+        // The frames are gathered from the requests themselves, a short write resumes inside a frame.
+        struct iovec iov[MHS5200_WRITEV_FRAMES];
+        size_t first = m_inFlight.size() - m_unsentFrames;
+        int count = 0;
+        size_t offered = 0;
+        for ( size_t i = first; i < m_inFlight.size() && count < MHS5200_WRITEV_FRAMES; i++, count++ ) {
+            const std::string &command = m_inFlight[i].command;
+            size_t skip = count == 0 ? m_outputOffset : 0;
+            iov[count].iov_base = (void *)(command.data() + skip);
+            iov[count].iov_len = command.size() - skip;
+            offered += iov[count].iov_len;
+        }
+        sampleOutputQueue(monotonicMicros());
+        ssize_t n = writev(m_fileDescriptor, iov, count);
+        if ( n < 0 ) {
+            if ( errno == EINTR ) continue;
+            if ( errno == EAGAIN ) return;
+            systemError("write", "Error from write, %s\n", strerror(errno));
+            linkLost();
+            return;
+        }
+        m_statistics.writes++;
+        m_statistics.bytesWritten += n;
+        if ( (size_t)n < offered ) m_statistics.partialWrites++;
+        
+        // The response timeout of a frame starts once its last byte has been handed to the tty.
+        now = monotonicMicros();
+        size_t left = (size_t)n;
+        for ( int k = 0; k < count && left > 0; k++ ) {
+            size_t part = std::min(left, iov[k].iov_len);
+            MHS5200_TRACE_IO(EventWrite, (int)part, (const char *)iov[k].iov_base);
+            m_trace.record(MHS5200TraceRecord::TX, (const char *)iov[k].iov_base, part);
+            left -= part;
+            if ( part < iov[k].iov_len ) {
+                m_outputOffset += part;
+                break;
+            }
+            Request &request = m_inFlight[first + k];
+            request.sentMicros = now;
+            request.timeoutMicros = responseTimeoutMicros(request.command.c_str());
+            m_unsentFrames--;
+            m_outputOffset = 0;
+        }
+    }
+}
+
+void MHS5200Driver::onReadable() {
+    if ( m_readLength >= (int)sizeof(m_readBuffer) ) {
+        // A full buffer without a frame boundary is garbage.
+        m_readLength = 0;
+    }
+    int rdlen = read(m_fileDescriptor, &m_readBuffer[m_readLength], sizeof(m_readBuffer) - m_readLength);
+    if ( rdlen > 0 ) {
+        MHS5200_TRACE_IO(EventRead, rdlen, &m_readBuffer[m_readLength]);
+        m_trace.record(MHS5200TraceRecord::RX, &m_readBuffer[m_readLength], rdlen);
+        m_readLength += rdlen;
+    } else if ( rdlen < 0 ) {
+        if ( errno == EINTR || errno == EAGAIN ) return;
+        systemError("read", "Error from read: %d: %s\n", rdlen, strerror(errno));
+        linkLost();
+        return;
+    } else {
+        systemError("read", "Device closed\n");
+        linkLost();
+        return;
+    }
+    
+    char response[MHS5200_BUFFER_SIZE];
+    int64_t now = monotonicMicros();
+    while ( nextResponse(response) ) {
+        // Responses come back in order, match against the oldest request in flight first so a lost
+        // reply only costs the requests whose replies actually went missing.
+        // Frames not completely written cannot have been answered.
+        auto written = m_inFlight.end() - m_unsentFrames;
+        auto match = m_inFlight.end();
+        for ( auto i = m_inFlight.begin(); i != written; ++i ) {
+            if ( matchesResponse(response, i->prefix) ) {
+                match = i;
+                break;
+            }
+        }
+        if ( match == m_inFlight.end() ) {
+            m_statistics.discardedFrames++;
+            continue;
+        }
+        Request request = *match;
+        m_inFlight.erase(match);
+        m_statistics.commands++;
+        
+        // A request waits for the one ahead of it, its latency starts with the previous response. Responses
+        // taken from the same read say nothing about the device and are not sampled.
+        int64_t start = std::max(request.sentMicros, m_lastResponseMicros);
+        if ( request.sentMicros && start < now ) {
+            int64_t wire = (int64_t)(wireMicrosPerByte() * (request.command.size() + strlen(response) + 2));
+            recordLatency(request.commandClass, now - start - wire);
+        }
+        m_lastResponseMicros = now;
+        m_consecutiveMisses = 0;
+        if ( strcmp(response, "ok") == 0 ) noteVerification(request.command.c_str(), (int)request.command.size());
+        if ( request.done ) request.done(response);
+    }
+    
+    onWritable();
+}
+
+void MHS5200Driver::onTimeout() {
+    int64_t now = monotonicMicros();
+    
+    if ( m_resumeMicros ) {
+        if ( now < m_resumeMicros ) return;
+        m_resumeMicros = 0;
+        flushInput();
+        onWritable();
+        return;
+    }
+    if ( m_bulkClearMicros && now >= m_bulkClearMicros && !m_queued[PriorityBulk].empty() ) onWritable();
+    
+    if ( m_inFlight.empty() || m_unsentFrames > 0 ) return;
+    Request &head = m_inFlight.front();
+    if ( now - std::max(head.sentMicros, m_lastResponseMicros) < head.timeoutMicros ) return;
+    
+    MHS5200_TRACE_EVENT(EventTimeout, (int)(head.timeoutMicros/1000));
+    m_statistics.timeouts++;
+    m_needResync = true;
+    m_consecutiveMisses++;
+    
+    if ( m_failFastMisses > 0 && m_consecutiveMisses >= m_failFastMisses ) {
+        // Nothing came back for a while, the device is switched off or unplugged. Retrying every command
+        // would stall a whole chain, fail what is pending until the device answers again.
+        if ( m_consecutiveMisses == m_failFastMisses )
+            systemError("transact", "Device not responding after %d consecutive timeouts\n", m_consecutiveMisses);
+        MHS5200_TRACE_EVENT(EventFailure, m_consecutiveMisses);
+        failAll();
+        return;
+    }
+    
+    // Every command sets or reads an absolute value, so everything in flight is simply sent again.
+    if ( ++head.attempt > m_maxRetries ) {
+        Request failed = head;
+        m_inFlight.pop_front();
+        MHS5200_TRACE_EVENT(EventFailure, 0);
+        m_statistics.failures++;
+        systemError("transact", "No valid response after %d attempts\n", m_maxRetries+1);
+        requeueInFlight();
+        if ( failed.done ) failed.done(nullptr);
+        if ( pendingRequests() > 0 ) {
+            flushInput();
+            onWritable();
+        }
+        return;
+    }
+    
+    MHS5200_TRACE_EVENT(EventRetry, head.attempt);
+    m_statistics.retries++;
+    int attempt = head.attempt;
+    requeueInFlight();
+    m_resumeMicros = now + (int64_t)backoffMillis(attempt)*1000;
+    if ( m_resumeMicros == now ) m_resumeMicros = now + 1;
+}
+
+int MHS5200Driver::commandClass(const char *command) {
+    if ( command[0] == ':' && command[1] == 'r' ) return CommandRead;
+    if ( command[0] == ':' && command[1] == 'a' ) return CommandArbitrary;
+    return CommandSet;
+}
+
+void MHS5200Driver::setAdaptiveTimeouts(double factor, int floorMs, int failFastMisses) {
+    m_timeoutFactor = factor;
+    m_timeoutFloorMs = floorMs;
+    m_failFastMisses = failFastMisses;
+}
+
+void MHS5200Driver::recordLatency(int commandClass, int64_t micros) {
+    // Histogram with four buckets per octave, the quantiles are accurate to about 20%.
+    int bucket = micros > 1 ? (int)(4*log2((double)micros)) : 0;
+    if ( bucket >= MHS5200_LATENCY_BUCKETS ) bucket = MHS5200_LATENCY_BUCKETS-1;
+    uint32_t *counts = m_latency[commandClass];
+    counts[bucket]++;
+    if ( ++m_latencySamples[commandClass] < 65536 ) return;
+    
+    // Halve the old samples now and then so the distribution follows a device that gets slower.
+    m_latencySamples[commandClass] = 0;
+    for ( int i = 0; i < MHS5200_LATENCY_BUCKETS; i++ ) {
+        counts[i] /= 2;
+        m_latencySamples[commandClass] += counts[i];
+    }
+}
+
+double MHS5200Driver::latencyQuantile(int commandClass, double quantile) {
+    uint32_t samples = m_latencySamples[commandClass];
+    if ( samples < MHS5200_LATENCY_MIN_SAMPLES ) return -1;
+    uint32_t target = (uint32_t)ceil(quantile * samples);
+    uint32_t seen = 0;
+    int bucket = 0;
+    for ( ; bucket < MHS5200_LATENCY_BUCKETS-1; bucket++ ) {
+        seen += m_latency[commandClass][bucket];
+        if ( seen >= target ) break;
+    }
+    // Upper edge of the bucket, a timeout errs on the long side.
+    return pow(2.0, (bucket+1)/4.0);
+}
+
+int64_t MHS5200Driver::responseTimeoutMicros(const char *command) {
+    int cls = commandClass(command);
+    int64_t ceilingMicros = (int64_t)m_attemptTimeoutMs*1000;
+    int64_t floorMicros = (int64_t)m_timeoutFloorMs*1000;
+    // A query is answered with about 16 bytes, a set with ok.
+    int64_t wire = (int64_t)(wireMicrosPerByte() * (strlen(command) + (cls == CommandRead ? 16 : 4)));
+    
+    // While the device is not answering every command gets one short attempt.
+    if ( m_failFastMisses > 0 && m_consecutiveMisses >= m_failFastMisses ) return floorMicros + wire;
+    
+    double latency = m_timeoutFactor > 0 ? latencyQuantile(cls, 0.999) : -1;
+    if ( latency < 0 ) return ceilingMicros;
+    int64_t timeout = (int64_t)(latency * m_timeoutFactor) + wire;
+    if ( timeout < floorMicros ) timeout = floorMicros;
+    if ( timeout > ceilingMicros ) timeout = ceilingMicros;
+    return timeout;
+}
+
+void MHS5200Driver::requeueInFlight() {
+    while ( !m_inFlight.empty() ) {
+        m_queued[m_inFlight.back().priority].push_front(m_inFlight.back());
+        m_inFlight.pop_back();
+    }
+    m_unsentFrames = 0;
+    m_outputOffset = 0;
+}
+
+void MHS5200Driver::failAll() {
+    std::deque<Request> failed;
+    failed.swap(m_inFlight);
+    for ( auto &queue : m_queued ) {
+        failed.insert(failed.end(), queue.begin(), queue.end());
+        queue.clear();
+    }
+    m_unsentFrames = 0;
+    m_outputOffset = 0;
+    m_resumeMicros = 0;
+    m_needResync = true;
+    for ( auto &request : failed ) {
+        m_statistics.failures++;
+        if ( request.done ) request.done(nullptr);
+    }
+}
+
+bool MHS5200Driver::runPending() {
+    drainInbox();
+    while ( pendingRequests() > 0 ) {
+        if ( !m_fileDescriptor ) {
+            if ( m_reconnectTimeoutMs > 0 && reconnect(m_reconnectTimeoutMs) ) continue;
+            failAll();
+            return false;
+        }
+        struct pollfd pfd[2];
+        pfd[0].fd = m_fileDescriptor;
+        pfd[0].events = pollEvents();
+        pfd[0].revents = 0;
+        pfd[1].fd = m_wakeFd;
+        pfd[1].events = POLLIN;
+        pfd[1].revents = 0;
+        int ready = poll(pfd, m_wakeFd >= 0 ? 2 : 1, timeoutMillis());
+        if ( ready < 0 ) {
+            if ( errno == EINTR ) continue;
+            systemError("poll", "Error from poll: %s\n", strerror(errno));
+            failAll();
+            return false;
+        }
+        if ( ready == 0 ) {
+            onTimeout();
+            continue;
+        }
+        if ( pfd[1].revents & POLLIN ) drainInbox();
+        if ( pfd[0].revents & (POLLIN | POLLERR | POLLHUP) ) onReadable();
+        if ( pfd[0].revents & POLLOUT ) onWritable();
+        onTimeout();
+    }
+    return true;
+}
+
+void MHS5200Driver::drainInbox() {
+    std::vector<Request> inbox;
+    {
+        std::lock_guard<std::mutex> lock(m_inboxMutex);
+        inbox.swap(m_inbox);
+        uint64_t wakeups;
+        if ( m_wakeFd >= 0 && read(m_wakeFd, &wakeups, sizeof(wakeups)) < 0 && errno != EAGAIN ) {
+            systemError("read", "Error from read: %s\n", strerror(errno));
+        }
+    }
+    for ( auto &request : inbox ) {
+        cacheSetting(request.command.c_str(), (int)request.command.size());
+        m_queued[request.priority].push_back(request);
+    }
+    if ( !inbox.empty() && m_fileDescriptor && m_resumeMicros == 0 ) onWritable();
+}
+
+bool MHS5200Driver::enterLoop(const char *command, int priority, char *response, bool &ok) {
+    std::thread::id self = std::this_thread::get_id();
+    if ( !command ) {
+        // Operations with many commands wait for the link as a whole.
+        m_loopMutex.lock();
+        std::lock_guard<std::mutex> lock(m_inboxMutex);
+        m_loopOwner = self;
+        m_loopDepth++;
+        return false;
+    }
+    for (;;) {
+        std::unique_lock<std::mutex> lock(m_inboxMutex);
+        if ( m_loopDepth > 0 && m_loopOwner != self ) {
+            // Another thread is busy on the link, it sends the command in between its own by priority.
+            std::condition_variable finished;
+            bool done = false;
+            ok = false;
+            m_inbox.push_back(makeRequest(command, [&](const char *reply) {
+                std::lock_guard<std::mutex> guard(m_inboxMutex);
+                if ( reply ) {
+                    strcpy(response, reply);
+                    ok = true;
+                }
+                done = true;
+                finished.notify_one();
+            }, priority));
+            uint64_t one = 1;
+            if ( write(m_wakeFd, &one, sizeof(one)) < 0 ) {
+                systemError("write", "Error from write: %s\n", strerror(errno));
+            }
+            finished.wait(lock, [&] { return done; });
+            return true;
+        }
+        if ( m_loopMutex.try_lock() ) {
+            m_loopOwner = self;
+            m_loopDepth++;
+            return false;
+        }
+        // The owner is just taking over or leaving.
+        lock.unlock();
+        std::this_thread::yield();
+    }
+}
+
+void MHS5200Driver::leaveLoop() {
+    for (;;) {
+        {
+            std::lock_guard<std::mutex> lock(m_inboxMutex);
+            if ( m_loopDepth > 1 || m_inbox.empty() ) {
+                if ( --m_loopDepth == 0 ) m_loopOwner = std::thread::id();
+                m_loopMutex.unlock();
+                return;
+            }
+        }
+        // Commands handed over at the last moment still need sending.
+        runPending();
+    }
+}
+
+const char *MHS5200Driver::transact(const char *command, int priority) {
+    static thread_local char handedOver[MHS5200_BUFFER_SIZE];
+    bool ok = false;
+    if ( enterLoop(command, priority, handedOver, ok) ) return ok ? handedOver : nullptr;
+    submit(command, [&](const char *response) {
+        if ( response ) {
+            strcpy(m_responseBuffer, response);
+            ok = true;
+        }
+    }, priority);
+    runPending();
+    // The response is already copied, a batch of read backs may reuse the buffers.
+    if ( ok && m_loopDepth == 1 ) verifyIfDue();
+    leaveLoop();
+    return ok ? m_responseBuffer : nullptr;
+}
+
+int MHS5200Driver::rawBatch(const char *const commands[], int count, const char *responses[]) {
+    int received = 0;
+    bool ok;
+    enterLoop(nullptr, PriorityNormal, nullptr, ok);
+    int depth = m_pipelineDepth;
+    
+    if ( count > MHS5200_MAX_BATCH ) count = MHS5200_MAX_BATCH;
+    // Queue everything before the first write so the whole batch goes out in one write.
+    m_pipelineDepth = count;
+    m_holdOutput = true;
+    for ( int i = 0; i < count; i++ ) {
+        responses[i] = nullptr;
+        submit(commands[i], [&, i](const char *response) {
+            if ( !response ) return;
+            strcpy(m_batchResponses[i], response);
+            responses[i] = m_batchResponses[i];
+            received++;
+        });
+    }
+    m_holdOutput = false;
+    onWritable();
+    runPending();
+    m_pipelineDepth = depth;
+    leaveLoop();
+    return received;
+}
+
+int MHS5200Driver::rawPipeline(int count, int window, const std::function<const char *(int index)> &command,
+                               const std::function<void(int index)> &acknowledged, int priority) {
+    int acked = 0, submitted = 0;
+    bool failed = false;
+    bool ok;
+    enterLoop(nullptr, priority, nullptr, ok);
+    int depth = m_pipelineDepth;
+    m_pipelineDepth = window < 1 ? 1 : window;
+    
+    // Each acknowledgement submits the next command so at most window commands are in flight.
+    std::function<void()> submitNext;
+    submitNext = [&]() {
+        int index = submitted++;
+        submit(command(index), [&, index](const char *response) {
+            if ( !response ) {
+                failed = true;
+                return;
+            }
+            if ( acknowledged ) acknowledged(index);
+            acked++;
+            if ( !failed && submitted < count ) submitNext();
+        }, priority);
+    };
+    while ( submitted < count && submitted < m_pipelineDepth )
+        submitNext();
+    runPending();
+    
+    m_pipelineDepth = depth;
+    leaveLoop();
+    return acked;
+}
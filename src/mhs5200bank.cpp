@@ -0,0 +1,219 @@
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include "mhs5200bank.hpp"
+
+MHS5200Bank::MHS5200Bank() : m_slots(MHS5200_BANK_SLOTS), m_parseMillis(0)
+{
+    for ( auto &slot : m_slots ) {
+        slot.used = false;
+        slot.parseMillis = slot.encodeMillis = slot.uploadMillis = 0;
+        slot.bytes = 0;
+    }
+}
+
+bool MHS5200Bank::loadManifest(const char *fileName, std::string &error) {
+    FILE *f = fopen(fileName, "r");
+    if ( !f ) {
+        error = std::string("Error: Opening manifest ") + fileName + ": " + strerror(errno);
+        return false;
+    }
+    
+    std::string directory;
+    const char *slash = strrchr(fileName, '/');
+    if ( slash ) directory.assign(fileName, slash - fileName + 1);
+    
+    char line[4096];
+    int lineNumber = 0;
+    while ( fgets(line, sizeof(line), f) ) {
+        lineNumber++;
+        char *p = line;
+        while ( isspace((unsigned char)*p) ) p++;
+        if ( *p == 0 || *p == '#' ) continue;
+        
+        char *end = nullptr;
+        long slot = strtol(p, &end, 10);
+        if ( end == p || !isspace((unsigned char)*end) || slot < 0 || slot >= MHS5200_BANK_SLOTS ) {
+            error = std::string("Error: ") + fileName + " line " + std::to_string(lineNumber) + ": expected <slot 0-15> <file>.";
+            fclose(f);
+            return false;
+        }
+        p = end;
+        while ( isspace((unsigned char)*p) ) p++;
+        end = p + strlen(p);
+        while ( end > p && isspace((unsigned char)end[-1]) ) end--;
+        if ( end == p ) {
+            error = std::string("Error: ") + fileName + " line " + std::to_string(lineNumber) + ": missing file name.";
+            fclose(f);
+            return false;
+        }
+        if ( m_slots[slot].used ) {
+            error = std::string("Error: ") + fileName + " line " + std::to_string(lineNumber) + ": slot " + std::to_string(slot) + " listed twice.";
+            fclose(f);
+            return false;
+        }
+        
+        std::string name(p, end - p);
+        m_slots[slot].used = true;
+        m_slots[slot].fileName = name[0] == '/' ? name : directory + name;
+    }
+    fclose(f);
+    m_manifestName = fileName;
+    return true;
+}
+
+bool MHS5200Bank::parseSamples(const char *fileName, std::vector<int> &values, std::string &error, int maxSample, size_t limit) {
+    FILE *f = fopen(fileName, "rb");
+    if ( !f ) {
+        error = std::string("Error: Opening ") + fileName + ": " + strerror(errno);
+        return false;
+    }
+    std::vector<char> data;
+    char block[16384];
+    size_t n;
+    while ( (n = fread(block, 1, sizeof(block), f)) > 0 )
+        data.insert(data.end(), block, block + n);
+    fclose(f);
+    data.push_back(0);
+    
+    // One sample per line, anything else is an error.
+    const char *p = data.data();
+    int lineNumber = 1;
+    values.clear();
+    if ( limit ) values.reserve(limit);
+    while ( *p && (limit == 0 || values.size() < limit) ) {
+        while ( *p == ' ' || *p == '\t' ) p++;
+        char *end = nullptr;
+        long v = strtol(p, &end, 10);
+        if ( end == p || v < 0 || v > maxSample ) {
+            error = std::string("Error: Parsing file ") + fileName + " line " + std::to_string(lineNumber) + 
+                    ", expected a sample between 0 and " + std::to_string(maxSample) + ".";
+            return false;
+        }
+        values.push_back((int)v);
+        p = end;
+        while ( *p == ' ' || *p == '\t' || *p == '\r' ) p++;
+        if ( *p == '\n' ) {
+            p++;
+            lineNumber++;
+        } else if ( *p ) {
+            error = std::string("Error: Parsing file ") + fileName + " line " + std::to_string(lineNumber) + ", unexpected text after the sample.";
+            return false;
+        }
+    }
+    return true;
+}
+
+bool MHS5200Bank::parseWaveform(const char *fileName, int values[MHS5200_ARB_VALUES], std::string &error, int maxSample) {
+    std::vector<int> samples;
+    if ( !parseSamples(fileName, samples, error, maxSample, MHS5200_ARB_VALUES) ) return false;
+    int count = (int)samples.size();
+    if ( count < MHS5200_ARB_VALUES ) {
+        error = std::string("Error: Parsing file ") + fileName + ", expected " + std::to_string(MHS5200_ARB_VALUES) + 
+                " samples but found " + std::to_string(count) + ".";
+        return false;
+    }
+    std::copy(samples.begin(), samples.end(), values);
+    return true;
+}
+
+bool MHS5200Bank::parseFiles(int threads, std::string &error) {
+    std::vector<int> work;
+    for ( int i = 0; i < MHS5200_BANK_SLOTS; i++ )
+        if ( m_slots[i].used ) work.push_back(i);
+    if ( work.empty() ) {
+        error = "Error: Manifest " + m_manifestName + " lists no slots.";
+        return false;
+    }
+    
+    if ( threads <= 0 ) threads = (int)std::thread::hardware_concurrency();
+    if ( threads <= 0 ) threads = 1;
+    if ( threads > (int)work.size() ) threads = (int)work.size();
+    
+    std::atomic<int> next(0);
+    std::vector<std::string> errors(MHS5200_BANK_SLOTS);
+    int64_t start = MHS5200Driver::monotonicMicros();
+    std::vector<std::thread> pool;
+    for ( int t = 0; t < threads; t++ ) {
+        pool.emplace_back([&]() {
+            int i;
+            while ( (i = next++) < (int)work.size() ) {
+                Slot &slot = m_slots[work[i]];
+                int64_t slotStart = MHS5200Driver::monotonicMicros();
+                parseWaveform(slot.fileName.c_str(), slot.values, errors[work[i]]);
+                slot.parseMillis = (MHS5200Driver::monotonicMicros() - slotStart) / 1000.0;
+            }
+        });
+    }
+    for ( auto &t : pool ) t.join();
+    m_parseMillis = (MHS5200Driver::monotonicMicros() - start) / 1000.0;
+    
+    for ( int i : work ) {
+        if ( !errors[i].empty() ) {
+            error = errors[i];
+            return false;
+        }
+    }
+    return true;
+}
+
+bool MHS5200Bank::upload(MHS5200Driver &driver, int window, MHS5200Bank::Report &report) {
+    std::vector<int> order;
+    for ( int i = 0; i < MHS5200_BANK_SLOTS; i++ )
+        if ( m_slots[i].used ) order.push_back(i);
+    
+    int total = (int)order.size() * MHS5200_ARB_CHUNKS;
+    std::vector<char> frames((size_t)total * MHS5200_ARB_CHUNK_SIZE);
+    std::mutex lock;
+    std::condition_variable ready;
+    int encoded = 0;
+    
+    // Encoding runs ahead of the upload, the pipeline only waits when it catches up.
+    std::thread encoder([&]() {
+        for ( size_t s = 0; s < order.size(); s++ ) {
+            Slot &slot = m_slots[order[s]];
+            int64_t start = MHS5200Driver::monotonicMicros();
+            slot.bytes = 0;
+            for ( int chunk = 0; chunk < MHS5200_ARB_CHUNKS; chunk++ ) {
+                int index = (int)s*MHS5200_ARB_CHUNKS + chunk;
+                slot.bytes += MHS5200Driver::formatArbitraryChunk(&frames[(size_t)index*MHS5200_ARB_CHUNK_SIZE], order[s], chunk, 
+                                                                  &slot.values[chunk*MHS5200_ARB_CHUNK_VALUES]);
+                std::lock_guard<std::mutex> guard(lock);
+                encoded = index + 1;
+                ready.notify_one();
+            }
+            slot.encodeMillis = (MHS5200Driver::monotonicMicros() - start) / 1000.0;
+        }
+    });
+    
+    int64_t start = MHS5200Driver::monotonicMicros();
+    int64_t previous = start;
+    int acked = driver.rawPipeline(total, window, [&](int index) -> const char * {
+        std::unique_lock<std::mutex> guard(lock);
+        ready.wait(guard, [&]() { return encoded > index; });
+        return &frames[(size_t)index*MHS5200_ARB_CHUNK_SIZE];
+    }, [&](int index) {
+        if ( (index+1) % MHS5200_ARB_CHUNKS != 0 ) return;
+        int64_t now = MHS5200Driver::monotonicMicros();
+        m_slots[order[index/MHS5200_ARB_CHUNKS]].uploadMillis = (now - previous) / 1000.0;
+        previous = now;
+    }, MHS5200Driver::PriorityBulk);
+    int64_t end = MHS5200Driver::monotonicMicros();
+    encoder.join();
+    
+    memset(&report, 0, sizeof(report));
+    report.slots = (int)order.size();
+    for ( int i : order )
+        report.bytes += m_slots[i].bytes;
+    report.parseMillis = m_parseMillis;
+    report.uploadMillis = (end - start) / 1000.0;
+    if ( end > start ) report.bytesPerSecond = report.bytes * 1000000.0 / (end - start);
+    return acked == total;
+}
@@ -0,0 +1,104 @@
+#pragma once
+#include <string>
+#include <vector>
+#include "mhs5200.hpp"
+
+#define MHS5200_BANK_SLOTS 16
+
+/**
+ * Programs several arbitrary wave form slots in one go.
+ * 
+ * The manifest lists one "<slot> <file>" pair per line, blank lines and lines starting with # are ignored and
+ * relative file names are relative to the manifest. Wave form files are parsed in parallel, the upload encodes
+ * the chunks on a separate thread while the driver keeps the link busy with a pipelined send.
+ */
+class MHS5200Bank
+{
+public:
+    struct Slot {
+        bool used;
+        std::string fileName;
+        int values[MHS5200_ARB_VALUES];
+        double parseMillis;     // Time spent parsing the file.
+        double encodeMillis;    // Time spent encoding the chunks.
+        double uploadMillis;    // Time from the previous slot's last acknowledgement to this slot's last acknowledgement.
+        int bytes;              // Bytes sent for the slot.
+    };
+    
+    struct Report {
+        int slots;
+        int bytes;
+        double parseMillis;     // Wall time of the parallel parse.
+        double uploadMillis;    // Wall time of the upload.
+        double bytesPerSecond;
+    };
+    
+protected:
+    std::vector<Slot> m_slots;
+    std::string m_manifestName;
+    double m_parseMillis;
+    
+public:
+    MHS5200Bank();
+    
+    /**
+     * Read a manifest. The wave form files are not read yet.
+     * 
+     * @param fileName The manifest.
+     * @param error Receives a description of the problem on failure.
+     * @return True on success.
+     */
+    bool loadManifest(const char *fileName, std::string &error);
+    
+    /**
+     * Parse and validate the wave form files of all slots in the manifest.
+     * 
+     * @param threads Number of worker threads, 0 for one per CPU.
+     * @param error Receives a description of the first problem on failure.
+     * @return True when all files are valid.
+     */
+    bool parseFiles(int threads, std::string &error);
+    
+    /**
+     * Upload all parsed slots.
+     * 
+     * @param driver Connected driver.
+     * @param window Chunks in flight, see MHS5200Driver::rawPipeline().
+     * @param report Receives the totals, per slot times are in slot().
+     * @return True when every chunk was acknowledged.
+     */
+    bool upload(MHS5200Driver &driver, int window, Report &report);
+    
+    /**
+     * Access a slot.
+     * 
+     * @param index Slot 0-15.
+     * @return The slot.
+     */
+    const Slot &slot(int index) { return m_slots[index]; }
+    
+    /**
+     * Parse a wave form file of MHS5200_ARB_VALUES lines with one sample each.
+     * 
+     * @param fileName The file.
+     * @param values Receives the samples.
+     * @param error Receives a description of the problem on failure.
+     * @param maxSample Largest sample the model takes, see MHS5200ModelLimits.
+     * @return True on success.
+     */
+    static bool parseWaveform(const char *fileName, int values[MHS5200_ARB_VALUES], std::string &error,
+                              int maxSample = MHS5200_ARB_MAX_SAMPLE);
+    
+    /**
+     * Parse a wave form file of any length in the format of parseWaveform().
+     * 
+     * @param fileName The file.
+     * @param values Receives the samples.
+     * @param error Receives a description of the problem on failure.
+     * @param maxSample Largest sample the model takes, see MHS5200ModelLimits.
+     * @param limit Stop after this many samples, 0 reads the whole file.
+     * @return True on success.
+     */
+    static bool parseSamples(const char *fileName, std::vector<int> &values, std::string &error,
+                             int maxSample = MHS5200_ARB_MAX_SAMPLE, size_t limit = 0);
+};
@@ -0,0 +1,191 @@
+#include <new>
+#include <string.h>
+#include "mhs5200.hpp"
+#include "mhs5200c.h"
+
+struct mhs5200 {
+    MHS5200Driver driver;
+};
+
+static int readChannel(mhs5200_t *handle, int channel, MHS5200Driver::StateField field, MHS5200Driver::ChannelState &state) {
+    if ( !handle || channel < 1 || channel > 2 ) return -1;
+    MHS5200Driver::DeviceState device;
+    unsigned mask = MHS5200Driver::fieldMask(channel, field);
+    if ( handle->driver.readState(device, mask) != mask ) return -1;
+    state = device.channels[channel-1];
+    return 0;
+}
+
+static int readDevice(mhs5200_t *handle, MHS5200Driver::StateField field, MHS5200Driver::DeviceState &state) {
+    if ( !handle ) return -1;
+    return handle->driver.readState(state, field) == (unsigned)field ? 0 : -1;
+}
+
+static int result(bool ok) {
+    return ok ? 0 : -1;
+}
+
+extern "C" {
+
+mhs5200_t *mhs5200_open(const char *device) {
+    mhs5200_t *handle = new (std::nothrow) mhs5200_t;
+    if ( !handle ) return nullptr;
+    if ( !device || !handle->driver.connect(device) ) {
+        delete handle;
+        return nullptr;
+    }
+    return handle;
+}
+
+void mhs5200_close(mhs5200_t *handle) {
+    delete handle;
+}
+
+int mhs5200_version(void) {
+    return 10000;
+}
+
+int mhs5200_get_channel_state(mhs5200_t *handle, int channel, mhs5200_channel_state_t *state) {
+    if ( !handle || !state || channel < 1 || channel > 2 ) return -1;
+    MHS5200Driver::DeviceState device;
+    unsigned mask = MHS5200Driver::fieldMask(channel, MHS5200Driver::FieldAllChannel);
+    if ( handle->driver.readState(device, mask) != mask ) return -1;
+    const MHS5200Driver::ChannelState &ch = device.channels[channel-1];
+    state->wave = (int)ch.wave;
+    state->frequency = ch.frequency;
+    state->amplitude = ch.amplitude;
+    state->duty_cycle = ch.dutyCycle;
+    state->offset = ch.offset;
+    state->phase_offset = ch.phaseOffset;
+    state->inverted = ch.inverted;
+    return 0;
+}
+
+int mhs5200_get_frequency(mhs5200_t *handle, int channel, double *hz) {
+    MHS5200Driver::ChannelState state;
+    if ( !hz || readChannel(handle, channel, MHS5200Driver::FieldFrequency, state) != 0 ) return -1;
+    *hz = state.frequency;
+    return 0;
+}
+
+int mhs5200_set_frequency(mhs5200_t *handle, int channel, double hz) {
+    return handle ? result(handle->driver.setFrequency(channel, hz)) : -1;
+}
+
+int mhs5200_get_duty_cycle(mhs5200_t *handle, int channel, double *duty_cycle) {
+    MHS5200Driver::ChannelState state;
+    if ( !duty_cycle || readChannel(handle, channel, MHS5200Driver::FieldDutyCycle, state) != 0 ) return -1;
+    *duty_cycle = state.dutyCycle;
+    return 0;
+}
+
+int mhs5200_set_duty_cycle(mhs5200_t *handle, int channel, double duty_cycle) {
+    return handle ? result(handle->driver.setDutyCycle(channel, duty_cycle)) : -1;
+}
+
+int mhs5200_get_wave(mhs5200_t *handle, int channel, int *wave) {
+    MHS5200Driver::ChannelState state;
+    if ( !wave || readChannel(handle, channel, MHS5200Driver::FieldWave, state) != 0 ) return -1;
+    *wave = (int)state.wave;
+    return 0;
+}
+
+int mhs5200_set_wave(mhs5200_t *handle, int channel, int wave) {
+    return handle ? result(handle->driver.setWaveType(channel, (MHS5200Driver::WaveType)wave)) : -1;
+}
+
+int mhs5200_get_offset(mhs5200_t *handle, int channel, int *offset) {
+    MHS5200Driver::ChannelState state;
+    if ( !offset || readChannel(handle, channel, MHS5200Driver::FieldOffset, state) != 0 ) return -1;
+    *offset = state.offset;
+    return 0;
+}
+
+int mhs5200_set_offset(mhs5200_t *handle, int channel, int offset) {
+    return handle ? result(handle->driver.setOffset(channel, offset)) : -1;
+}
+
+int mhs5200_get_amplitude(mhs5200_t *handle, int channel, double *amplitude) {
+    MHS5200Driver::ChannelState state;
+    if ( !amplitude || readChannel(handle, channel, MHS5200Driver::FieldAmplitude, state) != 0 ) return -1;
+    *amplitude = state.amplitude;
+    return 0;
+}
+
+int mhs5200_set_amplitude(mhs5200_t *handle, int channel, double amplitude) {
+    return handle ? result(handle->driver.setAmplitude(channel, amplitude)) : -1;
+}
+
+int mhs5200_get_phase_offset(mhs5200_t *handle, int channel, int *phase_offset) {
+    MHS5200Driver::ChannelState state;
+    if ( !phase_offset || readChannel(handle, channel, MHS5200Driver::FieldPhaseOffset, state) != 0 ) return -1;
+    *phase_offset = state.phaseOffset;
+    return 0;
+}
+
+int mhs5200_set_phase_offset(mhs5200_t *handle, int channel, int phase_offset) {
+    return handle ? result(handle->driver.setPhaseOffset(channel, phase_offset)) : -1;
+}
+
+int mhs5200_get_inverted(mhs5200_t *handle, int channel, int *inverted) {
+    MHS5200Driver::ChannelState state;
+    if ( !inverted || readChannel(handle, channel, MHS5200Driver::FieldInverted, state) != 0 ) return -1;
+    *inverted = state.inverted;
+    return 0;
+}
+
+int mhs5200_set_inverted(mhs5200_t *handle, int channel, int inverted) {
+    return handle ? result(handle->driver.setInverted(channel, inverted != 0)) : -1;
+}
+
+int mhs5200_get_current_channel(mhs5200_t *handle, int *channel) {
+    MHS5200Driver::DeviceState state;
+    if ( !channel || readDevice(handle, MHS5200Driver::FieldCurrentChannel, state) != 0 ) return -1;
+    *channel = state.currentChannel;
+    return 0;
+}
+
+int mhs5200_set_current_channel(mhs5200_t *handle, int channel) {
+    return handle ? result(handle->driver.setCurrentChannel(channel)) : -1;
+}
+
+int mhs5200_get_output(mhs5200_t *handle, int *on) {
+    MHS5200Driver::DeviceState state;
+    if ( !on || readDevice(handle, MHS5200Driver::FieldChannelStatus, state) != 0 ) return -1;
+    *on = state.currentChannelStatus;
+    return 0;
+}
+
+int mhs5200_set_output(mhs5200_t *handle, int on) {
+    return handle ? result(handle->driver.setCurrentChannelStatus(on != 0)) : -1;
+}
+
+int mhs5200_set_arbitrary(mhs5200_t *handle, int slot, const int values[1024]) {
+    if ( !handle || !values || slot < 0 || slot > 15 ) return -1;
+    return result(handle->driver.setArbitrary(slot, values));
+}
+
+int mhs5200_save_settings(mhs5200_t *handle, int slot) {
+    return handle ? result(handle->driver.saveSettings(slot)) : -1;
+}
+
+int mhs5200_load_settings(mhs5200_t *handle, int slot) {
+    return handle ? result(handle->driver.loadSettings(slot)) : -1;
+}
+
+int mhs5200_transact(mhs5200_t *handle, const char *command, char *response, int response_size) {
+    if ( !handle || !command ) return -1;
+    const char *r = handle->driver.transact(command);
+    if ( !r ) return -1;
+    if ( response && response_size > 0 ) {
+        strncpy(response, r, response_size-1);
+        response[response_size-1] = 0;
+    }
+    return 0;
+}
+
+void mhs5200_set_debug(mhs5200_t *handle, int on) {
+    if ( handle ) handle->driver.setDebugOutput(on != 0);
+}
+
+}
@@ -0,0 +1,75 @@
+#ifndef MHS5200C_H
+#define MHS5200C_H
+
+/*
+ * C interface to MHS5200Driver for use from other languages (ctypes, cgo, ...).
+ *
+ * A handle owns one open connection. Functions returning int return 0 on success and -1 on failure,
+ * getters store the value through the pointer argument only on success. A handle must not be used
+ * from more than one thread at a time.
+ */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct mhs5200 mhs5200_t;
+
+typedef struct mhs5200_channel_state {
+    int wave;               /* See MHS5200Driver::WaveType: 0-4 basic waves, 32-47 arbitrary 0-15. */
+    double frequency;       /* Hz. */
+    double amplitude;       /* Volts peak to peak. */
+    double duty_cycle;      /* Percent. */
+    int offset;             /* -120 to 120 percent. */
+    int phase_offset;       /* 0 to 359 degrees. */
+    int inverted;
+} mhs5200_channel_state_t;
+
+/* Connect to a tty device such as /dev/ttyUSB0, returns NULL on failure. */
+mhs5200_t *mhs5200_open(const char *device);
+
+/* Disconnect and free the handle. */
+void mhs5200_close(mhs5200_t *handle);
+
+/* Version of the library as major*10000 + minor*100 + patch. */
+int mhs5200_version(void);
+
+int mhs5200_get_channel_state(mhs5200_t *handle, int channel, mhs5200_channel_state_t *state);
+
+int mhs5200_get_frequency(mhs5200_t *handle, int channel, double *hz);
+int mhs5200_set_frequency(mhs5200_t *handle, int channel, double hz);
+int mhs5200_get_duty_cycle(mhs5200_t *handle, int channel, double *duty_cycle);
+int mhs5200_set_duty_cycle(mhs5200_t *handle, int channel, double duty_cycle);
+int mhs5200_get_wave(mhs5200_t *handle, int channel, int *wave);
+int mhs5200_set_wave(mhs5200_t *handle, int channel, int wave);
+int mhs5200_get_offset(mhs5200_t *handle, int channel, int *offset);
+int mhs5200_set_offset(mhs5200_t *handle, int channel, int offset);
+int mhs5200_get_amplitude(mhs5200_t *handle, int channel, double *amplitude);
+int mhs5200_set_amplitude(mhs5200_t *handle, int channel, double amplitude);
+int mhs5200_get_phase_offset(mhs5200_t *handle, int channel, int *phase_offset);
+int mhs5200_set_phase_offset(mhs5200_t *handle, int channel, int phase_offset);
+int mhs5200_get_inverted(mhs5200_t *handle, int channel, int *inverted);
+int mhs5200_set_inverted(mhs5200_t *handle, int channel, int inverted);
+
+int mhs5200_get_current_channel(mhs5200_t *handle, int *channel);
+int mhs5200_set_current_channel(mhs5200_t *handle, int channel);
+int mhs5200_get_output(mhs5200_t *handle, int *on);
+int mhs5200_set_output(mhs5200_t *handle, int on);
+
+/* Program arbitrary wave form slot 0-15 with 1024 samples. */
+int mhs5200_set_arbitrary(mhs5200_t *handle, int slot, const int values[1024]);
+
+/* Save to or load from device memory slot 0-9. */
+int mhs5200_save_settings(mhs5200_t *handle, int slot);
+int mhs5200_load_settings(mhs5200_t *handle, int slot);
+
+/* Send a command including the trailing \n and copy its response (see MHS5200Driver::rawResponse()). */
+int mhs5200_transact(mhs5200_t *handle, const char *command, char *response, int response_size);
+
+void mhs5200_set_debug(mhs5200_t *handle, int on);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,104 @@
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <atomic>
+#include "mhs5200events.hpp"
+
+#if defined(MHS5200_TRACE_BINARY)
+
+struct MHS5200EventRing {
+    MHS5200Event events[MHS5200_EVENTS_RING_SIZE];
+    std::atomic<uint64_t> head;     // Written only by the owning thread.
+    uint64_t threadId;
+    MHS5200EventRing *next;
+};
+
+// Rings are never freed so a dump can run while other threads exit.
+static std::atomic<MHS5200EventRing *> g_rings(nullptr);
+static thread_local MHS5200EventRing *t_ring = nullptr;
+
+static MHS5200EventRing *registerRing() {
+    MHS5200EventRing *ring = new MHS5200EventRing;
+    ring->head.store(0, std::memory_order_relaxed);
+    ring->threadId = (uint64_t)pthread_self();
+    ring->next = g_rings.load(std::memory_order_relaxed);
+    while ( !g_rings.compare_exchange_weak(ring->next, ring, std::memory_order_release, std::memory_order_relaxed) );
+    t_ring = ring;
+    return ring;
+}
+
+void mhs5200EventRecord(uint16_t id, uint32_t arg, const char *payload, int length) {
+    MHS5200EventRing *ring = t_ring ? t_ring : registerRing();
+    uint64_t head = ring->head.load(std::memory_order_relaxed);
+    MHS5200Event &event = ring->events[head & (MHS5200_EVENTS_RING_SIZE-1)];
+    
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    event.nanos = (uint64_t)ts.tv_sec*1000000000ull + ts.tv_nsec;
+    event.id = id;
+    event.arg = arg;
+    if ( length > MHS5200_EVENTS_PAYLOAD ) length = MHS5200_EVENTS_PAYLOAD;
+    if ( length < 0 || !payload ) length = 0;
+    event.length = (uint16_t)length;
+    memcpy(event.payload, payload, length);
+    
+    ring->head.store(head+1, std::memory_order_release);
+}
+
+bool mhs5200EventsDump(const char *fileName) {
+    FILE *f = fopen(fileName, "wb");
+    if ( !f ) {
+        fprintf(stderr, "Error creating %s: %s\n", fileName, strerror(errno));
+        return false;
+    }
+    
+    MHS5200EventsHeader header;
+    memset(&header, 0, sizeof(header));
+    header.magic = MHS5200_EVENTS_MAGIC;
+    header.version = MHS5200_EVENTS_VERSION;
+    header.eventSize = sizeof(MHS5200Event);
+    for ( MHS5200EventRing *ring = g_rings.load(std::memory_order_acquire); ring; ring = ring->next )
+        header.threads++;
+    fwrite(&header, sizeof(header), 1, f);
+    
+    // Events of threads still running may be overwritten while copying, the dump is a best effort snapshot.
+    uint32_t written = 0;
+    for ( MHS5200EventRing *ring = g_rings.load(std::memory_order_acquire); ring && written < header.threads; ring = ring->next, written++ ) {
+        MHS5200EventsThread thread;
+        memset(&thread, 0, sizeof(thread));
+        uint64_t head = ring->head.load(std::memory_order_acquire);
+        uint64_t first = head > MHS5200_EVENTS_RING_SIZE ? head - MHS5200_EVENTS_RING_SIZE : 0;
+        thread.threadId = ring->threadId;
+        thread.total = head;
+        thread.count = (uint32_t)(head - first);
+        fwrite(&thread, sizeof(thread), 1, f);
+        for ( uint64_t i = first; i < head; i++ )
+            fwrite(&ring->events[i & (MHS5200_EVENTS_RING_SIZE-1)], sizeof(MHS5200Event), 1, f);
+    }
+    
+    bool ok = !ferror(f);
+    if ( fclose(f) != 0 ) ok = false;
+    return ok;
+}
+
+bool mhs5200EventsEnabled() {
+    return true;
+}
+
+#else
+
+void mhs5200EventRecord(uint16_t, uint32_t, const char *, int) {
+}
+
+bool mhs5200EventsDump(const char *) {
+    fprintf(stderr, "Error: binary events are not compiled in, configure with -DMHS5200_TRACE=BINARY.\n");
+    return false;
+}
+
+bool mhs5200EventsEnabled() {
+    return false;
+}
+
+#endif
@@ -0,0 +1,99 @@
+#pragma once
+#include <stdint.h>
+
+/**
+ * Hot path event tracing, selected at compile time with the MHS5200_TRACE CMake option:
+ * 
+ *  TEXT    (default) MHS5200_TRACE_* print through MHS5200Driver::debugInfo() when debug output is turned on.
+ *  BINARY  MHS5200_TRACE_* append a fixed size MHS5200Event to a lock free ring buffer owned by the calling
+ *          thread. mhs5200EventsDump() writes all rings to a file for the mhs5200-events decoder.
+ *  OFF     MHS5200_TRACE_* compile to nothing.
+ */
+
+#define MHS5200_EVENTS_MAGIC 0x5645484d  /* "MHEV" */
+#define MHS5200_EVENTS_VERSION 1
+#define MHS5200_EVENTS_RING_SIZE 4096    /* Events kept per thread, power of two. */
+#define MHS5200_EVENTS_PAYLOAD 8
+
+/* Driver methods reported by MHS5200_TRACE_CALL, the decoder prints them by name. */
+#define MHS5200_TRACE_CALLS(X) \
+    X(readState) X(commit) X(getFrequency) X(setFrequency) X(getDutyCycle) X(setDutyCycle) \
+    X(getWaveType) X(setWaveType) X(getOffset) X(setOffset) X(getPhaseOffset) X(setPhaseOffset) \
+    X(getAmplitude) X(setAmplitude) X(getInverted) X(setInverted) X(getCurrentChannel) X(setCurrentChannel) \
+    X(getCurrentChannelStatus) X(setCurrentChannelStatus) X(setArbitrary) X(saveSettings) X(loadSettings) \
+    X(reconnect)
+
+enum MHS5200TraceCall {
+#define MHS5200_TRACE_CALL_ENUM(name) TraceCall_##name,
+    MHS5200_TRACE_CALLS(MHS5200_TRACE_CALL_ENUM)
+#undef MHS5200_TRACE_CALL_ENUM
+    TraceCallCount
+};
+
+enum MHS5200EventId {
+    EventCall = 1,      // arg = MHS5200TraceCall
+    EventWrite,         // arg = bytes written, payload = first bytes
+    EventRead,          // arg = bytes read, payload = first bytes
+    EventTimeout,       // arg = timeout in ms
+    EventRetry,         // arg = attempt
+    EventFlush,
+    EventFailure
+};
+
+struct MHS5200Event {
+    uint64_t nanos;     // CLOCK_MONOTONIC.
+    uint16_t id;        // MHS5200EventId.
+    uint16_t length;    // Valid payload bytes.
+    uint32_t arg;
+    char payload[MHS5200_EVENTS_PAYLOAD];
+};
+
+/* Layout of a dump: MHS5200EventsHeader, then for each thread a MHS5200EventsThread followed by its events oldest first. */
+struct MHS5200EventsHeader {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t eventSize;
+    uint32_t threads;
+    uint32_t reserved;
+};
+
+struct MHS5200EventsThread {
+    uint64_t threadId;
+    uint64_t total;     // Events recorded, older ones than the ring size are lost.
+    uint32_t count;     // Events following.
+    uint32_t reserved;
+};
+
+/**
+ * Append an event to the ring of the calling thread. Use the MHS5200_TRACE_* macros instead of calling this.
+ */
+void mhs5200EventRecord(uint16_t id, uint32_t arg, const char *payload, int length);
+
+/**
+ * Write the rings of all threads to a file.
+ * 
+ * @param fileName File to create.
+ * @return True on success, false on error or when not built with MHS5200_TRACE=BINARY.
+ */
+bool mhs5200EventsDump(const char *fileName);
+
+/**
+ * Determine if binary events are compiled in.
+ * 
+ * @return True when built with MHS5200_TRACE=BINARY.
+ */
+bool mhs5200EventsEnabled();
+
+#if defined(MHS5200_TRACE_BINARY)
+#define MHS5200_TRACE_CALL(name) mhs5200EventRecord(EventCall, TraceCall_##name, nullptr, 0)
+#define MHS5200_TRACE_IO(id, len, buffer) mhs5200EventRecord((id), (uint32_t)(len), (buffer), (len))
+#define MHS5200_TRACE_EVENT(id, arg) mhs5200EventRecord((id), (uint32_t)(arg), nullptr, 0)
+#elif defined(MHS5200_TRACE_OFF)
+#define MHS5200_TRACE_CALL(name) ((void)0)
+#define MHS5200_TRACE_IO(id, len, buffer) ((void)0)
+#define MHS5200_TRACE_EVENT(id, arg) ((void)0)
+#else
+#define MHS5200_TRACE_CALL(name) debugInfo("function", -1, #name)
+#define MHS5200_TRACE_IO(id, len, buffer) debugInfo((id) == EventWrite ? "write" : "read", (len), (buffer))
+#define MHS5200_TRACE_EVENT(id, arg) ((void)0)
+#endif
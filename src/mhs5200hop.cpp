@@ -0,0 +1,212 @@
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/timerfd.h>
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include "mhs5200hop.hpp"
+#include "mhs5200traits.hpp"
+
+MHS5200HopEngine::MHS5200HopEngine(MHS5200Driver &driver) : m_driver(driver), m_alphabetSize(0)
+{
+}
+
+bool MHS5200HopEngine::setAlphabet(int channel, const double *frequencies, int count) {
+    if ( count < 1 || count > MHS5200_HOP_MAX_SYMBOLS || channel < 1 || channel > 2 ) return false;
+    const MHS5200ModelLimits &limits = m_driver.getLimits();
+    for ( int i = 0; i < count; i++ ) {
+        double hz = frequencies[i];
+        bool valid = mhs5200WithTraits(limits.model, [hz](auto traits) {
+            return decltype(traits)::validFrequency(hz);
+        });
+        if ( !valid ) {
+            fprintf(stderr, "Error: symbol %d, %.2fHz is out of range for the %s (%.2fHz to %.0fHz).\n", i, hz, limits.name,
+                    limits.minFrequency, limits.maxFrequency);
+            m_alphabetSize = 0;
+            return false;
+        }
+        m_frameLength[i] = MHS5200Driver::formatFrequency(m_frames[i], channel, hz);
+    }
+    m_alphabetSize = count;
+    return true;
+}
+
+double MHS5200HopEngine::maxSymbolRate() {
+    int longest = 0;
+    for ( int i = 0; i < m_alphabetSize; i++ )
+        longest = std::max(longest, m_frameLength[i]);
+    // The command plus its ok\r\n share the link in opposite directions, the command is the bottleneck.
+    double micros = longest * m_driver.wireMicrosPerByte();
+    return micros > 0 ? 1000000.0 / micros : 0;
+}
+
+double MHS5200HopEngine::percentile(std::vector<double> &values, double p) {
+    if ( values.empty() ) return 0;
+    size_t index = (size_t)(p * (values.size()-1) + 0.5);
+    std::nth_element(values.begin(), values.begin()+index, values.end());
+    return values[index];
+}
+
+bool MHS5200HopEngine::run(const int *symbols, int count, double symbolRate, bool realtime, MHS5200HopEngine::Report &report) {
+    memset(&report, 0, sizeof(report));
+    report.targetRate = symbolRate;
+    
+    int fd = m_driver.getFileDescriptor();
+    if ( fd == 0 || m_alphabetSize == 0 || count <= 0 || symbolRate <= 0 ) return false;
+    for ( int i = 0; i < count; i++ ) {
+        if ( symbols[i] < 0 || symbols[i] >= m_alphabetSize ) {
+            fprintf(stderr, "Error: symbol %d at position %d is not in the alphabet.\n", symbols[i], i);
+            return false;
+        }
+    }
+    
+    int timer = timerfd_create(CLOCK_MONOTONIC, 0);
+    if ( timer < 0 ) {
+        fprintf(stderr, "Error from timerfd_create: %s\n", strerror(errno));
+        return false;
+    }
+    // Symbols are timed from their write, nothing written earlier may still be waiting in the tty. The
+    // acknowledgements are counted here, nothing the driver already read may be among them.
+    if ( !m_driver.beginDirectAccess() ) {
+        close(timer);
+        return false;
+    }
+    
+    std::vector<int64_t> scheduled(count), written(count), acked(count, 0);
+    int64_t periodNanos = (int64_t)(1000000000.0 / symbolRate);
+    int64_t startMicros = MHS5200Driver::monotonicMicros() + 10000;
+    for ( int i = 0; i < count; i++ )
+        scheduled[i] = startMicros + (int64_t)i*periodNanos/1000;
+    
+    struct itimerspec its;
+    its.it_value.tv_sec = startMicros / 1000000;
+    its.it_value.tv_nsec = (startMicros % 1000000) * 1000;
+    its.it_interval.tv_sec = periodNanos / 1000000000;
+    its.it_interval.tv_nsec = periodNanos % 1000000000;
+    if ( timerfd_settime(timer, TFD_TIMER_ABSTIME, &its, nullptr) != 0 ) {
+        fprintf(stderr, "Error from timerfd_settime: %s\n", strerror(errno));
+        close(timer);
+        return false;
+    }
+    
+    std::atomic<int> sent(0);
+    std::atomic<bool> sendFailed(false);
+    int overruns = 0;
+    
+    std::thread sender([&]() {
+        if ( realtime ) {
+            struct sched_param param;
+            param.sched_priority = sched_get_priority_max(SCHED_FIFO);
+            if ( pthread_setschedparam(pthread_self(), SCHED_FIFO, &param) == 0 ) {
+                report.realtime = true;
+            } else {
+                fprintf(stderr, "Warning: SCHED_FIFO not available, running with normal priority.\n");
+            }
+        }
+        
+        int i = 0;
+        while ( i < count ) {
+            uint64_t expirations;
+            if ( read(timer, &expirations, sizeof(expirations)) != sizeof(expirations) ) {
+                if ( errno == EINTR ) continue;
+                sendFailed = true;
+                break;
+            }
+            // Late ticks are not made up by bursting, the symbols keep their place on the schedule.
+            if ( expirations > 1 ) overruns += (int)(expirations-1);
+            
+            const char *frame = m_frames[symbols[i]];
+            int len = m_frameLength[symbols[i]];
+            int done = 0;
+            while ( done < len ) {
+                ssize_t n = write(fd, frame+done, len-done);
+                if ( n < 0 ) {
+                    if ( errno == EINTR ) continue;
+                    if ( errno == EAGAIN ) {
+                        struct pollfd out;
+                        out.fd = fd;
+                        out.events = POLLOUT;
+                        out.revents = 0;
+                        poll(&out, 1, 100);
+                        continue;
+                    }
+                    sendFailed = true;
+                    break;
+                }
+                done += n;
+            }
+            if ( sendFailed ) break;
+            written[i] = MHS5200Driver::monotonicMicros();
+            i++;
+            sent = i;
+        }
+    });
+    
+    // Acknowledgements arrive in order, collect them here while the sender keeps its schedule.
+    int acknowledged = 0;
+    char line[MHS5200_BUFFER_SIZE];
+    int lineLen = 0;
+    int64_t lastActivity = MHS5200Driver::monotonicMicros();
+    while ( acknowledged < count ) {
+        int alreadySent = sent;
+        if ( sendFailed && acknowledged >= alreadySent ) break;
+        if ( alreadySent == count && MHS5200Driver::monotonicMicros() - lastActivity > 1000000 ) break;
+        
+        struct pollfd pfd;
+        pfd.fd = fd;
+        pfd.events = POLLIN;
+        pfd.revents = 0;
+        int ready = poll(&pfd, 1, 50);
+        if ( ready <= 0 ) continue;
+        
+        char buf[256];
+        ssize_t n = read(fd, buf, sizeof(buf));
+        if ( n <= 0 ) continue;
+        int64_t now = MHS5200Driver::monotonicMicros();
+        lastActivity = now;
+        for ( ssize_t k = 0; k < n; k++ ) {
+            if ( buf[k] != '\n' ) {
+                if ( lineLen < (int)sizeof(line)-1 ) line[lineLen++] = buf[k];
+                continue;
+            }
+            while ( lineLen > 0 && line[lineLen-1] == '\r' ) lineLen--;
+            if ( lineLen == 2 && strncmp(line, "ok", 2) == 0 && acknowledged < count )
+                acked[acknowledged++] = now;
+            lineLen = 0;
+        }
+    }
+    
+    sender.join();
+    close(timer);
+    m_driver.endDirectAccess(acknowledged == sent);
+    // The channel is left on the last symbol written, the driver neither knows its frequency nor could replay it.
+    if ( sent > 0 ) m_driver.noteDirectWrite(m_frames[symbols[sent-1]], m_frameLength[symbols[sent-1]]);
+    
+    report.symbolsSent = sent;
+    report.acknowledged = acknowledged;
+    report.overruns = overruns;
+    
+    std::vector<double> errors, latencies;
+    double errorSum = 0;
+    for ( int i = 0; i < report.symbolsSent; i++ ) {
+        double error = (double)(written[i] - scheduled[i]);
+        errors.push_back(error);
+        errorSum += error;
+        report.errorMaxMicros = std::max(report.errorMaxMicros, error);
+        if ( i < acknowledged ) latencies.push_back((double)(acked[i] - written[i]));
+    }
+    if ( report.symbolsSent > 1 )
+        report.achievedRate = (report.symbolsSent-1) * 1000000.0 / (written[report.symbolsSent-1] - written[0]);
+    if ( !errors.empty() ) report.errorMeanMicros = errorSum / errors.size();
+    report.errorP50Micros = percentile(errors, 0.5);
+    report.errorP99Micros = percentile(errors, 0.99);
+    report.ackLatencyP50Micros = percentile(latencies, 0.5);
+    report.ackLatencyP99Micros = percentile(latencies, 0.99);
+    
+    return !sendFailed && report.symbolsSent == count && acknowledged == count;
+}
@@ -0,0 +1,75 @@
+#pragma once
+#include <stdint.h>
+#include <vector>
+#include "mhs5200.hpp"
+
+#define MHS5200_HOP_MAX_SYMBOLS 36
+
+/**
+ * Steps a channel through a table of frequencies on a fixed symbol clock (FSK / frequency hopping).
+ * 
+ * The set frequency command of every symbol is encoded up front, symbols are written without waiting
+ * for the device from a thread paced by a timerfd, and acknowledgements are collected by a second thread.
+ * While running the engine owns the TTY, the driver must not be used until run() returns.
+ */
+class MHS5200HopEngine
+{
+public:
+    /**
+     * Outcome of a run. Timing errors are the difference between the scheduled and the actual write of each symbol.
+     */
+    struct Report {
+        int symbolsSent;
+        int acknowledged;
+        int overruns;               // Timer ticks missed because a write took longer than a symbol.
+        double targetRate;          // Symbols per second requested.
+        double achievedRate;        // Symbols per second from the first to the last write.
+        double errorMeanMicros;
+        double errorP50Micros;
+        double errorP99Micros;
+        double errorMaxMicros;
+        double ackLatencyP50Micros; // Time from write to acknowledgement.
+        double ackLatencyP99Micros;
+        bool realtime;              // SCHED_FIFO was granted.
+    };
+    
+protected:
+    MHS5200Driver &m_driver;
+    char m_frames[MHS5200_HOP_MAX_SYMBOLS][MHS5200_BUFFER_SIZE];
+    int m_frameLength[MHS5200_HOP_MAX_SYMBOLS];
+    int m_alphabetSize;
+    
+    static double percentile(std::vector<double> &values, double p);
+    
+public:
+    MHS5200HopEngine(MHS5200Driver &driver);
+    
+    /**
+     * Define the symbol alphabet and pre-encode its frames.
+     * 
+     * @param channel Channel to hop (1 or 2).
+     * @param frequencies Frequency in Hz of each symbol.
+     * @param count Number of symbols, up to MHS5200_HOP_MAX_SYMBOLS.
+     * @return True on success, false when a frequency is outside the range of the driver's model.
+     */
+    bool setAlphabet(int channel, const double *frequencies, int count);
+    
+    /**
+     * Estimate the highest symbol rate the serial link can carry for the current alphabet.
+     * 
+     * @return Symbols per second.
+     */
+    double maxSymbolRate();
+    
+    /**
+     * Send a symbol sequence.
+     * 
+     * @param symbols Indexes into the alphabet.
+     * @param count Number of symbols.
+     * @param symbolRate Symbols per second.
+     * @param realtime Try to run the sending thread with SCHED_FIFO priority.
+     * @param report Receives the timing statistics.
+     * @return True when every symbol was sent and acknowledged.
+     */
+    bool run(const int *symbols, int count, double symbolRate, bool realtime, Report &report);
+};
@@ -0,0 +1,206 @@
+// Device discovery, hot-plug detection and reconnecting of MHS5200Driver.
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <poll.h>
+#include <glob.h>
+#include <sys/inotify.h>
+#include <memory>
+#include "mhs5200.hpp"
+#include "mhs5200events.hpp"
+
+std::vector<MHS5200Driver::DiscoveredDevice> MHS5200Driver::discover(const std::vector<std::string> &candidates, int timeoutMs) {
+    std::vector<std::string> names = candidates;
+    if ( names.empty() ) {
+        const char *patterns[] = { "/dev/ttyUSB*", "/dev/ttyACM*" };
+        for ( auto pattern : patterns ) {
+            glob_t found;
+            if ( glob(pattern, 0, nullptr, &found) == 0 ) {
+                for ( size_t i = 0; i < found.gl_pathc; i++ )
+                    names.push_back(found.gl_pathv[i]);
+            }
+            globfree(&found);
+        }
+    }
+    
+    // Each candidate gets its own driver on the non-blocking core, so all of them are probed at the same time
+    // and a silent port costs timeoutMs once instead of once per port.
+    std::vector<std::unique_ptr<MHS5200Driver>> drivers;
+    std::vector<DiscoveredDevice> results(names.size());
+    std::vector<bool> answered(names.size(), false);
+    for ( size_t i = 0; i < names.size(); i++ ) {
+        std::unique_ptr<MHS5200Driver> driver(new MHS5200Driver());
+        results[i].deviceName = names[i];
+        results[i].latencyMicros = 0;
+        if ( !driver->connect(names[i].c_str()) ) {
+            drivers.push_back(nullptr);
+            continue;
+        }
+        driver->setRetryPolicy(0, timeoutMs);
+        driver->setAdaptiveTimeouts(0, timeoutMs, 0);
+        int64_t start = monotonicMicros();
+        // Every MHS-5200 answers the wave type query, other devices rarely answer with :r1w.
+        driver->submit(":r1w\n", [&results, &answered, i, start](const char *response) {
+            if ( !response ) return;
+            results[i].identity = response;
+            results[i].latencyMicros = monotonicMicros() - start;
+            answered[i] = true;
+        });
+        drivers.push_back(std::move(driver));
+    }
+    
+    for (;;) {
+        std::vector<struct pollfd> pfds;
+        std::vector<MHS5200Driver*> polled;
+        int timeout = -1;
+        for ( auto &driver : drivers ) {
+            if ( !driver || driver->pendingRequests() == 0 ) continue;
+            struct pollfd pfd;
+            pfd.fd = driver->getFileDescriptor();
+            pfd.events = driver->pollEvents();
+            pfd.revents = 0;
+            pfds.push_back(pfd);
+            polled.push_back(driver.get());
+            int t = driver->timeoutMillis();
+            if ( t >= 0 && (timeout < 0 || t < timeout) ) timeout = t;
+        }
+        if ( polled.empty() ) break;
+        
+        int ready = poll(pfds.data(), pfds.size(), timeout);
+        if ( ready < 0 && errno != EINTR ) break;
+        for ( size_t i = 0; i < polled.size(); i++ ) {
+            if ( ready > 0 && (pfds[i].revents & (POLLIN | POLLERR | POLLHUP)) ) polled[i]->onReadable();
+            if ( ready > 0 && (pfds[i].revents & POLLOUT) ) polled[i]->onWritable();
+            polled[i]->onTimeout();
+        }
+    }
+    
+    std::vector<DiscoveredDevice> found;
+    for ( size_t i = 0; i < names.size(); i++ ) {
+        if ( answered[i] ) found.push_back(results[i]);
+    }
+    return found;
+}
+
+void MHS5200Driver::setAutoReconnect(int timeoutMs) {
+    m_reconnectTimeoutMs = timeoutMs;
+}
+
+void MHS5200Driver::cacheSetting(const char *command, int len) {
+    // Remember the last value sent for each setting so that a reconnect can restore it. Sets are absolute,
+    // only the latest of each matters. The command may be several frames written at once.
+    int start = 0;
+    for ( int i = 0; i < len; i++ ) {
+        if ( command[i] != '\n' ) continue;
+        const char *frame = command + start;
+        int flen = i + 1 - start;
+        start = i + 1;
+        if ( flen < 5 || frame[0] != ':' || frame[1] != 's' ) continue;
+        // The value is known again once the set is acknowledged, see noteKnownState().
+        m_knownFields &= ~frameFields(frame);
+        if ( frame[3] == 'u' ) continue;
+        std::string setting(frame, flen);
+        if ( frame[3] == 'v' ) {
+            // Loading a memory slot replaces every setting sent before it.
+            m_settingsCache.clear();
+            m_settingsCache.push_back(setting);
+            continue;
+        }
+        bool replaced = false;
+        for ( auto &cached : m_settingsCache ) {
+            if ( cached.compare(0, 4, setting, 0, 4) == 0 ) {
+                cached = setting;
+                replaced = true;
+                break;
+            }
+        }
+        if ( !replaced ) m_settingsCache.push_back(setting);
+    }
+}
+
+void MHS5200Driver::linkLost() {
+    MHS5200_TRACE_EVENT(EventFailure, 0);
+    if ( m_fileDescriptor && close(m_fileDescriptor) != 0 ) {
+        systemError("close", "Error from close: %s\n", strerror(errno));
+    }
+    m_fileDescriptor = 0;
+    m_readLength = 0;
+    m_resumeMicros = 0;
+    m_needResync = false;
+    requeueInFlight();
+    if ( m_reconnectTimeoutMs <= 0 || m_deviceName.empty() ) failAll();
+}
+
+bool MHS5200Driver::waitForDevice(const char *deviceName, int timeoutMs) {
+    int64_t deadline = monotonicMicros() + (int64_t)timeoutMs*1000;
+    std::string directory = deviceName;
+    size_t slash = directory.rfind('/');
+    if ( slash == std::string::npos ) directory = ".";
+    else directory.resize(slash ? slash : 1);
+    
+    // The node (or a /dev/serial/by-id link to it) shows up again in the same directory.
+    int notify = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if ( notify >= 0 && inotify_add_watch(notify, directory.c_str(), IN_CREATE | IN_MOVED_TO | IN_ATTRIB) < 0 ) {
+        systemError("inotify_add_watch", "Error watching %s: %s\n", directory.c_str(), strerror(errno));
+        close(notify);
+        notify = -1;
+    }
+    
+    bool connected = false;
+    for (;;) {
+        if ( access(deviceName, F_OK) == 0 && openDevice(deviceName) ) {
+            connected = true;
+            break;
+        }
+        int64_t remaining = deadline - monotonicMicros();
+        if ( remaining <= 0 ) break;
+        // Look again now and then even without events, udev may still be setting up the permissions.
+        int waitMs = remaining > 250000 ? 250 : (int)(remaining/1000) + 1;
+        if ( notify >= 0 ) {
+            struct pollfd pfd;
+            pfd.fd = notify;
+            pfd.events = POLLIN;
+            pfd.revents = 0;
+            if ( poll(&pfd, 1, waitMs) > 0 ) {
+                char events[4096];
+                while ( read(notify, events, sizeof(events)) > 0 ) {}
+            }
+        } else {
+            usleep(waitMs*1000);
+        }
+    }
+    if ( notify >= 0 ) close(notify);
+    return connected;
+}
+
+bool MHS5200Driver::reconnect(int timeoutMs) {
+    MHS5200_TRACE_CALL(reconnect);
+    if ( m_deviceName.empty() ) return false;
+    if ( m_fileDescriptor ) {
+        if ( close(m_fileDescriptor) != 0 ) {
+            systemError("close", "Error from close: %s\n", strerror(errno));
+        }
+        m_fileDescriptor = 0;
+        requeueInFlight();
+    }
+    
+    debugInfo("Waiting for", -1, m_deviceName.c_str());
+    if ( !waitForDevice(m_deviceName.c_str(), timeoutMs) ) {
+        systemError("reconnect", "%s did not come back within %d ms\n", m_deviceName.c_str(), timeoutMs);
+        return false;
+    }
+    m_statistics.reconnects++;
+    m_readLength = 0;
+    m_needResync = false;
+    m_consecutiveMisses = 0;
+    m_lastResponseMicros = 0;
+    
+    // The generator may have been power cycled with the adapter, restore the settings ahead of anything pending.
+    for ( auto i = m_settingsCache.rbegin(); i != m_settingsCache.rend(); ++i ) {
+        m_queued[PriorityUrgent].push_front(makeRequest(i->c_str(), Completion(), PriorityUrgent));
+    }
+    onWritable();
+    return true;
+}
@@ -0,0 +1,377 @@
+// Fake generator on a pseudo terminal and the load test driving a mix of commands over one connection.
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+#include <algorithm>
+#include <deque>
+#include <string>
+#include "mhs5200loadtest.hpp"
+
+MHS5200FakeDevice::MHS5200FakeDevice() : m_master(-1), m_microsPerByte(0), m_readMicros(0), m_setMicros(0),
+    m_lossRate(0), m_seed(1), m_instant(false), m_log(nullptr), m_stop(false)
+{
+    m_slaveName[0] = 0;
+    memset(&m_statistics, 0, sizeof(m_statistics));
+    setTiming(MHS5200_FAKE_BAUD, 1000, 2000);
+    reset();
+}
+
+MHS5200FakeDevice::~MHS5200FakeDevice() {
+    stop();
+    close();
+}
+
+int MHS5200FakeDevice::settingsIndex(char channel) {
+    const char *p = strchr("012ab", channel);
+    return p && channel ? (int)(p - "012ab") : -1;
+}
+
+void MHS5200FakeDevice::reset() {
+    memset(m_settings, 0, sizeof(m_settings));
+    for ( int channel = 1; channel <= 2; channel++ ) {
+        char (*s)[16] = m_settings[channel];
+        strcpy(s['f'-'a'], "0000100000");
+        strcpy(s['w'-'a'], "0");
+        strcpy(s['y'-'a'], "1");
+        strcpy(s['a'-'a'], "0500");
+        strcpy(s['d'-'a'], "500");
+        strcpy(s['o'-'a'], "120");
+        strcpy(s['p'-'a'], "000");
+    }
+    // b is overloaded: 1b the output, 2b the displayed channel, ab and bb inverting channel 1 and 2.
+    strcpy(m_settings[1]['b'-'a'], "1");
+    strcpy(m_settings[2]['b'-'a'], "1");
+    strcpy(m_settings[3]['b'-'a'], "0");
+    strcpy(m_settings[4]['b'-'a'], "0");
+    strcpy(m_settings[0]['c'-'a'], "5225A");
+    for ( int slot = 0; slot < MHS5200_MEMORY_SLOTS; slot++ )
+        memcpy(m_memory[slot], m_settings, sizeof(m_settings));
+}
+
+bool MHS5200FakeDevice::open() {
+    close();
+    m_master = posix_openpt(O_RDWR | O_NOCTTY);
+    if ( m_master < 0 || grantpt(m_master) != 0 || unlockpt(m_master) != 0 || ptsname_r(m_master, m_slaveName, sizeof(m_slaveName)) != 0 ) {
+        fprintf(stderr, "Error creating pseudo terminal: %s\n", strerror(errno));
+        close();
+        return false;
+    }
+    // The driver sets up the slave, keep the master side from translating line endings.
+    struct termios tty;
+    if ( tcgetattr(m_master, &tty) == 0 ) {
+        cfmakeraw(&tty);
+        tcsetattr(m_master, TCSANOW, &tty);
+    }
+    return true;
+}
+
+void MHS5200FakeDevice::close() {
+    if ( m_master >= 0 ) {
+        ::close(m_master);
+        m_master = -1;
+    }
+    m_slaveName[0] = 0;
+}
+
+void MHS5200FakeDevice::setTiming(int baudRate, int readMicros, int setMicros) {
+    // 8N1, ten bits on the wire per byte.
+    m_microsPerByte = baudRate > 0 ? 10000000.0 / baudRate : 0;
+    m_readMicros = readMicros < 0 ? 0 : readMicros;
+    m_setMicros = setMicros < 0 ? 0 : setMicros;
+}
+
+void MHS5200FakeDevice::setLossRate(double lossRate, unsigned seed) {
+    m_lossRate = lossRate;
+    m_seed = seed ? seed : 1;
+}
+
+void MHS5200FakeDevice::setInstant(bool instant) {
+    m_instant = instant;
+}
+
+void MHS5200FakeDevice::setLog(FILE *log) {
+    m_log = log;
+}
+
+int MHS5200FakeDevice::respond(const char *frame, int len, char *response) {
+    while ( len > 0 && (frame[len-1] == '\r' || frame[len-1] == '\n') ) len--;
+    if ( len < 4 || frame[0] != ':' ) return 0;
+    
+    if ( frame[1] == 'a' ) return sprintf(response, "ok\r\n");
+    int channel = settingsIndex(frame[2]);
+    int setting = frame[3] - 'a';
+    if ( setting < 0 || setting >= 26 ) return 0;
+    if ( frame[1] == 'r' ) {
+        if ( channel < 0 || !m_settings[channel][setting][0] ) return 0;
+        return sprintf(response, ":r%c%c%s\r\n", frame[2], frame[3], m_settings[channel][setting]);
+    }
+    if ( frame[1] != 's' ) return 0;
+    if ( frame[3] == 'u' || frame[3] == 'v' ) {
+        // Slots hold the channel settings, not the output switch (1b) and the displayed channel (2b).
+        int slot = frame[2] - '0';
+        if ( slot < 0 || slot >= MHS5200_MEMORY_SLOTS ) return 0;
+        char output[16], displayed[16];
+        strcpy(output, m_settings[1]['b'-'a']);
+        strcpy(displayed, m_settings[2]['b'-'a']);
+        if ( frame[3] == 'u' ) memcpy(m_memory[slot], m_settings, sizeof(m_settings));
+        else memcpy(m_settings, m_memory[slot], sizeof(m_settings));
+        strcpy(m_settings[1]['b'-'a'], output);
+        strcpy(m_settings[2]['b'-'a'], displayed);
+    } else {
+        if ( channel < 0 || len - 4 >= (int)sizeof(m_settings[0][0]) ) return 0;
+        memcpy(m_settings[channel][setting], frame + 4, len - 4);
+        m_settings[channel][setting][len-4] = 0;
+    }
+    return sprintf(response, "ok\r\n");
+}
+
+long MHS5200FakeDevice::run(int idleTimeout) {
+    struct Pending {
+        int64_t dueMicros;
+        std::string data;
+    };
+    if ( m_master < 0 ) return -1;
+    
+    // Hold the slave open so the master does not see a hangup before and between host connections.
+    int slave = ::open(m_slaveName, O_RDWR | O_NOCTTY);
+    if ( slave < 0 ) {
+        fprintf(stderr, "Error opening %s: %s\n", m_slaveName, strerror(errno));
+        return -1;
+    }
+    
+    std::deque<Pending> pending;
+    std::string frame;
+    char input[4096];
+    char response[MHS5200_BUFFER_SIZE];
+    unsigned state = m_seed;
+    long answered = 0;
+    int64_t rxFree = 0, deviceFree = 0, txFree = 0, firstFrame = -1;
+    int64_t lastInput = MHS5200Driver::monotonicMicros();
+    memset(&m_statistics, 0, sizeof(m_statistics));
+    
+    while ( !m_stop.load() ) {
+        int64_t now = MHS5200Driver::monotonicMicros();
+        while ( !pending.empty() && pending.front().dueMicros <= now ) {
+            const std::string &data = pending.front().data;
+            size_t written = 0;
+            while ( written < data.size() ) {
+                ssize_t n = write(m_master, data.data() + written, data.size() - written);
+                if ( n < 0 ) {
+                    if ( errno == EINTR || errno == EAGAIN ) continue;
+                    fprintf(stderr, "Fake device: error writing: %s\n", strerror(errno));
+                    ::close(slave);
+                    return -1;
+                }
+                written += n;
+            }
+            pending.pop_front();
+        }
+        if ( idleTimeout > 0 && pending.empty() && now - lastInput > idleTimeout * 1000000LL ) break;
+        
+        // Wake for the next response or after a while to look at m_stop.
+        int64_t wait = pending.empty() ? 100000 : pending.front().dueMicros - now;
+        if ( wait > 100000 ) wait = 100000;
+        struct pollfd pfd;
+        pfd.fd = m_master;
+        pfd.events = POLLIN;
+        pfd.revents = 0;
+        struct timespec timeout;
+        timeout.tv_sec = wait / 1000000;
+        timeout.tv_nsec = (long)(wait % 1000000) * 1000;
+        int ready = ppoll(&pfd, 1, &timeout, nullptr);
+        if ( ready < 0 && errno != EINTR ) {
+            fprintf(stderr, "Fake device: error from poll: %s\n", strerror(errno));
+            break;
+        }
+        if ( ready <= 0 || !(pfd.revents & POLLIN) ) continue;
+        ssize_t n = read(m_master, input, sizeof(input));
+        if ( n <= 0 ) continue;
+        now = MHS5200Driver::monotonicMicros();
+        lastInput = now;
+        m_statistics.bytesReceived += n;
+        m_statistics.roundTrips++;
+        // Answering at once, the host writes again right after the last response went over the emulated link.
+        int64_t written = m_instant ? txFree : now;
+        if ( firstFrame < 0 ) firstFrame = written;
+        
+        for ( ssize_t i = 0; i < n; i++ ) {
+            frame += input[i];
+            if ( input[i] != '\n' ) continue;
+            // The frame arrives one wire time after the previous one at the earliest, the device works through
+            // the frames in order and its answers queue up for the wire back.
+            int64_t arrived = std::max(written, rxFree) + (int64_t)(frame.size() * m_microsPerByte);
+            rxFree = arrived;
+            int len = respond(frame.data(), (int)frame.size(), response);
+            bool query = frame[1] == 'r';
+            int64_t processed = std::max(arrived, deviceFree) + (query ? m_readMicros : m_setMicros);
+            deviceFree = processed;
+            m_statistics.frames++;
+            if ( query ) m_statistics.queries++;
+            else if ( frame[1] == 'a' ) m_statistics.chunks++;
+            if ( m_log ) {
+                frame.resize(frame.size() - 1);
+                fprintf(m_log, "  %-20s %.*s\n", frame.c_str(), len > 2 ? len - 2 : 0, response);
+            }
+            frame.clear();
+            if ( len == 0 ) continue;
+            if ( m_lossRate > 0 ) {
+                state ^= state << 13;
+                state ^= state >> 17;
+                state ^= state << 5;
+                if ( (state >> 8) * (1.0 / 16777216.0) < m_lossRate ) continue;
+            }
+            int64_t sent = std::max(processed, txFree) + (int64_t)(len * m_microsPerByte);
+            txFree = sent;
+            m_statistics.bytesSent += len;
+            m_statistics.linkMicros = sent - firstFrame;
+            Pending p;
+            p.dueMicros = m_instant ? now : sent;
+            p.data.assign(response, len);
+            pending.push_back(p);
+            answered++;
+        }
+    }
+    
+    ::close(slave);
+    return answered;
+}
+
+bool MHS5200FakeDevice::start() {
+    if ( m_master < 0 || m_thread.joinable() ) return false;
+    m_stop = false;
+    m_thread = std::thread([this]() { run(0); });
+    return true;
+}
+
+void MHS5200FakeDevice::stop() {
+    m_stop = true;
+    if ( m_thread.joinable() ) m_thread.join();
+}
+
+MHS5200LoadTest::MHS5200LoadTest(MHS5200Driver &driver) : m_driver(driver), m_arbitrarySlot(15), m_seed(1)
+{
+    setMix(80, 18, 2);
+}
+
+bool MHS5200LoadTest::setMix(int reads, int sets, int uploads) {
+    if ( reads < 0 || sets < 0 || uploads < 0 || reads + sets + uploads <= 0 ) return false;
+    m_weights[OpRead] = reads;
+    m_weights[OpSet] = sets;
+    m_weights[OpArbitrary] = uploads;
+    return true;
+}
+
+void MHS5200LoadTest::setArbitrarySlot(int slot) {
+    m_arbitrarySlot = slot & 15;
+}
+
+void MHS5200LoadTest::setSeed(unsigned seed) {
+    m_seed = seed ? seed : 1;
+}
+
+bool MHS5200LoadTest::runOperation(int type, unsigned random, uint64_t &bytes) {
+    char command[MHS5200_BUFFER_SIZE];
+    int channel = 1 + (random & 1);
+    random >>= 1;
+    int len;
+    
+    if ( type == OpArbitrary ) {
+        // A ramp shifted by the random value so consecutive uploads differ.
+        int values[MHS5200_ARB_VALUES];
+        int maxSample = m_driver.getLimits().maxSample;
+        for ( int i = 0; i < MHS5200_ARB_VALUES; i++ )
+            values[i] = (int)(((int64_t)(i + random) % MHS5200_ARB_VALUES) * maxSample / (MHS5200_ARB_VALUES - 1));
+        char chunk[MHS5200_ARB_CHUNK_SIZE];
+        for ( int i = 0; i < MHS5200_ARB_CHUNKS; i++ )
+            bytes += MHS5200Driver::formatArbitraryChunk(chunk, m_arbitrarySlot, i, &values[i*MHS5200_ARB_CHUNK_VALUES]) + 4;
+        return m_driver.setArbitrary(m_arbitrarySlot, values);
+    }
+    
+    if ( type == OpRead ) {
+        static const char readable[] = "fwdopya";
+        len = sprintf(command, ":r%d%c\n", channel, readable[random % (sizeof(readable) - 1)]);
+    } else {
+        switch ( random % 4 ) {
+            case 0: len = MHS5200Driver::formatFrequency(command, channel, 1000 + (random >> 2) % 1000000); break;
+            case 1: len = MHS5200Driver::formatDutyCycle(command, channel, 10 + (random >> 2) % 80); break;
+            case 2: len = MHS5200Driver::formatOffset(command, channel, (int)((random >> 2) % 41) - 20); break;
+            default: len = MHS5200Driver::formatPhaseOffset(command, channel, (random >> 2) % 360); break;
+        }
+    }
+    const char *response = m_driver.transact(command);
+    bytes += len;
+    if ( !response ) return false;
+    // The response went over the wire with its line end, values also with the leading colon.
+    bytes += strlen(response) + (response[0] == 'r' ? 3 : 2);
+    return true;
+}
+
+static double percentile(std::vector<int64_t> &sorted, double quantile) {
+    if ( sorted.empty() ) return 0;
+    size_t index = (size_t)(quantile * (sorted.size() - 1) + 0.5);
+    return (double)sorted[std::min(index, sorted.size() - 1)];
+}
+
+bool MHS5200LoadTest::run(int64_t durationMicros, int64_t operations, MHS5200LoadTest::Report &report, volatile sig_atomic_t *stop) {
+    std::vector<int64_t> latencies[OpTypes];
+    memset(&report, 0, sizeof(report));
+    int totalWeight = m_weights[OpRead] + m_weights[OpSet] + m_weights[OpArbitrary];
+    const MHS5200Driver::LinkStatistics &stats = m_driver.getStatistics();
+    uint64_t timeoutsBefore = stats.timeouts, retriesBefore = stats.retries;
+    unsigned state = m_seed;
+    
+    int64_t start = MHS5200Driver::monotonicMicros();
+    int64_t now = start;
+    while ( (durationMicros <= 0 || now - start < durationMicros) && (operations <= 0 || (int64_t)report.operations < operations) ) {
+        if ( stop && *stop ) break;
+        state ^= state << 13;
+        state ^= state >> 17;
+        state ^= state << 5;
+        int pick = (int)((state >> 8) % (unsigned)totalWeight);
+        int type = 0;
+        while ( pick >= m_weights[type] ) pick -= m_weights[type++];
+        
+        OpReport &op = report.types[type];
+        uint64_t bytes = 0;
+        int64_t opStart = MHS5200Driver::monotonicMicros();
+        bool ok = runOperation(type, state * 2654435761u, bytes);
+        now = MHS5200Driver::monotonicMicros();
+        op.operations++;
+        op.bytes += bytes;
+        report.operations++;
+        report.bytes += bytes;
+        if ( ok ) {
+            latencies[type].push_back(now - opStart);
+        } else {
+            op.errors++;
+            report.errors++;
+        }
+        if ( !m_driver.isConnected() ) break;
+    }
+    
+    report.seconds = (now - start) / 1000000.0;
+    report.timeouts = stats.timeouts - timeoutsBefore;
+    report.retries = stats.retries - retriesBefore;
+    if ( report.seconds > 0 ) {
+        report.operationsPerSecond = report.operations / report.seconds;
+        report.bytesPerSecond = report.bytes / report.seconds;
+    }
+    for ( int type = 0; type < OpTypes; type++ ) {
+        std::vector<int64_t> &sorted = latencies[type];
+        std::sort(sorted.begin(), sorted.end());
+        OpReport &op = report.types[type];
+        op.p50Micros = percentile(sorted, 0.5);
+        op.p90Micros = percentile(sorted, 0.9);
+        op.p99Micros = percentile(sorted, 0.99);
+        op.maxMicros = sorted.empty() ? 0 : (double)sorted.back();
+    }
+    return report.errors == 0;
+}
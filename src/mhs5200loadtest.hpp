@@ -0,0 +1,218 @@
+#pragma once
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <atomic>
+#include <thread>
+#include <vector>
+#include "mhs5200.hpp"
+
+#define MHS5200_FAKE_BAUD 57600
+
+/**
+ * Emulates the generator on a pseudo terminal so the driver and the command line can be exercised without one.
+ * 
+ * Settings are stored per channel and read back as set, memory slots keep the channel settings and arbitrary
+ * wave chunks are acknowledged.
+ * A pty moves bytes instantly, so the responses are held back by the wire time of the frame and its response at
+ * the configured baud rate plus the processing time of the device. Frames are handled one after the other like
+ * on the generator, a pipelined host sees the same throughput as on a real link.
+ */
+class MHS5200FakeDevice
+{
+public:
+    struct Statistics {
+        uint64_t frames;            // Frames answered or ignored.
+        uint64_t queries;
+        uint64_t chunks;            // Arbitrary wave chunks.
+        uint64_t bytesReceived;
+        uint64_t bytesSent;
+        uint64_t roundTrips;        // Writes of the host, a pipelined batch is one.
+        int64_t linkMicros;         // The session on the emulated link, from the first frame to the last response.
+    };
+    
+protected:
+    int m_master;
+    char m_slaveName[128];
+    double m_microsPerByte;
+    int m_readMicros;
+    int m_setMicros;
+    double m_lossRate;
+    unsigned m_seed;
+    bool m_instant;
+    FILE *m_log;
+    Statistics m_statistics;
+    std::atomic<bool> m_stop;
+    std::thread m_thread;
+    
+    char m_settings[5][26][16];     // Value digits by the channel character 0, 1, 2, a or b and the setting letter.
+    char m_memory[MHS5200_MEMORY_SLOTS][5][26][16];
+    
+    static int settingsIndex(char channel);
+    
+    void reset();
+    int respond(const char *frame, int len, char *response);
+    
+public:
+    MHS5200FakeDevice();
+    ~MHS5200FakeDevice();
+    
+    /**
+     * Create the pseudo terminal.
+     * 
+     * @return True if successful.
+     */
+    bool open();
+    
+    /**
+     * Name of the tty device to connect the driver to.
+     * 
+     * @return Path of the pseudo terminal slave.
+     */
+    const char *deviceName() { return m_slaveName; }
+    
+    /**
+     * Set the timing of the emulated link, call before start() or run().
+     * 
+     * @param baudRate Baud rate of the emulated serial line, 0 for no wire time.
+     * @param readMicros Time the device takes to answer a query.
+     * @param setMicros Time the device takes to acknowledge a set or an arbitrary wave chunk.
+     */
+    void setTiming(int baudRate, int readMicros, int setMicros);
+    
+    /**
+     * Drop responses to test recovery, like MHS5200Driver::setFaultInjection() but on the device side.
+     * 
+     * @param lossRate Fraction of frames not answered, 0 to 1.
+     * @param seed Seed so runs are repeatable.
+     */
+    void setLossRate(double lossRate, unsigned seed = 1);
+    
+    /**
+     * Answer at once instead of after the emulated link time. The link time is still accounted in the
+     * statistics, so a session can be planned without waiting for it.
+     * 
+     * @param instant True to answer at once.
+     */
+    void setInstant(bool instant);
+    
+    /**
+     * Print every frame with its response.
+     * 
+     * @param log Where to print, nullptr for no log.
+     */
+    void setLog(FILE *log);
+    
+    /**
+     * Counters of the frames served, read them after stop() or run() returned.
+     * 
+     * @return The statistics.
+     */
+    const Statistics &getStatistics() { return m_statistics; }
+    
+    /**
+     * Serve the host until it has been idle for idleTimeout seconds or stop() is called.
+     * 
+     * @param idleTimeout Seconds to wait for the host, 0 to wait for stop().
+     * @return Number of frames answered, or -1 on error.
+     */
+    long run(int idleTimeout = 30);
+    
+    /**
+     * Serve the host from a background thread until stop().
+     * 
+     * @return True if the thread was started.
+     */
+    bool start();
+    
+    /**
+     * End run() and join the background thread.
+     */
+    void stop();
+    
+    void close();
+};
+
+/**
+ * Drives a mix of reads, sets and arbitrary wave uploads over one connection and measures what the link sustains.
+ * 
+ * Each operation is one blocking call on the driver, reads and sets are single frames and an upload is the
+ * 16 chunks of setArbitrary(). The report has the rate, the bytes on the wire and per type latency percentiles;
+ * timeouts and retries are taken from the driver's link statistics.
+ */
+class MHS5200LoadTest
+{
+public:
+    enum OpType { OpRead, OpSet, OpArbitrary, OpTypes };
+    
+    struct OpReport {
+        uint64_t operations;
+        uint64_t errors;            // Operations that failed after the driver's retries.
+        uint64_t bytes;             // Frames and responses on the wire.
+        double p50Micros;
+        double p90Micros;
+        double p99Micros;
+        double maxMicros;
+    };
+    
+    struct Report {
+        double seconds;
+        uint64_t operations;
+        uint64_t errors;
+        uint64_t timeouts;          // Attempts without a response, including those that succeeded on a retry.
+        uint64_t retries;
+        uint64_t bytes;
+        double operationsPerSecond;
+        double bytesPerSecond;
+        OpReport types[OpTypes];
+    };
+    
+protected:
+    MHS5200Driver &m_driver;
+    int m_weights[OpTypes];
+    int m_arbitrarySlot;
+    unsigned m_seed;
+    
+    bool runOperation(int type, unsigned random, uint64_t &bytes);
+    
+public:
+    /**
+     * @param driver Connected driver.
+     */
+    MHS5200LoadTest(MHS5200Driver &driver);
+    
+    /**
+     * Relative share of each operation type, ie. 80, 18, 2.
+     * 
+     * @param reads Weight of frequency, duty cycle and other single value queries.
+     * @param sets Weight of single value sets.
+     * @param uploads Weight of arbitrary wave form uploads.
+     * @return False if no weight is positive.
+     */
+    bool setMix(int reads, int sets, int uploads);
+    
+    /**
+     * Arbitrary wave slot overwritten by the uploads.
+     * 
+     * @param slot 0-15.
+     */
+    void setArbitrarySlot(int slot);
+    
+    /**
+     * Seed of the operation sequence so runs are repeatable.
+     * 
+     * @param seed The seed.
+     */
+    void setSeed(unsigned seed);
+    
+    /**
+     * Run until the duration has passed or the number of operations is done, whichever comes first.
+     * 
+     * @param durationMicros Duration, 0 for no limit.
+     * @param operations Number of operations, 0 for no limit.
+     * @param report Receives the results.
+     * @param stop Ends the run early when set, ie. from a signal handler.
+     * @return True if every operation succeeded.
+     */
+    bool run(int64_t durationMicros, int64_t operations, Report &report, volatile sig_atomic_t *stop = nullptr);
+};
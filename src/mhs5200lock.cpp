@@ -0,0 +1,140 @@
+// First come, first served access to a device shared by several processes.
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/file.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <atomic>
+#include "mhs5200.hpp"
+
+void MHS5200Driver::setQueuedAccess(int waitMs, const char *lockDirectory) {
+    m_queueWaitMs = waitMs < 0 ? 0 : waitMs;
+    m_lockDirectory = lockDirectory ? lockDirectory : "/tmp";
+}
+
+bool MHS5200Driver::acquireDeviceLock(const char *deviceName) {
+    releaseDeviceLock();
+    
+    // One queue per device node, links such as /dev/serial/by-id/... share the queue of their target.
+    char resolved[PATH_MAX];
+    if ( !realpath(deviceName, resolved) ) {
+        strncpy(resolved, deviceName, sizeof(resolved) - 1);
+        resolved[sizeof(resolved) - 1] = 0;
+    }
+    std::string queue = m_lockDirectory + "/mhs5200";
+    for ( const char *p = resolved; *p; p++ )
+        queue += *p == '/' ? '_' : *p;
+    queue += ".queue";
+    if ( mkdir(queue.c_str(), 01777) == 0 ) {
+        chmod(queue.c_str(), 01777);
+    } else if ( errno != EEXIST ) {
+        systemError("mkdir", "Error creating %s: %s\n", queue.c_str(), strerror(errno));
+        return false;
+    }
+    
+    // Tickets are numbered under the lock of the counter file and only show up in the directory locked,
+    // with rename(), so every ticket visible to a waiter is held and all earlier tickets are already there.
+    std::string counterPath = queue + "/next";
+    int counter = open(counterPath.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0666);
+    if ( counter < 0 || flock(counter, LOCK_EX) != 0 ) {
+        systemError("open", "Error locking %s: %s\n", counterPath.c_str(), strerror(errno));
+        if ( counter >= 0 ) close(counter);
+        return false;
+    }
+    char number[32];
+    ssize_t len = pread(counter, number, sizeof(number) - 1, 0);
+    number[len > 0 ? len : 0] = 0;
+    unsigned long long ticket = strtoull(number, nullptr, 16);
+    len = sprintf(number, "%016llx\n", ticket + 1);
+    bool counted = pwrite(counter, number, len, 0) == len;
+    
+    static std::atomic<unsigned> s_sequence(0);
+    char name[64];
+    sprintf(name, "%016llx", ticket);
+    std::string path = queue + "/" + name;
+    std::string temporary = queue + "/.new." + std::to_string(getpid()) + "." + std::to_string(s_sequence++);
+    // Opened for writing so that the close, also by a crashing process, is an inotify event.
+    int fd = open(temporary.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0666);
+    bool queued = counted && fd >= 0 && flock(fd, LOCK_EX | LOCK_NB) == 0 && rename(temporary.c_str(), path.c_str()) == 0;
+    int error = errno;
+    close(counter);
+    if ( !queued ) {
+        systemError("lock", "Error queueing for %s: %s\n", deviceName, strerror(error));
+        if ( fd >= 0 ) {
+            unlink(temporary.c_str());
+            close(fd);
+        }
+        return false;
+    }
+    m_lockFd = fd;
+    m_lockPath = path;
+    
+    int notify = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if ( notify >= 0 && inotify_add_watch(notify, queue.c_str(), IN_DELETE | IN_CLOSE_WRITE | IN_MOVED_FROM) < 0 ) {
+        close(notify);
+        notify = -1;
+    }
+    
+    int64_t start = monotonicMicros();
+    int64_t deadline = start + (int64_t)m_queueWaitMs * 1000;
+    bool waited = false;
+    for (;;) {
+        // Count the held tickets ahead of ours, a ticket whose lock is free belongs to a process that died.
+        int ahead = 0;
+        DIR *dir = opendir(queue.c_str());
+        if ( dir ) {
+            while ( struct dirent *entry = readdir(dir) ) {
+                if ( strlen(entry->d_name) != 16 || strcmp(entry->d_name, name) >= 0 ) continue;
+                std::string other = queue + "/" + entry->d_name;
+                int ofd = open(other.c_str(), O_RDONLY | O_CLOEXEC);
+                if ( ofd < 0 ) continue;
+                if ( flock(ofd, LOCK_SH | LOCK_NB) == 0 ) unlink(other.c_str());
+                else ahead++;
+                close(ofd);
+            }
+            closedir(dir);
+        }
+        if ( ahead == 0 ) break;
+        
+        int64_t now = monotonicMicros();
+        if ( now >= deadline ) {
+            systemError("lock", "Gave up waiting for %s after %d ms, %d ahead in the queue\n", deviceName, m_queueWaitMs, ahead);
+            if ( notify >= 0 ) close(notify);
+            releaseDeviceLock();
+            return false;
+        }
+        if ( !waited ) {
+            waited = true;
+            m_statistics.lockWaits++;
+        }
+        // Woken when a ticket goes away, the timeout only covers a missed event.
+        struct pollfd pfd;
+        pfd.fd = notify;
+        pfd.events = POLLIN;
+        pfd.revents = 0;
+        int timeout = (int)((deadline - now + 999) / 1000);
+        poll(&pfd, notify >= 0 ? 1 : 0, timeout < 100 ? timeout : 100);
+        char events[4096];
+        while ( notify >= 0 && read(notify, events, sizeof(events)) > 0 ) {
+        }
+    }
+    if ( notify >= 0 ) close(notify);
+    if ( waited ) m_statistics.lockWaitMicros += monotonicMicros() - start;
+    return true;
+}
+
+void MHS5200Driver::releaseDeviceLock() {
+    if ( m_lockFd < 0 ) return;
+    unlink(m_lockPath.c_str());
+    close(m_lockFd);
+    m_lockFd = -1;
+    m_lockPath.clear();
+}
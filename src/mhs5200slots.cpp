@@ -0,0 +1,235 @@
+// Host side index of the memory slots and the state the driver knows the device has.
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "mhs5200.hpp"
+
+// Set latency assumed until the link has measured one, about what the generator takes.
+#define MHS5200_DEFAULT_SET_MICROS 2000
+
+static const char *s_fieldNames[] = { "inverted", "wave", "duty", "offset", "phase", "amplitude", "frequency" };
+
+bool MHS5200Driver::setSlotIndex(const char *fileName, bool update) {
+    memset(m_slotFields, 0, sizeof(m_slotFields));
+    m_slotIndexFile = fileName ? fileName : "";
+    m_slotIndexUpdate = update;
+    if ( !fileName ) return true;
+    
+    FILE *f = fopen(fileName, "r");
+    if ( !f ) {
+        if ( errno == ENOENT ) return true;
+        systemError("open", "Error opening %s: %s\n", fileName, strerror(errno));
+        return false;
+    }
+    // One line per slot and channel: <slot> <channel> followed by <field> <value> pairs of the fields known.
+    char line[512];
+    int lineNumber = 0;
+    bool ok = true;
+    while ( ok && fgets(line, sizeof(line), f) ) {
+        lineNumber++;
+        char *save;
+        char *token = strtok_r(line, " \t\r\n", &save);
+        if ( !token || token[0] == '#' ) continue;
+        int slot = atoi(token);
+        token = strtok_r(nullptr, " \t\r\n", &save);
+        int channel = token ? atoi(token) : 0;
+        if ( slot < 0 || slot >= MHS5200_MEMORY_SLOTS || channel < 1 || channel > 2 ) {
+            ok = false;
+            break;
+        }
+        ChannelState &state = m_slotStates[slot].channels[channel-1];
+        while ( (token = strtok_r(nullptr, " \t\r\n", &save)) ) {
+            const char *value = strtok_r(nullptr, " \t\r\n", &save);
+            int field = 0;
+            while ( field < 7 && strcmp(token, s_fieldNames[field]) != 0 ) field++;
+            if ( !value || field == 7 ) {
+                ok = false;
+                break;
+            }
+            switch ( 1 << field ) {
+                case FieldInverted: state.inverted = atoi(value) != 0; break;
+                case FieldWave: state.wave = (WaveType)atoi(value); break;
+                case FieldDutyCycle: state.dutyCycle = atof(value); break;
+                case FieldOffset: state.offset = atoi(value); break;
+                case FieldPhaseOffset: state.phaseOffset = atoi(value); break;
+                case FieldAmplitude: state.amplitude = atof(value); break;
+                case FieldFrequency: state.frequency = atof(value); break;
+            }
+            m_slotFields[slot] |= fieldMask(channel, (StateField)(1 << field));
+        }
+    }
+    fclose(f);
+    if ( !ok ) {
+        systemError("parse", "Error in slot index %s line %d\n", fileName, lineNumber);
+        memset(m_slotFields, 0, sizeof(m_slotFields));
+    }
+    return ok;
+}
+
+bool MHS5200Driver::writeSlotIndex() {
+    // Written next to the index and renamed over it, a crash leaves the old or the new one.
+    std::string temporary = m_slotIndexFile + ".new";
+    FILE *f = fopen(temporary.c_str(), "w");
+    if ( !f ) {
+        systemError("open", "Error writing %s: %s\n", temporary.c_str(), strerror(errno));
+        return false;
+    }
+    fprintf(f, "# Memory slots of the MHS-5200 as stored by mhs5200: <slot> <channel> <field> <value> ...\n");
+    for ( int slot = 0; slot < MHS5200_MEMORY_SLOTS; slot++ ) {
+        for ( int channel = 1; channel <= 2; channel++ ) {
+            if ( !(m_slotFields[slot] & fieldMask(channel, FieldAllChannel)) ) continue;
+            const ChannelState &state = m_slotStates[slot].channels[channel-1];
+            fprintf(f, "%d %d", slot, channel);
+            for ( int field = 0; field < 7; field++ ) {
+                if ( !(m_slotFields[slot] & fieldMask(channel, (StateField)(1 << field))) ) continue;
+                fprintf(f, " %s ", s_fieldNames[field]);
+                switch ( 1 << field ) {
+                    case FieldInverted: fprintf(f, "%d", state.inverted ? 1 : 0); break;
+                    case FieldWave: fprintf(f, "%d", (int)state.wave); break;
+                    case FieldDutyCycle: fprintf(f, "%.1f", state.dutyCycle); break;
+                    case FieldOffset: fprintf(f, "%d", state.offset); break;
+                    case FieldPhaseOffset: fprintf(f, "%d", state.phaseOffset); break;
+                    case FieldAmplitude: fprintf(f, "%.3f", state.amplitude); break;
+                    case FieldFrequency: fprintf(f, "%.2f", state.frequency); break;
+                }
+            }
+            fprintf(f, "\n");
+        }
+    }
+    bool ok = fflush(f) == 0 && fsync(fileno(f)) == 0;
+    ok = fclose(f) == 0 && ok;
+    if ( !ok || rename(temporary.c_str(), m_slotIndexFile.c_str()) != 0 ) {
+        systemError("write", "Error writing %s: %s\n", m_slotIndexFile.c_str(), strerror(errno));
+        unlink(temporary.c_str());
+        return false;
+    }
+    return true;
+}
+
+unsigned MHS5200Driver::slotContents(int slot, MHS5200Driver::DeviceState &state) {
+    if ( slot < 0 || slot >= MHS5200_MEMORY_SLOTS ) return 0;
+    state = m_slotStates[slot];
+    return m_slotFields[slot];
+}
+
+unsigned MHS5200Driver::knownState(MHS5200Driver::DeviceState &state) {
+    state = m_knownState;
+    return m_knownFields;
+}
+
+void MHS5200Driver::forgetKnownState() {
+    m_knownFields = 0;
+}
+
+void MHS5200Driver::noteKnownState(const MHS5200Driver::DeviceState &state, unsigned fields) {
+    for ( int channel = 1; channel <= 2; channel++ ) {
+        for ( unsigned field = FieldInverted; field <= FieldFrequency; field <<= 1 ) {
+            unsigned mask = fieldMask(channel, (StateField)field);
+            if ( !(fields & mask) ) continue;
+            ChannelState &known = m_knownState.channels[channel-1];
+            const ChannelState &source = state.channels[channel-1];
+            switch ( field ) {
+                case FieldInverted: known.inverted = source.inverted; break;
+                case FieldWave: known.wave = source.wave; break;
+                case FieldDutyCycle: known.dutyCycle = source.dutyCycle; break;
+                case FieldOffset: known.offset = source.offset; break;
+                case FieldPhaseOffset: known.phaseOffset = source.phaseOffset; break;
+                case FieldAmplitude: known.amplitude = source.amplitude; break;
+                case FieldFrequency: known.frequency = source.frequency; break;
+            }
+        }
+    }
+    if ( fields & FieldCurrentChannel ) m_knownState.currentChannel = state.currentChannel;
+    if ( fields & FieldChannelStatus ) m_knownState.currentChannelStatus = state.currentChannelStatus;
+    m_knownFields |= fields;
+}
+
+unsigned MHS5200Driver::frameFields(const char *frame) {
+    // Fields a set frame changes, ie. ":s1f100000\n". b is the inversion on channels a and b, the output
+    // on channel 1 and the displayed channel on channel 2.
+    if ( frame[0] != ':' || frame[1] != 's' || !frame[2] || !frame[3] ) return 0;
+    int channel = frame[2] == '1' || frame[2] == 'a' ? 1 : 2;
+    switch ( frame[3] ) {
+        case 'b':
+            if ( frame[2] == '1' ) return FieldChannelStatus;
+            if ( frame[2] == '2' ) return FieldCurrentChannel;
+            return fieldMask(channel, FieldInverted);
+        case 'w': return fieldMask(channel, FieldWave);
+        case 'd': return fieldMask(channel, FieldDutyCycle);
+        case 'o': return fieldMask(channel, FieldOffset);
+        case 'p': return fieldMask(channel, FieldPhaseOffset);
+        case 'a':
+        case 'y': return fieldMask(channel, FieldAmplitude);
+        case 'f': return fieldMask(channel, FieldFrequency);
+        case 'u': return 0;
+        default: break;
+    }
+    // Slot loads and anything unknown may change every setting.
+    return ~0u;
+}
+
+bool MHS5200Driver::planProfile(const MHS5200Driver::DeviceState &target, unsigned fields, MHS5200Driver::ProfilePlan &plan) {
+    fields &= fieldMask(1, FieldAllChannel) | fieldMask(2, FieldAllChannel);
+    double perByte = wireMicrosPerByte();
+    double setMicros = latencyQuantile(CommandSet, 0.5);
+    if ( setMicros < 0 ) setMicros = MHS5200_DEFAULT_SET_MICROS;
+    
+    // Sets needed from a base state, a field the base does not know is set.
+    auto sets = [&](const DeviceState &base, unsigned baseFields, ProfilePlan &way) -> bool {
+        way.fields = 0;
+        way.frames = 0;
+        way.bytes = 0;
+        for ( int channel = 1; channel <= 2; channel++ ) {
+            for ( unsigned field = FieldInverted; field <= FieldFrequency; field <<= 1 ) {
+                unsigned mask = fieldMask(channel, (StateField)field);
+                if ( !(fields & mask) ) continue;
+                if ( (baseFields & mask) && sameFieldValue((StateField)field, base.channels[channel-1], target.channels[channel-1]) ) continue;
+                char buffer[2*MHS5200_BUFFER_SIZE];
+                int len = formatField(buffer, channel, (StateField)field, target.channels[channel-1]);
+                if ( len == 0 ) return false;
+                way.fields |= mask;
+                way.bytes += len;
+                for ( int i = 0; i < len; i++ )
+                    if ( buffer[i] == '\n' ) way.frames++;
+            }
+        }
+        // Each frame is answered with ok\r\n after the device took its time.
+        way.estimatedMicros = (way.bytes + 4*way.frames) * perByte + way.frames * setMicros;
+        return true;
+    };
+    
+    plan.slot = -1;
+    if ( !sets(m_knownState, m_knownFields, plan) ) {
+        systemError("profile", "Invalid value in the profile\n");
+        return false;
+    }
+    plan.directMicros = plan.estimatedMicros;
+    
+    // A load is ":s0v\n" answered with ok\r\n, until one was timed it is taken to cost the device a set.
+    double loadMicros = 9 * perByte + (m_slotLoadMicros >= 0 ? m_slotLoadMicros : setMicros);
+    for ( int slot = 0; slot < MHS5200_MEMORY_SLOTS; slot++ ) {
+        if ( !(m_slotFields[slot] & fields) ) continue;
+        ProfilePlan way;
+        if ( !sets(m_slotStates[slot], m_slotFields[slot], way) ) continue;
+        way.estimatedMicros += loadMicros;
+        if ( way.estimatedMicros >= plan.estimatedMicros ) continue;
+        way.slot = slot;
+        way.directMicros = plan.directMicros;
+        plan = way;
+    }
+    return true;
+}
+
+bool MHS5200Driver::applyProfile(const MHS5200Driver::DeviceState &target, unsigned fields, MHS5200Driver::ProfilePlan *plan, MHS5200Driver::CommitReport *report) {
+    ProfilePlan dummy;
+    if ( !plan ) plan = &dummy;
+    if ( report ) memset(report, 0, sizeof(*report));
+    if ( !planProfile(target, fields, *plan) ) return false;
+    if ( plan->slot >= 0 && !loadSettings(plan->slot) ) return false;
+    if ( plan->fields == 0 ) return true;
+    // The plan already left out what is known to match, nothing needs reading.
+    return commit(target, plan->fields, report, false);
+}
@@ -0,0 +1,160 @@
+#include <errno.h>
+#include <poll.h>
+#include <string.h>
+#include <time.h>
+#include <algorithm>
+#include "mhs5200stream.hpp"
+#include "mhs5200bank.hpp"
+
+MHS5200ArbitraryStream::MHS5200ArbitraryStream(MHS5200Driver &driver) : m_driver(driver), m_firstSlot(14), m_slotCount(2)
+{
+}
+
+bool MHS5200ArbitraryStream::load(const char *fileName, std::string &error) {
+    if ( !MHS5200Bank::parseSamples(fileName, m_samples, error, m_driver.getLimits().maxSample) ) return false;
+    if ( m_samples.empty() || m_samples.size() % MHS5200_ARB_VALUES != 0 ) {
+        error = std::string("Error: Parsing file ") + fileName + ", expected a multiple of " + std::to_string(MHS5200_ARB_VALUES) +
+                " samples but found " + std::to_string(m_samples.size()) + ".";
+        m_samples.clear();
+        return false;
+    }
+    return true;
+}
+
+bool MHS5200ArbitraryStream::setSlots(int first, int count) {
+    if ( first < 0 || count < 2 || first + count > 16 ) return false;
+    m_firstSlot = first;
+    m_slotCount = count;
+    return true;
+}
+
+int MHS5200ArbitraryStream::segments() {
+    return (int)(m_samples.size() / MHS5200_ARB_VALUES);
+}
+
+int64_t MHS5200ArbitraryStream::segmentUploadMicros() {
+    if ( m_samples.empty() ) return 0;
+    char frame[MHS5200_ARB_CHUNK_SIZE];
+    int bytes = 0;
+    for ( int chunk = 0; chunk < MHS5200_ARB_CHUNKS; chunk++ )
+        bytes += MHS5200Driver::formatArbitraryChunk(frame, m_firstSlot, chunk, &m_samples[chunk*MHS5200_ARB_CHUNK_VALUES]) + 4;
+    double latency = m_driver.latencyQuantile(MHS5200Driver::CommandArbitrary, 0.5);
+    if ( latency < 0 ) latency = 2000;
+    return (int64_t)(bytes * m_driver.wireMicrosPerByte() + MHS5200_ARB_CHUNKS * latency);
+}
+
+bool MHS5200ArbitraryStream::run(int channel, int64_t segmentMicros, MHS5200ArbitraryStream::Report &report, volatile sig_atomic_t *stop) {
+    int count = segments();
+    memset(&report, 0, sizeof(report));
+    report.segments = count;
+    report.targetRate = segmentMicros > 0 ? 1000000.0 / segmentMicros : 0;
+    if ( count == 0 || segmentMicros <= 0 || !m_driver.isConnected() || m_driver.pendingRequests() > 0 ) return false;
+    
+    std::vector<int> acked(count, 0);
+    std::vector<int64_t> uploadStart(count, 0), uploadEnd(count, 0);
+    std::vector<char> underrun(count, 0);
+    int uploadSegment = 0, uploadChunk = 0;
+    bool chunkInFlight = false;
+    int onAir = -1;
+    bool switchPending = false;
+    bool failed = false;
+    int64_t start = 0, firstSwitch = 0, lastSwitch = 0;
+    double lateTotal = 0;
+    // Round trip of one chunk, to keep the link free of chunks when a switch is due.
+    double chunkMicros = segmentUploadMicros() / (double)MHS5200_ARB_CHUNKS;
+    int preload = std::min(count, m_slotCount);
+    char frame[MHS5200_ARB_CHUNK_SIZE];
+    
+    while ( !failed && onAir < count - 1 && !(stop && *stop) ) {
+        int64_t now = MHS5200Driver::monotonicMicros();
+        int next = onAir + 1;
+        bool nextReady = acked[next] == MHS5200_ARB_CHUNKS;
+        if ( start == 0 && acked[preload-1] == MHS5200_ARB_CHUNKS ) start = now;
+        int64_t due = start + next * segmentMicros;
+        
+        if ( start && !switchPending && now >= due ) {
+            if ( nextReady ) {
+                MHS5200Driver::formatWaveType(frame, channel, (MHS5200Driver::WaveType)((int)MHS5200Driver::WaveType::Arbitrary0 + m_firstSlot + next % m_slotCount));
+                switchPending = true;
+                m_driver.submit(frame, [&, next, due](const char *response) {
+                    switchPending = false;
+                    if ( !response ) {
+                        failed = true;
+                        return;
+                    }
+                    int64_t acknowledged = MHS5200Driver::monotonicMicros();
+                    onAir = next;
+                    if ( report.switched++ == 0 ) firstSwitch = acknowledged;
+                    lastSwitch = acknowledged;
+                    double late = (acknowledged - due) / 1000.0;
+                    lateTotal += late;
+                    report.lateMaxMillis = std::max(report.lateMaxMillis, late);
+                }, MHS5200Driver::PriorityUrgent);
+            } else if ( !underrun[next] ) {
+                underrun[next] = 1;
+                report.underruns++;
+            }
+        }
+        
+        // A segment goes into the slot of the one slotCount before it, which is free once a later one is on air.
+        // The next chunk waits when it would still be on the wire at a switch that is ready to go.
+        bool hold = start && !switchPending && nextReady && now + chunkMicros > due;
+        if ( !chunkInFlight && !hold && uploadSegment < count && uploadSegment < std::max(m_slotCount, onAir + m_slotCount) ) {
+            int segment = uploadSegment, chunk = uploadChunk;
+            int slot = m_firstSlot + segment % m_slotCount;
+            MHS5200Driver::formatArbitraryChunk(frame, slot, chunk, &m_samples[segment*MHS5200_ARB_VALUES + chunk*MHS5200_ARB_CHUNK_VALUES]);
+            if ( chunk == 0 ) uploadStart[segment] = now;
+            chunkInFlight = true;
+            m_driver.submit(frame, [&, segment, now](const char *response) {
+                chunkInFlight = false;
+                if ( !response ) {
+                    failed = true;
+                    return;
+                }
+                int64_t acknowledged = MHS5200Driver::monotonicMicros();
+                chunkMicros = chunkMicros * 0.8 + (acknowledged - now) * 0.2;
+                if ( ++acked[segment] == MHS5200_ARB_CHUNKS ) uploadEnd[segment] = acknowledged;
+            }, MHS5200Driver::PriorityBulk);
+            if ( ++uploadChunk == MHS5200_ARB_CHUNKS ) {
+                uploadChunk = 0;
+                uploadSegment++;
+            }
+        }
+        
+        // Sleep until the link needs attention or the next switch is due.
+        int64_t wait = -1;
+        int timeout = m_driver.timeoutMillis();
+        if ( timeout >= 0 ) wait = (int64_t)timeout * 1000;
+        if ( start && !switchPending && nextReady ) {
+            int64_t untilDue = std::max<int64_t>(0, due - MHS5200Driver::monotonicMicros());
+            if ( wait < 0 || untilDue < wait ) wait = untilDue;
+        }
+        struct pollfd pfd;
+        pfd.fd = m_driver.getFileDescriptor();
+        pfd.events = m_driver.pollEvents();
+        pfd.revents = 0;
+        if ( pfd.events == 0 && wait < 0 ) break;
+        struct timespec ts;
+        ts.tv_sec = wait / 1000000;
+        ts.tv_nsec = (long)(wait % 1000000) * 1000;
+        int ready = ppoll(&pfd, 1, wait < 0 ? nullptr : &ts, nullptr);
+        if ( ready < 0 && errno != EINTR ) break;
+        if ( ready > 0 && (pfd.revents & (POLLIN | POLLERR | POLLHUP)) ) m_driver.onReadable();
+        if ( ready > 0 && (pfd.revents & POLLOUT) ) m_driver.onWritable();
+        m_driver.onTimeout();
+    }
+    // Commands still queued after a stop or a failure complete before the state they refer to goes away.
+    m_driver.runPending();
+    
+    int uploads = 0;
+    double uploadTotal = 0;
+    for ( int i = 0; i < count; i++ ) {
+        if ( uploadEnd[i] == 0 ) continue;
+        uploads++;
+        uploadTotal += (uploadEnd[i] - uploadStart[i]) / 1000.0;
+    }
+    if ( uploads ) report.uploadMeanMillis = uploadTotal / uploads;
+    if ( report.switched ) report.lateMeanMillis = lateTotal / report.switched;
+    if ( report.switched > 1 ) report.achievedRate = (report.switched - 1) * 1000000.0 / (lastSwitch - firstSwitch);
+    return !failed && report.switched == count;
+}
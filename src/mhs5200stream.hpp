@@ -0,0 +1,83 @@
+#pragma once
+#include <signal.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include "mhs5200.hpp"
+
+/**
+ * Plays a wave form longer than one arbitrary slot as a sequence of 1024 sample segments.
+ * 
+ * The segments rotate through a range of arbitrary slots: while one slot plays, the following segments are
+ * uploaded into the others and each switch to the next slot is sent when its time has come. Uploads are queued
+ * as bulk commands on the driver's non-blocking core and the switches as urgent ones, so a switch waits at most
+ * for the chunk on the wire instead of for the rest of an upload. A segment not uploaded by its switch time is
+ * an underrun, the previous one keeps playing until it is ready.
+ * 
+ * While running the stream drives the driver's event loop, the driver must not be used from other threads.
+ */
+class MHS5200ArbitraryStream
+{
+public:
+    struct Report {
+        int segments;
+        int switched;               // Segments that went on air.
+        int underruns;              // Segments not uploaded by their switch time.
+        double targetRate;          // Segments per second requested.
+        double achievedRate;        // Segments per second from the first to the last switch.
+        double uploadMeanMillis;    // First chunk queued to last chunk acknowledged, per segment.
+        double lateMeanMillis;      // Switch acknowledged after its scheduled time.
+        double lateMaxMillis;
+    };
+    
+protected:
+    MHS5200Driver &m_driver;
+    std::vector<int> m_samples;
+    int m_firstSlot;
+    int m_slotCount;
+    
+public:
+    MHS5200ArbitraryStream(MHS5200Driver &driver);
+    
+    /**
+     * Read the wave form, a file in the format of MHS5200Bank::parseWaveform() with any multiple of 1024 lines.
+     * 
+     * @param fileName The file.
+     * @param error Receives a description of the problem on failure.
+     * @return True on success.
+     */
+    bool load(const char *fileName, std::string &error);
+    
+    /**
+     * Arbitrary slots to rotate through, two (the default, slots 14 and 15) is double buffering. More slots
+     * let more segments be uploaded ahead to ride out a slow link.
+     * 
+     * @param first First slot.
+     * @param count Number of slots, 2 to 16 - first.
+     * @return False if the range is not valid.
+     */
+    bool setSlots(int first, int count);
+    
+    /**
+     * @return Number of segments loaded.
+     */
+    int segments();
+    
+    /**
+     * Estimate the upload time of one segment from the wire time of its chunks and the observed latency.
+     * 
+     * @return Microseconds.
+     */
+    int64_t segmentUploadMicros();
+    
+    /**
+     * Upload the first segments, then switch through all of them.
+     * 
+     * @param channel Channel playing the stream (1 or 2).
+     * @param segmentMicros Time each segment plays.
+     * @param report Receives the statistics.
+     * @param stop Ends the stream early when set, ie. from a signal handler.
+     * @return True when every segment went on air.
+     */
+    bool run(int channel, int64_t segmentMicros, Report &report, volatile sig_atomic_t *stop = nullptr);
+};
@@ -0,0 +1,216 @@
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sched.h>
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include "mhs5200sync.hpp"
+
+MHS5200SyncGroup::MHS5200SyncGroup()
+{
+}
+
+int MHS5200SyncGroup::add(MHS5200Driver &driver) {
+    Unit unit;
+    unit.driver = &driver;
+    unit.frameCount = 0;
+    m_units.push_back(unit);
+    return (int)m_units.size() - 1;
+}
+
+int MHS5200SyncGroup::units() {
+    return (int)m_units.size();
+}
+
+bool MHS5200SyncGroup::prepare(int unit, const MHS5200Driver::DeviceState &target, unsigned fields) {
+    static const MHS5200Driver::StateField order[] = {
+        MHS5200Driver::FieldWave, MHS5200Driver::FieldInverted, MHS5200Driver::FieldDutyCycle, MHS5200Driver::FieldOffset,
+        MHS5200Driver::FieldAmplitude, MHS5200Driver::FieldFrequency, MHS5200Driver::FieldPhaseOffset
+    };
+    if ( unit < 0 || unit >= (int)m_units.size() ) return false;
+    MHS5200Driver &driver = *m_units[unit].driver;
+    
+    std::string frames;
+    for ( auto field : order ) {
+        for ( int channel = 1; channel <= 2; channel++ ) {
+            if ( !(fields & MHS5200Driver::fieldMask(channel, field)) ) continue;
+            char buffer[2*MHS5200_BUFFER_SIZE];
+            int len = driver.formatField(buffer, channel, field, target.channels[channel-1]);
+            if ( len == 0 ) {
+                fprintf(stderr, "Error: invalid value for unit %d channel %d.\n", unit, channel);
+                return false;
+            }
+            frames.append(buffer, len);
+        }
+    }
+    return prepareCommands(unit, frames.c_str());
+}
+
+bool MHS5200SyncGroup::prepareCommands(int unit, const char *commands) {
+    if ( unit < 0 || unit >= (int)m_units.size() ) return false;
+    Unit &u = m_units[unit];
+    u.frames += commands;
+    u.frameCount += (int)std::count(commands, commands + strlen(commands), '\n');
+    return true;
+}
+
+void MHS5200SyncGroup::clearFrames() {
+    for ( auto &unit : m_units ) {
+        unit.frames.clear();
+        unit.frameCount = 0;
+    }
+}
+
+bool MHS5200SyncGroup::triggerUnit(MHS5200SyncGroup::Unit &unit, MHS5200SyncGroup::UnitReport &report) {
+    int fd = unit.driver->getFileDescriptor();
+    const char *frames = unit.frames.data();
+    int len = (int)unit.frames.size();
+    int done = 0;
+    
+    // The frames bypass the driver, which no longer knows the settings and replays these after a reconnect.
+    unit.driver->noteDirectWrite(frames, len);
+    report.writeStartMicros = MHS5200Driver::monotonicMicros();
+    while ( done < len ) {
+        ssize_t n = write(fd, frames+done, len-done);
+        if ( n < 0 ) {
+            if ( errno == EINTR ) continue;
+            if ( errno == EAGAIN ) {
+                struct pollfd out;
+                out.fd = fd;
+                out.events = POLLOUT;
+                out.revents = 0;
+                poll(&out, 1, 100);
+                continue;
+            }
+            fprintf(stderr, "Error from write: %s\n", strerror(errno));
+            return false;
+        }
+        done += n;
+    }
+    report.writeEndMicros = MHS5200Driver::monotonicMicros();
+    
+    // The frames are on their way, each one still costs the device its set latency.
+    int64_t deadline = report.writeEndMicros + unit.driver->responseTimeoutMicros(":s1f\n") * unit.frameCount;
+    char line[MHS5200_BUFFER_SIZE];
+    int lineLen = 0;
+    while ( report.acknowledged < unit.frameCount ) {
+        int64_t remaining = deadline - MHS5200Driver::monotonicMicros();
+        if ( remaining <= 0 ) break;
+        struct pollfd pfd;
+        pfd.fd = fd;
+        pfd.events = POLLIN;
+        pfd.revents = 0;
+        if ( poll(&pfd, 1, (int)(remaining/1000) + 1) <= 0 ) continue;
+        
+        char buf[256];
+        ssize_t n = read(fd, buf, sizeof(buf));
+        if ( n <= 0 ) continue;
+        int64_t now = MHS5200Driver::monotonicMicros();
+        for ( ssize_t k = 0; k < n; k++ ) {
+            if ( buf[k] != '\n' ) {
+                if ( lineLen < (int)sizeof(line)-1 ) line[lineLen++] = buf[k];
+                continue;
+            }
+            while ( lineLen > 0 && line[lineLen-1] == '\r' ) lineLen--;
+            if ( lineLen == 2 && strncmp(line, "ok", 2) == 0 && report.acknowledged < unit.frameCount ) {
+                report.acknowledged++;
+                report.lastAckMicros = now;
+            }
+            lineLen = 0;
+        }
+    }
+    return report.acknowledged == unit.frameCount;
+}
+
+bool MHS5200SyncGroup::trigger(MHS5200SyncGroup::Report &report, bool realtime) {
+    int count = (int)m_units.size();
+    report.units = count;
+    report.frames = 0;
+    report.acknowledged = 0;
+    report.releaseSpreadMicros = 0;
+    report.skewMicros = 0;
+    report.ackSpreadMicros = 0;
+    report.realtime = realtime;
+    report.unitReports.assign(count, UnitReport());
+    for ( int i = 0; i < count; i++ ) {
+        memset(&report.unitReports[i], 0, sizeof(UnitReport));
+        report.unitReports[i].frames = m_units[i].frameCount;
+        report.frames += m_units[i].frameCount;
+        if ( !m_units[i].driver->isConnected() || m_units[i].driver->pendingRequests() > 0 ) {
+            fprintf(stderr, "Error: unit %d is not connected or busy.\n", i);
+            return false;
+        }
+    }
+    if ( count == 0 ) return true;
+    
+    std::atomic<int> ready(0);
+    std::atomic<bool> go(false);
+    std::atomic<bool> realtimeGranted(true);
+    std::vector<char> succeeded(count, 0);
+    std::vector<std::thread> threads;
+    
+    for ( int i = 0; i < count; i++ ) {
+        threads.emplace_back([&, i]() {
+            Unit &unit = m_units[i];
+            if ( realtime ) {
+                struct sched_param param;
+                param.sched_priority = sched_get_priority_max(SCHED_FIFO);
+                if ( pthread_setschedparam(pthread_self(), SCHED_FIFO, &param) != 0 ) realtimeGranted = false;
+            }
+            // Everything slow happens before the barrier: earlier frames are out, stale input including what the
+            // driver already read is dropped and the thread is running.
+            bool handedOver = unit.driver->beginDirectAccess();
+            // The last thread to arrive opens the barrier, a realtime thread spinning here never waits for one
+            // with normal priority.
+            if ( ++ready == count ) go.store(true, std::memory_order_release);
+            // Spin rather than sleep, waking a blocked thread costs more than the skew we are after.
+            while ( !go.load(std::memory_order_acquire) )
+                std::this_thread::yield();
+            if ( !handedOver ) return;
+            if ( unit.frameCount > 0 ) succeeded[i] = triggerUnit(unit, report.unitReports[i]);
+            else succeeded[i] = 1;
+            unit.driver->endDirectAccess(succeeded[i] != 0);
+        });
+    }
+    
+    for ( auto &thread : threads )
+        thread.join();
+    
+    if ( realtime && !realtimeGranted ) {
+        fprintf(stderr, "Warning: SCHED_FIFO not available, running with normal priority.\n");
+        report.realtime = false;
+    }
+    
+    // Spread of the timestamps over the units that had something to send.
+    int64_t firstStart = 0, lastStart = 0, firstEnd = 0, lastEnd = 0, firstAck = 0, lastAck = 0;
+    bool first = true, allAcked = true;
+    bool ok = true;
+    for ( int i = 0; i < count; i++ ) {
+        UnitReport &unit = report.unitReports[i];
+        report.acknowledged += unit.acknowledged;
+        if ( !succeeded[i] ) ok = false;
+        if ( unit.frames == 0 ) continue;
+        if ( unit.lastAckMicros == 0 ) allAcked = false;
+        if ( first ) {
+            firstStart = lastStart = unit.writeStartMicros;
+            firstEnd = lastEnd = unit.writeEndMicros;
+            firstAck = lastAck = unit.lastAckMicros;
+            first = false;
+            continue;
+        }
+        firstStart = std::min(firstStart, unit.writeStartMicros);
+        lastStart = std::max(lastStart, unit.writeStartMicros);
+        firstEnd = std::min(firstEnd, unit.writeEndMicros);
+        lastEnd = std::max(lastEnd, unit.writeEndMicros);
+        firstAck = std::min(firstAck, unit.lastAckMicros);
+        lastAck = std::max(lastAck, unit.lastAckMicros);
+    }
+    report.releaseSpreadMicros = (double)(lastStart - firstStart);
+    report.skewMicros = (double)(lastEnd - firstEnd);
+    if ( allAcked ) report.ackSpreadMicros = (double)(lastAck - firstAck);
+    return ok;
+}
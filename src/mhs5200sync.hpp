@@ -0,0 +1,106 @@
+#pragma once
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include "mhs5200.hpp"
+
+/**
+ * Applies a change to several generators at nearly the same instant, ie. a phase or frequency step on
+ * chained units.
+ * 
+ * The frames of every unit are encoded up front. trigger() starts one thread per unit which flushes its input
+ * and then waits at a barrier, all of them are released together and write their frames in one burst. The
+ * acknowledgements are checked afterwards and the skew is taken from the write timestamps. While triggering
+ * the group owns the TTYs, the drivers must not be used until trigger() returns.
+ */
+class MHS5200SyncGroup
+{
+public:
+    /**
+     * Outcome of one unit.
+     */
+    struct UnitReport {
+        int frames;
+        int acknowledged;
+        int64_t writeStartMicros;   // Monotonic time the write was started.
+        int64_t writeEndMicros;     // Monotonic time the last byte was handed to the tty.
+        int64_t lastAckMicros;      // Monotonic time of the last acknowledgement, 0 when missing.
+    };
+    
+    /**
+     * Outcome of a trigger.
+     */
+    struct Report {
+        int units;
+        int frames;
+        int acknowledged;
+        double releaseSpreadMicros; // First to last write started after the barrier.
+        double skewMicros;          // First to last write completed, the measured cross device skew.
+        double ackSpreadMicros;     // First to last final acknowledgement, includes the device latency.
+        bool realtime;              // SCHED_FIFO was granted to all unit threads.
+        std::vector<UnitReport> unitReports;
+    };
+    
+protected:
+    struct Unit {
+        MHS5200Driver *driver;
+        std::string frames;
+        int frameCount;
+    };
+    
+    std::vector<Unit> m_units;
+    
+    bool triggerUnit(Unit &unit, UnitReport &report);
+    
+public:
+    MHS5200SyncGroup();
+    
+    /**
+     * Add a connected generator to the group.
+     * 
+     * @param driver The driver, must stay valid while the group is used.
+     * @return Index of the unit.
+     */
+    int add(MHS5200Driver &driver);
+    
+    /**
+     * Number of units in the group.
+     * 
+     * @return The count.
+     */
+    int units();
+    
+    /**
+     * Encode the channel fields of a unit for the next trigger. The order is the one of commit(), frequency
+     * and phase last so they land as close together as possible.
+     * 
+     * @param unit Index returned by add().
+     * @param target Values to set.
+     * @param fields Mask of channel fields to set, see MHS5200Driver::fieldMask(). Device fields are ignored.
+     * @return False when a value is out of range for the unit's model.
+     */
+    bool prepare(int unit, const MHS5200Driver::DeviceState &target, unsigned fields);
+    
+    /**
+     * Append raw set commands for a unit to the next trigger.
+     * 
+     * @param unit Index returned by add().
+     * @param commands One or more set commands, each including the trailing \n and answered with ok.
+     * @return False when the unit does not exist.
+     */
+    bool prepareCommands(int unit, const char *commands);
+    
+    /**
+     * Drop the prepared frames of all units.
+     */
+    void clearFrames();
+    
+    /**
+     * Release the prepared frames of all units at once and wait for the acknowledgements.
+     * 
+     * @param report Receives the timing of every unit and the skew.
+     * @param realtime Try to run the unit threads with SCHED_FIFO priority.
+     * @return True when every frame of every unit was acknowledged.
+     */
+    bool trigger(Report &report, bool realtime = false);
+};
@@ -0,0 +1,265 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <termios.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include "mhs5200trace.hpp"
+
+#define MHS5200_TRACE_GROWTH (1024*1024)
+
+static int64_t traceMicros() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec*1000000 + ts.tv_nsec/1000;
+}
+
+MHS5200Trace::MHS5200Trace() : m_fileDescriptor(-1), m_map(nullptr), m_mapSize(0), m_used(0), m_startMicros(0)
+{
+}
+
+MHS5200Trace::~MHS5200Trace() {
+    close();
+}
+
+bool MHS5200Trace::open(const char *fileName) {
+    close();
+    
+    int fd = ::open(fileName, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if ( fd < 0 ) {
+        fprintf(stderr, "Error creating trace %s: %s\n", fileName, strerror(errno));
+        return false;
+    }
+    if ( ftruncate(fd, MHS5200_TRACE_GROWTH) != 0 ) {
+        fprintf(stderr, "Error sizing trace %s: %s\n", fileName, strerror(errno));
+        ::close(fd);
+        return false;
+    }
+    void *map = mmap(nullptr, MHS5200_TRACE_GROWTH, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if ( map == MAP_FAILED ) {
+        fprintf(stderr, "Error mapping trace %s: %s\n", fileName, strerror(errno));
+        ::close(fd);
+        return false;
+    }
+    
+    m_fileDescriptor = fd;
+    m_map = (char *)map;
+    m_mapSize = MHS5200_TRACE_GROWTH;
+    m_startMicros = traceMicros();
+    
+    struct timeval tv;
+    gettimeofday(&tv, nullptr);
+    MHS5200TraceHeader *header = (MHS5200TraceHeader *)m_map;
+    header->magic = MHS5200_TRACE_MAGIC;
+    header->version = MHS5200_TRACE_VERSION;
+    header->headerSize = sizeof(MHS5200TraceHeader);
+    header->startMicros = m_startMicros;
+    header->startWallMicros = (int64_t)tv.tv_sec*1000000 + tv.tv_usec;
+    m_used = sizeof(MHS5200TraceHeader);
+    return true;
+}
+
+void MHS5200Trace::close() {
+    if ( m_map ) {
+        munmap(m_map, m_mapSize);
+        m_map = nullptr;
+    }
+    if ( m_fileDescriptor >= 0 ) {
+        if ( ftruncate(m_fileDescriptor, m_used) != 0 ) {
+            fprintf(stderr, "Error truncating trace: %s\n", strerror(errno));
+        }
+        ::close(m_fileDescriptor);
+        m_fileDescriptor = -1;
+    }
+    m_mapSize = 0;
+    m_used = 0;
+}
+
+bool MHS5200Trace::grow(size_t needed) {
+    size_t newSize = m_mapSize;
+    while ( newSize < m_used + needed )
+        newSize += MHS5200_TRACE_GROWTH;
+    if ( ftruncate(m_fileDescriptor, newSize) != 0 ) {
+        fprintf(stderr, "Error growing trace: %s\n", strerror(errno));
+        return false;
+    }
+    void *map = mremap(m_map, m_mapSize, newSize, MREMAP_MAYMOVE);
+    if ( map == MAP_FAILED ) {
+        fprintf(stderr, "Error remapping trace: %s\n", strerror(errno));
+        return false;
+    }
+    m_map = (char *)map;
+    m_mapSize = newSize;
+    return true;
+}
+
+void MHS5200Trace::record(MHS5200TraceRecord::Direction direction, const char *data, size_t length) {
+    if ( !m_map ) return;
+    
+    // Records longer than a uint16_t length are split.
+    while ( length > 0 ) {
+        size_t chunk = length > 0xffff ? 0xffff : length;
+        size_t needed = sizeof(MHS5200TraceRecord) + chunk;
+        if ( m_used + needed > m_mapSize && !grow(needed) ) {
+            close();
+            return;
+        }
+        
+        MHS5200TraceRecord *rec = (MHS5200TraceRecord *)&m_map[m_used];
+        rec->micros = traceMicros() - m_startMicros;
+        rec->direction = (uint8_t)direction;
+        rec->reserved = 0;
+        rec->length = (uint16_t)chunk;
+        rec->reserved2 = 0;
+        memcpy(rec+1, data, chunk);
+        m_used += needed;
+        data += chunk;
+        length -= chunk;
+    }
+}
+
+MHS5200Replay::MHS5200Replay() : m_master(-1), m_map(nullptr), m_mapSize(0)
+{
+    m_slaveName[0] = 0;
+}
+
+MHS5200Replay::~MHS5200Replay() {
+    close();
+}
+
+bool MHS5200Replay::open(const char *fileName) {
+    close();
+    
+    int fd = ::open(fileName, O_RDONLY);
+    if ( fd < 0 ) {
+        fprintf(stderr, "Error opening trace %s: %s\n", fileName, strerror(errno));
+        return false;
+    }
+    struct stat st;
+    if ( fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(MHS5200TraceHeader) ) {
+        fprintf(stderr, "Error: %s is not a trace file.\n", fileName);
+        ::close(fd);
+        return false;
+    }
+    void *map = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if ( map == MAP_FAILED ) {
+        fprintf(stderr, "Error mapping trace %s: %s\n", fileName, strerror(errno));
+        return false;
+    }
+    m_map = (char *)map;
+    m_mapSize = st.st_size;
+    
+    const MHS5200TraceHeader *header = (const MHS5200TraceHeader *)m_map;
+    if ( header->magic != MHS5200_TRACE_MAGIC || header->version != MHS5200_TRACE_VERSION || header->headerSize > m_mapSize ) {
+        fprintf(stderr, "Error: %s is not a trace file.\n", fileName);
+        close();
+        return false;
+    }
+    
+    m_master = posix_openpt(O_RDWR | O_NOCTTY);
+    if ( m_master < 0 || grantpt(m_master) != 0 || unlockpt(m_master) != 0 || ptsname_r(m_master, m_slaveName, sizeof(m_slaveName)) != 0 ) {
+        fprintf(stderr, "Error creating pseudo terminal: %s\n", strerror(errno));
+        close();
+        return false;
+    }
+    return true;
+}
+
+void MHS5200Replay::close() {
+    if ( m_master >= 0 ) {
+        ::close(m_master);
+        m_master = -1;
+    }
+    if ( m_map ) {
+        munmap(m_map, m_mapSize);
+        m_map = nullptr;
+    }
+    m_mapSize = 0;
+    m_slaveName[0] = 0;
+}
+
+long MHS5200Replay::run(double speed, int idleTimeout) {
+    if ( m_master < 0 ) return -1;
+    
+    // Hold the slave open so the master does not see a hangup before and between host connections.
+    int slave = ::open(m_slaveName, O_RDWR | O_NOCTTY);
+    if ( slave < 0 ) {
+        fprintf(stderr, "Error opening %s: %s\n", m_slaveName, strerror(errno));
+        return -1;
+    }
+    
+    const MHS5200TraceHeader *header = (const MHS5200TraceHeader *)m_map;
+    size_t pos = header->headerSize;
+    long mismatches = 0;
+    int64_t lastTxRecorded = 0;
+    int64_t lastTxReplayed = traceMicros();
+    char input[4096];
+    size_t inputLength = 0, inputPos = 0;
+    
+    while ( pos + sizeof(MHS5200TraceRecord) <= m_mapSize ) {
+        const MHS5200TraceRecord *rec = (const MHS5200TraceRecord *)&m_map[pos];
+        const char *data = (const char *)(rec+1);
+        if ( pos + sizeof(MHS5200TraceRecord) + rec->length > m_mapSize ) break;
+        pos += sizeof(MHS5200TraceRecord) + rec->length;
+        
+        if ( rec->direction == MHS5200TraceRecord::TX ) {
+            for ( size_t i = 0; i < rec->length; i++ ) {
+                if ( inputPos == inputLength ) {
+                    struct pollfd pfd;
+                    pfd.fd = m_master;
+                    pfd.events = POLLIN;
+                    pfd.revents = 0;
+                    int ready = poll(&pfd, 1, idleTimeout*1000);
+                    if ( ready < 0 && errno == EINTR ) { i--; continue; }
+                    if ( ready <= 0 ) {
+                        fprintf(stderr, "Replay: timeout waiting for host\n");
+                        ::close(slave);
+                        return mismatches + (long)(rec->length - i);
+                    }
+                    ssize_t n = read(m_master, input, sizeof(input));
+                    if ( n <= 0 ) {
+                        if ( n < 0 && (errno == EINTR || errno == EAGAIN) ) { i--; continue; }
+                        fprintf(stderr, "Replay: error reading host data: %s\n", strerror(errno));
+                        ::close(slave);
+                        return -1;
+                    }
+                    inputLength = n;
+                    inputPos = 0;
+                }
+                if ( input[inputPos++] != data[i] ) mismatches++;
+            }
+            lastTxRecorded = rec->micros;
+            lastTxReplayed = traceMicros();
+        } else {
+            if ( speed > 0 ) {
+                int64_t due = lastTxReplayed + (int64_t)((rec->micros - lastTxRecorded) / speed);
+                int64_t now = traceMicros();
+                if ( due > now ) usleep((useconds_t)(due - now));
+            }
+            size_t written = 0;
+            while ( written < rec->length ) {
+                ssize_t n = write(m_master, data + written, rec->length - written);
+                if ( n < 0 ) {
+                    if ( errno == EINTR || errno == EAGAIN ) continue;
+                    fprintf(stderr, "Replay: error writing device data: %s\n", strerror(errno));
+                    ::close(slave);
+                    return -1;
+                }
+                written += n;
+            }
+        }
+    }
+    
+    // Give the host a moment to collect the final response before the pseudo terminal goes away.
+    tcdrain(m_master);
+    usleep(100000);
+    ::close(slave);
+    return mismatches;
+}
@@ -0,0 +1,120 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+
+#define MHS5200_TRACE_MAGIC 0x3532484d  /* "MH25" */
+#define MHS5200_TRACE_VERSION 1
+
+/**
+ * Binary trace of the bytes exchanged with the signal generator.
+ * 
+ * The file is a MHS5200TraceHeader followed by records, each a MHS5200TraceRecord immediately
+ * followed by its data. Records are appended straight into a memory mapped file so recording costs
+ * a clock read and a memcpy.
+ */
+struct MHS5200TraceHeader {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t headerSize;
+    int64_t startMicros;    // Monotonic time of the first record, record times are relative to this.
+    int64_t startWallMicros; // Wall clock time when recording started.
+};
+
+struct MHS5200TraceRecord {
+    enum Direction { TX=0, RX=1 };
+    
+    int64_t micros;         // Time since MHS5200TraceHeader::startMicros.
+    uint8_t direction;
+    uint8_t reserved;
+    uint16_t length;        // Number of data bytes following the record.
+    uint32_t reserved2;
+};
+
+class MHS5200Trace
+{
+protected:
+    int m_fileDescriptor;
+    char *m_map;
+    size_t m_mapSize;
+    size_t m_used;
+    int64_t m_startMicros;
+    
+    bool grow(size_t needed);
+public:
+    MHS5200Trace();
+    ~MHS5200Trace();
+    
+    /**
+     * Start recording into a file, replacing its contents.
+     * 
+     * @param fileName Trace file to create.
+     * @return True if successful.
+     */
+    bool open(const char *fileName);
+    
+    /**
+     * Finish recording, truncating the file to the recorded length.
+     */
+    void close();
+    
+    /**
+     * Determine if a trace is being recorded.
+     * 
+     * @return True while recording.
+     */
+    bool isOpen() { return m_map != nullptr; }
+    
+    /**
+     * Append a record.
+     * 
+     * @param direction MHS5200TraceRecord::TX for bytes sent to the device, MHS5200TraceRecord::RX for bytes received.
+     * @param data The bytes.
+     * @param length Number of bytes.
+     */
+    void record(MHS5200TraceRecord::Direction direction, const char *data, size_t length);
+};
+
+/**
+ * Plays a recorded trace back as a fake device on a pseudo terminal.
+ * 
+ * Bytes written by the host are compared to the recorded TX records, each recorded RX record is sent
+ * once the TX record preceding it has been received, delayed like in the recording.
+ */
+class MHS5200Replay
+{
+protected:
+    int m_master;
+    char *m_map;
+    size_t m_mapSize;
+    char m_slaveName[128];
+    
+public:
+    MHS5200Replay();
+    ~MHS5200Replay();
+    
+    /**
+     * Load a trace and create the pseudo terminal for it.
+     * 
+     * @param fileName Trace file recorded with MHS5200Trace.
+     * @return True if successful.
+     */
+    bool open(const char *fileName);
+    
+    /**
+     * Name of the tty device to connect the driver to.
+     * 
+     * @return Path of the pseudo terminal slave.
+     */
+    const char *deviceName() { return m_slaveName; }
+    
+    /**
+     * Serve the recorded session.
+     * 
+     * @param speed Time scale, 1 for recorded timing, 2 for twice as fast, 0 to respond without delay.
+     * @param idleTimeout Seconds to wait for the host before giving up.
+     * @return Number of TX bytes that did not match the recording, or -1 on error.
+     */
+    long run(double speed = 1.0, int idleTimeout = 30);
+    
+    void close();
+};
@@ -0,0 +1,44 @@
+// Runtime side of the MHS-5200A family traits.
+
+#include <ctype.h>
+#include <string.h>
+#include "mhs5200traits.hpp"
+
+static const MHS5200ModelLimits s_modelLimits[] = {
+    mhs5200LimitsOf< DeviceTraits<MHS5200Model::MHS5206A> >(),
+    mhs5200LimitsOf< DeviceTraits<MHS5200Model::MHS5212A> >(),
+    mhs5200LimitsOf< DeviceTraits<MHS5200Model::MHS5220A> >(),
+    mhs5200LimitsOf< DeviceTraits<MHS5200Model::MHS5225A> >()
+};
+
+const MHS5200ModelLimits &mhs5200ModelLimits(MHS5200Model model) {
+    return s_modelLimits[(int)model];
+}
+
+bool mhs5200ParseModel(const char *name, MHS5200Model &model) {
+    // Reduce the name to its digits so all the usual spellings match.
+    char digits[8];
+    int count = 0;
+    for ( const char *p = name; *p; p++ ) {
+        if ( isdigit((unsigned char)*p) ) {
+            if ( count >= (int)sizeof(digits)-1 ) return false;
+            digits[count++] = *p;
+        } else if ( !strchr("mhsMHS-aA", *p) ) {
+            return false;
+        }
+    }
+    digits[count] = 0;
+    
+    for ( auto &limits : s_modelLimits ) {
+        if ( strstr(limits.name, digits) && count == 4 ) {
+            model = limits.model;
+            return true;
+        }
+    }
+    return false;
+}
+
+static_assert(DeviceTraits<MHS5200Model::MHS5206A>::validFrequency(6000000.0) &&
+              !DeviceTraits<MHS5200Model::MHS5206A>::validFrequency(6000000.01), "MHS-5206A frequency ceiling");
+static_assert(DeviceTraits<MHS5200Model::MHS5225A>::amplitudeUnits(1.5) == 1500 &&
+              DeviceTraits<MHS5200Model::MHS5225A>::amplitudeUnits(5.0) == 500, "Amplitude scaling");
@@ -0,0 +1,143 @@
+#pragma once
+
+#include <stdint.h>
+
+/**
+ * Members of the MHS-5200A family. They speak the same protocol and differ in their limits.
+ */
+enum class MHS5200Model {
+    MHS5206A = 0,
+    MHS5212A,
+    MHS5220A,
+    MHS5225A
+};
+
+/**
+ * Limits shared by the family, the models differ in the highest sine frequency.
+ * All of it is constexpr so code instantiated for one model validates and scales with constants.
+ */
+template <int64_t MaxHz>
+struct MHS5200FamilyTraits {
+    static constexpr double minFrequency = 0.01;
+    static constexpr double maxFrequency = (double)MaxHz;
+    static constexpr double frequencyResolution = 0.01;
+    static constexpr double minAmplitude = 0.005;
+    static constexpr double maxAmplitude = 20.0;
+    static constexpr double attenuationMax = 2.0;   // Below this the attenuator is on and the resolution is 1mV.
+    static constexpr int sampleBits = 12;
+    static constexpr int maxSample = (1 << sampleBits) - 1;
+    static constexpr int arbValues = 1024;
+    static constexpr int arbSlots = 16;
+    
+    static constexpr bool validFrequency(double hz) {
+        return hz >= minFrequency && hz <= maxFrequency;
+    }
+    
+    static constexpr int64_t frequencyUnits(double hz) {
+        return (int64_t)(hz / frequencyResolution + 0.5);
+    }
+    
+    static constexpr bool validAmplitude(double volts) {
+        return volts > minAmplitude && volts < maxAmplitude;
+    }
+    
+    static constexpr bool attenuated(double volts) {
+        return volts < attenuationMax;
+    }
+    
+    static constexpr int amplitudeUnits(double volts) {
+        return (int)(volts * (attenuated(volts) ? 1000.0 : 100.0));
+    }
+    
+    static constexpr bool validSample(int value) {
+        return value >= 0 && value <= maxSample;
+    }
+};
+
+template <MHS5200Model Model>
+struct DeviceTraits;
+
+template <>
+struct DeviceTraits<MHS5200Model::MHS5206A> : MHS5200FamilyTraits<6000000> {
+    static constexpr MHS5200Model model = MHS5200Model::MHS5206A;
+    static constexpr const char *name() { return "MHS-5206A"; }
+};
+
+template <>
+struct DeviceTraits<MHS5200Model::MHS5212A> : MHS5200FamilyTraits<12000000> {
+    static constexpr MHS5200Model model = MHS5200Model::MHS5212A;
+    static constexpr const char *name() { return "MHS-5212A"; }
+};
+
+template <>
+struct DeviceTraits<MHS5200Model::MHS5220A> : MHS5200FamilyTraits<20000000> {
+    static constexpr MHS5200Model model = MHS5200Model::MHS5220A;
+    static constexpr const char *name() { return "MHS-5220A"; }
+};
+
+template <>
+struct DeviceTraits<MHS5200Model::MHS5225A> : MHS5200FamilyTraits<25000000> {
+    static constexpr MHS5200Model model = MHS5200Model::MHS5225A;
+    static constexpr const char *name() { return "MHS-5225A"; }
+};
+
+/**
+ * The limits of one model as runtime values, for code that is not instantiated per model.
+ */
+struct MHS5200ModelLimits {
+    MHS5200Model model;
+    const char *name;
+    double minFrequency;
+    double maxFrequency;
+    double frequencyResolution;
+    double minAmplitude;
+    double maxAmplitude;
+    double attenuationMax;
+    int sampleBits;
+    int maxSample;
+    int arbValues;
+    int arbSlots;
+};
+
+template <class Traits>
+constexpr MHS5200ModelLimits mhs5200LimitsOf() {
+    return { Traits::model, Traits::name(), Traits::minFrequency, Traits::maxFrequency, Traits::frequencyResolution,
+             Traits::minAmplitude, Traits::maxAmplitude, Traits::attenuationMax, Traits::sampleBits, Traits::maxSample,
+             Traits::arbValues, Traits::arbSlots };
+}
+
+/**
+ * Call a generic lambda with the DeviceTraits of a model chosen at runtime. The lambda body is compiled
+ * once per model with its limits as constants.
+ * 
+ * @param model Model to dispatch on.
+ * @param f Callable taking a DeviceTraits object, ie. [&](auto traits) { return decltype(traits)::maxSample; }
+ * @return Whatever f returns.
+ */
+template <class F>
+auto mhs5200WithTraits(MHS5200Model model, F &&f) -> decltype(f(DeviceTraits<MHS5200Model::MHS5225A>())) {
+    switch ( model ) {
+        case MHS5200Model::MHS5206A: return f(DeviceTraits<MHS5200Model::MHS5206A>());
+        case MHS5200Model::MHS5212A: return f(DeviceTraits<MHS5200Model::MHS5212A>());
+        case MHS5200Model::MHS5220A: return f(DeviceTraits<MHS5200Model::MHS5220A>());
+        case MHS5200Model::MHS5225A: break;
+    }
+    return f(DeviceTraits<MHS5200Model::MHS5225A>());
+}
+
+/**
+ * Runtime limits of a model.
+ * 
+ * @param model The model.
+ * @return Its limits.
+ */
+const MHS5200ModelLimits &mhs5200ModelLimits(MHS5200Model model);
+
+/**
+ * Look up a model by name, accepts MHS-5225A, MHS5225A, 5225A or 5225 in any case.
+ * 
+ * @param name Model name.
+ * @param model Receives the model.
+ * @return False if the name is unknown.
+ */
+bool mhs5200ParseModel(const char *name, MHS5200Model &model);
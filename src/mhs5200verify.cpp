@@ -0,0 +1,90 @@
+// Read-back verification of acknowledged settings.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "mhs5200.hpp"
+
+void MHS5200Driver::setVerifyPolicy(int policy, int sampleEvery, int batch) {
+    m_verifyPolicy = policy < VerifyNone || policy > VerifyCritical ? VerifyNone : policy;
+    m_verifySampleEvery = sampleEvery < 1 ? 1 : sampleEvery;
+    m_verifyBatch = batch < 1 ? 1 : (batch > MHS5200_MAX_BATCH ? MHS5200_MAX_BATCH : batch);
+    m_verifyCounter = 0;
+    if ( m_verifyPolicy == VerifyNone ) m_verifyPending.clear();
+}
+
+void MHS5200Driver::noteVerification(const char *command, int len) {
+    if ( m_verifyPolicy == VerifyNone ) return;
+    // The command may be several frames written at once, each set frame :s<ch><setting><value> is read
+    // back with :r<ch><setting>.
+    int start = 0;
+    for ( int i = 0; i < len; i++ ) {
+        if ( command[i] != '\n' ) continue;
+        const char *frame = command + start;
+        int flen = i + 1 - start;
+        start = i + 1;
+        if ( flen < 6 || frame[0] != ':' || frame[1] != 's' ) continue;
+        if ( frame[3] == 'v' ) {
+            // Loading a memory slot replaces every setting, the earlier values are gone.
+            m_verifyPending.clear();
+            continue;
+        }
+        if ( !strchr("fdwopyab", frame[3]) ) continue;
+    
+        if ( m_verifyPolicy == VerifyCritical ) {
+            bool outputOnOff = frame[2] == '1' && frame[3] == 'b';
+            if ( !strchr("fyao", frame[3]) && !outputOnOff ) continue;
+        } else if ( m_verifyPolicy == VerifySampled ) {
+            if ( ++m_verifyCounter % m_verifySampleEvery != 0 ) continue;
+        }
+    
+        std::string setting(frame, flen-1);
+        bool replaced = false;
+        for ( auto &pending : m_verifyPending ) {
+            if ( pending.compare(0, 4, setting, 0, 4) == 0 ) {
+                pending = setting;
+                replaced = true;
+                break;
+            }
+        }
+        if ( !replaced ) m_verifyPending.push_back(setting);
+    }
+}
+
+void MHS5200Driver::verifyIfDue() {
+    if ( (int)m_verifyPending.size() >= m_verifyBatch ) verifyPending();
+}
+
+int MHS5200Driver::verifyPending() {
+    std::vector<std::string> pending;
+    pending.swap(m_verifyPending);
+    if ( pending.empty() || !m_fileDescriptor ) return 0;
+    
+    int mismatches = 0;
+    bool complete = true;
+    for ( size_t first = 0; first < pending.size(); first += MHS5200_MAX_BATCH ) {
+        int count = (int)(pending.size() - first);
+        if ( count > MHS5200_MAX_BATCH ) count = MHS5200_MAX_BATCH;
+        char reads[MHS5200_MAX_BATCH][8];
+        const char *commands[MHS5200_MAX_BATCH];
+        const char *responses[MHS5200_MAX_BATCH];
+        for ( int i = 0; i < count; i++ ) {
+            sprintf(reads[i], ":r%c%c\n", pending[first+i][2], pending[first+i][3]);
+            commands[i] = reads[i];
+        }
+        if ( rawBatch(commands, count, responses) < count ) complete = false;
+    
+        for ( int i = 0; i < count; i++ ) {
+            if ( !responses[i] ) continue;
+            // Both carry the value as decimal digits after the setting, ie. :s1f0000100000 and r1f0000100000.
+            const char *expected = pending[first+i].c_str() + 4;
+            m_statistics.verified++;
+            if ( strtoll(responses[i] + 3, nullptr, 10) != strtoll(expected, nullptr, 10) ) {
+                m_statistics.verifyMismatches++;
+                mismatches++;
+                systemError("verify", "%s read back as %s\n", pending[first+i].c_str(), responses[i]);
+            }
+        }
+    }
+    return complete ? mismatches : -1;
+}
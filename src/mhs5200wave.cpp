@@ -0,0 +1,301 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <algorithm>
+#include <vector>
+#include "mhs5200wave.hpp"
+
+#define MHS5200_WAVE_VECTORS (MHS5200_ARB_VALUES/4)
+
+typedef int IntVector __attribute__((vector_size(16), aligned(4)));
+
+MHS5200WavePipeline::MHS5200WavePipeline(int maxSample) : m_scale(1), m_offset(0), m_maxSample(maxSample)
+{
+    memset(m_samples, 0, sizeof(m_samples));
+}
+
+bool MHS5200WavePipeline::failed(const std::string &error) {
+    if ( m_error.empty() ) m_error = error;
+    return false;
+}
+
+bool MHS5200WavePipeline::ok() {
+    return m_error.empty();
+}
+
+const std::string &MHS5200WavePipeline::error() {
+    return m_error;
+}
+
+bool MHS5200WavePipeline::readSamples(const char *fileName, float samples[MHS5200_ARB_VALUES]) {
+    int values[MHS5200_ARB_VALUES];
+    std::string error;
+    if ( !MHS5200Bank::parseWaveform(fileName, values, error, m_maxSample) ) return failed(error);
+    
+    // 0 to maxSample becomes -1 to 1.
+    const Vector scale = { 2.0f/m_maxSample, 2.0f/m_maxSample, 2.0f/m_maxSample, 2.0f/m_maxSample };
+    const Vector one = { 1, 1, 1, 1 };
+    const IntVector *in = (const IntVector *)values;
+    Vector *out = (Vector *)samples;
+    for ( int i = 0; i < MHS5200_WAVE_VECTORS; i++ )
+        out[i] = __builtin_convertvector(in[i], Vector) * scale - one;
+    return true;
+}
+
+MHS5200WavePipeline &MHS5200WavePipeline::load(const char *fileName) {
+    if ( !ok() ) return *this;
+    if ( readSamples(fileName, m_samples) ) {
+        m_scale = 1;
+        m_offset = 0;
+    }
+    return *this;
+}
+
+MHS5200WavePipeline &MHS5200WavePipeline::samples(const int values[MHS5200_ARB_VALUES]) {
+    if ( !ok() ) return *this;
+    for ( int i = 0; i < MHS5200_ARB_VALUES; i++ )
+        m_samples[i] = values[i] * 2.0f / m_maxSample - 1.0f;
+    m_scale = 1;
+    m_offset = 0;
+    return *this;
+}
+
+MHS5200WavePipeline &MHS5200WavePipeline::scale(double factor) {
+    m_scale *= (float)factor;
+    m_offset *= (float)factor;
+    return *this;
+}
+
+MHS5200WavePipeline &MHS5200WavePipeline::offset(double fraction) {
+    // The range -1 to 1 is 2 wide.
+    m_offset += (float)(2*fraction);
+    return *this;
+}
+
+MHS5200WavePipeline &MHS5200WavePipeline::invert() {
+    m_scale = -m_scale;
+    m_offset = -m_offset;
+    return *this;
+}
+
+MHS5200WavePipeline &MHS5200WavePipeline::reverse() {
+    // Reordering commutes with the pending a*x+b, it stays pending.
+    std::reverse(m_samples, m_samples + MHS5200_ARB_VALUES);
+    return *this;
+}
+
+MHS5200WavePipeline &MHS5200WavePipeline::shift(double degrees) {
+    int samples = (int)lround(degrees / 360.0 * MHS5200_ARB_VALUES) % MHS5200_ARB_VALUES;
+    if ( samples < 0 ) samples += MHS5200_ARB_VALUES;
+    if ( samples ) std::rotate(m_samples, m_samples + MHS5200_ARB_VALUES - samples, m_samples + MHS5200_ARB_VALUES);
+    return *this;
+}
+
+MHS5200WavePipeline &MHS5200WavePipeline::window(MHS5200WavePipeline::Window window) {
+    if ( !ok() ) return *this;
+    // The wave form repeats, the periodic form of the windows fits it.
+    float table[MHS5200_ARB_VALUES];
+    for ( int i = 0; i < MHS5200_ARB_VALUES; i++ ) {
+        double phase = 2*M_PI*i / MHS5200_ARB_VALUES;
+        switch ( window ) {
+            case WindowHann: table[i] = (float)(0.5 - 0.5*cos(phase)); break;
+            case WindowHamming: table[i] = (float)(0.54 - 0.46*cos(phase)); break;
+            case WindowBlackman: table[i] = (float)(0.42 - 0.5*cos(phase) + 0.08*cos(2*phase)); break;
+        }
+    }
+    
+    const Vector scale = { m_scale, m_scale, m_scale, m_scale };
+    const Vector offset = { m_offset, m_offset, m_offset, m_offset };
+    const Vector *w = (const Vector *)table;
+    Vector *x = (Vector *)m_samples;
+    for ( int i = 0; i < MHS5200_WAVE_VECTORS; i++ )
+        x[i] = (x[i] * scale + offset) * w[i];
+    m_scale = 1;
+    m_offset = 0;
+    return *this;
+}
+
+MHS5200WavePipeline &MHS5200WavePipeline::mix(const char *fileName, double weight) {
+    if ( !ok() ) return *this;
+    float other[MHS5200_ARB_VALUES];
+    if ( !readSamples(fileName, other) ) return *this;
+    
+    float own = (float)(1 - weight);
+    const Vector scale = { m_scale*own, m_scale*own, m_scale*own, m_scale*own };
+    const Vector offset = { m_offset*own, m_offset*own, m_offset*own, m_offset*own };
+    const Vector w = { (float)weight, (float)weight, (float)weight, (float)weight };
+    const Vector *y = (const Vector *)other;
+    Vector *x = (Vector *)m_samples;
+    for ( int i = 0; i < MHS5200_WAVE_VECTORS; i++ )
+        x[i] = x[i] * scale + offset + y[i] * w;
+    m_scale = 1;
+    m_offset = 0;
+    return *this;
+}
+
+MHS5200WavePipeline &MHS5200WavePipeline::dither(int bits, unsigned seed) {
+    if ( !ok() ) return *this;
+    if ( bits < 1 || bits > 16 ) {
+        failed("Error: dither takes 1 to 16 bits.");
+        return *this;
+    }
+    
+    // Triangular noise of one step, the sum of two uniform values. xorshift32 keeps it repeatable.
+    float noise[MHS5200_ARB_VALUES];
+    uint32_t state = seed ? seed : 1;
+    for ( int i = 0; i < MHS5200_ARB_VALUES; i++ ) {
+        float sum = 0;
+        for ( int k = 0; k < 2; k++ ) {
+            state ^= state << 13;
+            state ^= state >> 17;
+            state ^= state << 5;
+            sum += (state >> 8) * (1.0f / 16777216.0f);
+        }
+        noise[i] = sum - 1;
+    }
+    
+    // The levels are counted from the bottom of the range, where the pending a*x+b is folded in.
+    float levels = (float)((1 << bits) - 1);
+    float toLevels = levels / 2;
+    const Vector scale = { m_scale*toLevels, m_scale*toLevels, m_scale*toLevels, m_scale*toLevels };
+    const Vector offset = { (m_offset+1)*toLevels, (m_offset+1)*toLevels, (m_offset+1)*toLevels, (m_offset+1)*toLevels };
+    const Vector zero = { 0, 0, 0, 0 };
+    const Vector top = { levels, levels, levels, levels };
+    const Vector step = { 1/toLevels, 1/toLevels, 1/toLevels, 1/toLevels };
+    const Vector one = { 1, 1, 1, 1 };
+    const Vector half = { 0.5f, 0.5f, 0.5f, 0.5f };
+    const Vector *n = (const Vector *)noise;
+    Vector *x = (Vector *)m_samples;
+    for ( int i = 0; i < MHS5200_WAVE_VECTORS; i++ ) {
+        Vector level = x[i] * scale + offset + n[i];
+        level = level < zero ? zero : level;
+        level = level > top ? top : level;
+        // Both are positive here, truncating is rounding down.
+        level = __builtin_convertvector(__builtin_convertvector(level + half, IntVector), Vector);
+        level = level > top ? top : level;
+        x[i] = level * step - one;
+    }
+    m_scale = 1;
+    m_offset = 0;
+    return *this;
+}
+
+bool MHS5200WavePipeline::result(int values[MHS5200_ARB_VALUES]) {
+    if ( !ok() ) return false;
+    float half = m_maxSample / 2.0f;
+    const Vector scale = { m_scale*half, m_scale*half, m_scale*half, m_scale*half };
+    const Vector offset = { (m_offset+1)*half + 0.5f, (m_offset+1)*half + 0.5f, (m_offset+1)*half + 0.5f, (m_offset+1)*half + 0.5f };
+    const Vector zero = { 0, 0, 0, 0 };
+    const Vector top = { (float)m_maxSample, (float)m_maxSample, (float)m_maxSample, (float)m_maxSample };
+    const Vector *x = (const Vector *)m_samples;
+    IntVector *out = (IntVector *)values;
+    for ( int i = 0; i < MHS5200_WAVE_VECTORS; i++ ) {
+        Vector sample = x[i] * scale + offset;
+        sample = sample < zero ? zero : sample;
+        sample = sample > top ? top : sample;
+        out[i] = __builtin_convertvector(sample, IntVector);
+    }
+    return true;
+}
+
+bool MHS5200WavePipeline::isExpression(const char *argument) {
+    while ( isspace((unsigned char)*argument) ) argument++;
+    return strchr(argument, '|') || (strncmp(argument, "load", 4) == 0 && isspace((unsigned char)argument[4]));
+}
+
+bool MHS5200WavePipeline::evaluate(const char *expression, int values[MHS5200_ARB_VALUES], std::string &error, int maxSample) {
+    MHS5200WavePipeline pipeline(maxSample);
+    std::string text = expression;
+    size_t start = 0;
+    int stepNumber = 0;
+    
+    while ( start <= text.size() ) {
+        size_t bar = text.find('|', start);
+        if ( bar == std::string::npos ) bar = text.size();
+        std::vector<std::string> words;
+        size_t p = start;
+        while ( p < bar ) {
+            while ( p < bar && isspace((unsigned char)text[p]) ) p++;
+            size_t wordStart = p;
+            while ( p < bar && !isspace((unsigned char)text[p]) ) p++;
+            if ( p > wordStart ) words.push_back(text.substr(wordStart, p - wordStart));
+        }
+        start = bar + 1;
+        stepNumber++;
+    
+        std::string where = "Error: Step " + std::to_string(stepNumber) + " of the wave form expression";
+        if ( words.empty() ) {
+            error = where + " is empty.";
+            return false;
+        }
+        const std::string &op = words[0];
+        if ( stepNumber == 1 && op != "load" ) {
+            error = where + " has to be load <file>.";
+            return false;
+        }
+    
+        // Every step takes its arguments as numbers except for the file names.
+        double number = 0, weight = 0.5;
+        char *end = nullptr;
+        size_t expected = 1;
+        if ( op == "scale" || op == "offset" || op == "shift" || op == "dither" ) {
+            expected = 2;
+            if ( words.size() == 2 ) {
+                number = strtod(words[1].c_str(), &end);
+                if ( end == words[1].c_str() || *end ) {
+                    error = where + ", " + op + " expects a number.";
+                    return false;
+                }
+            }
+        } else if ( op == "load" || op == "window" ) {
+            expected = words.size() == 1 && op == "window" ? 1 : 2;
+        } else if ( op == "mix" ) {
+            expected = words.size() == 3 ? 3 : 2;
+            if ( words.size() == 3 ) {
+                weight = strtod(words[2].c_str(), &end);
+                if ( end == words[2].c_str() || *end || weight < 0 || weight > 1 ) {
+                    error = where + ", mix expects a weight between 0 and 1.";
+                    return false;
+                }
+            }
+        } else if ( op != "invert" && op != "reverse" ) {
+            error = where + ": unknown step " + op + ".";
+            return false;
+        }
+        if ( words.size() != expected ) {
+            error = where + ": wrong number of arguments for " + op + ".";
+            return false;
+        }
+    
+        if ( op == "load" ) pipeline.load(words[1].c_str());
+        else if ( op == "scale" ) pipeline.scale(number);
+        else if ( op == "offset" ) pipeline.offset(number);
+        else if ( op == "invert" ) pipeline.invert();
+        else if ( op == "reverse" ) pipeline.reverse();
+        else if ( op == "shift" ) pipeline.shift(number);
+        else if ( op == "mix" ) pipeline.mix(words[1].c_str(), weight);
+        else if ( op == "dither" ) {
+            if ( number != (int)number ) {
+                error = where + ", dither expects whole bits.";
+                return false;
+            }
+            pipeline.dither((int)number);
+        } else if ( op == "window" ) {
+            std::string name = words.size() == 2 ? words[1] : "hann";
+            if ( name == "hann" ) pipeline.window(WindowHann);
+            else if ( name == "hamming" ) pipeline.window(WindowHamming);
+            else if ( name == "blackman" ) pipeline.window(WindowBlackman);
+            else {
+                error = where + ", window is hann, hamming or blackman.";
+                return false;
+            }
+        }
+        if ( !pipeline.ok() ) {
+            error = pipeline.error();
+            return false;
+        }
+    }
+    return pipeline.result(values);
+}
@@ -0,0 +1,161 @@
+#pragma once
+#include <stdint.h>
+#include <string>
+#include "mhs5200.hpp"
+#include "mhs5200bank.hpp"
+
+/**
+ * Derives arbitrary wave forms from existing ones without writing intermediate files.
+ * 
+ * The samples are held as floats from -1 (sample 0) to 1 (the model's largest sample) in one buffer that every
+ * step works on in place. Scale, offset and invert only update a pending a*x+b which is applied together with
+ * the next step that needs the values, so a chain of them costs one pass. The kernels use 4 wide float vectors
+ * (SSE on x86, NEON on ARM) through the compiler's vector extensions.
+ * 
+ * Steps are chained, ie. pipeline.load("a.txt").invert().shift(90).dither(12).result(values), and the first
+ * failing step is reported by ok() and error(). evaluate() takes the same steps as an expression:
+ * "load a.txt | invert | shift 90 | dither 12".
+ */
+class MHS5200WavePipeline
+{
+public:
+    enum Window { WindowHann, WindowHamming, WindowBlackman };
+    
+protected:
+    // Only float alignment is assumed, operator new before C++17 does not promise 16 bytes on every target.
+    typedef float Vector __attribute__((vector_size(16), aligned(4)));
+    
+    float m_samples[MHS5200_ARB_VALUES];
+    float m_scale;          // Pending x*m_scale + m_offset.
+    float m_offset;
+    int m_maxSample;
+    std::string m_error;
+    
+    bool failed(const std::string &error);
+    bool readSamples(const char *fileName, float samples[MHS5200_ARB_VALUES]);
+    
+public:
+    /**
+     * @param maxSample Largest sample the model takes, see MHS5200ModelLimits.
+     */
+    MHS5200WavePipeline(int maxSample = MHS5200_ARB_MAX_SAMPLE);
+    
+    /**
+     * Replace the samples with a wave form file as read by MHS5200Bank::parseWaveform().
+     * 
+     * @param fileName The file.
+     * @return This pipeline.
+     */
+    MHS5200WavePipeline &load(const char *fileName);
+    
+    /**
+     * Replace the samples.
+     * 
+     * @param values MHS5200_ARB_VALUES samples between 0 and the largest sample.
+     * @return This pipeline.
+     */
+    MHS5200WavePipeline &samples(const int values[MHS5200_ARB_VALUES]);
+    
+    /**
+     * Scale around the middle of the sample range.
+     * 
+     * @param factor Scale factor, ie. 0.5 for half the peak to peak amplitude.
+     * @return This pipeline.
+     */
+    MHS5200WavePipeline &scale(double factor);
+    
+    /**
+     * Move the wave up or down.
+     * 
+     * @param fraction Fraction of the full sample range, -1 to 1.
+     * @return This pipeline.
+     */
+    MHS5200WavePipeline &offset(double fraction);
+    
+    /**
+     * Mirror around the middle of the sample range.
+     * 
+     * @return This pipeline.
+     */
+    MHS5200WavePipeline &invert();
+    
+    /**
+     * Play the samples backwards.
+     * 
+     * @return This pipeline.
+     */
+    MHS5200WavePipeline &reverse();
+    
+    /**
+     * Multiply with a window function, the result fades in and out at the middle of the sample range.
+     * 
+     * @param window The window.
+     * @return This pipeline.
+     */
+    MHS5200WavePipeline &window(Window window);
+    
+    /**
+     * Circular shift, a positive phase delays the wave.
+     * 
+     * @param degrees Phase in degrees, rounded to whole samples.
+     * @return This pipeline.
+     */
+    MHS5200WavePipeline &shift(double degrees);
+    
+    /**
+     * Mix with another wave form file.
+     * 
+     * @param fileName The file.
+     * @param weight Weight of the file, the current samples get 1-weight.
+     * @return This pipeline.
+     */
+    MHS5200WavePipeline &mix(const char *fileName, double weight = 0.5);
+    
+    /**
+     * Re-quantize to fewer levels with triangular dither so the error is noise instead of steps.
+     * 
+     * @param bits Resolution in bits over the full sample range, 1 to 16.
+     * @param seed Seed of the noise so that results are repeatable.
+     * @return This pipeline.
+     */
+    MHS5200WavePipeline &dither(int bits, unsigned seed = 1);
+    
+    /**
+     * @return False once a step failed, the following steps do nothing.
+     */
+    bool ok();
+    
+    /**
+     * @return Description of the first failed step.
+     */
+    const std::string &error();
+    
+    /**
+     * Quantize to device samples, values outside the range are clipped.
+     * 
+     * @param values Receives MHS5200_ARB_VALUES samples for MHS5200Driver::setArbitrary().
+     * @return False when a step failed.
+     */
+    bool result(int values[MHS5200_ARB_VALUES]);
+    
+    /**
+     * Run an expression of steps separated by |: load <file>, scale <factor>, offset <fraction>, invert,
+     * reverse, window [hann|hamming|blackman], shift <degrees>, mix <file> [weight], dither <bits>.
+     * 
+     * @param expression The expression, it has to start with load.
+     * @param values Receives the samples.
+     * @param error Receives a description of the problem on failure.
+     * @param maxSample Largest sample the model takes, see MHS5200ModelLimits.
+     * @return True on success.
+     */
+    static bool evaluate(const char *expression, int values[MHS5200_ARB_VALUES], std::string &error,
+                         int maxSample = MHS5200_ARB_MAX_SAMPLE);
+    
+    /**
+     * Tell an expression from a file name.
+     * 
+     * @param argument Command line argument.
+     * @return True when the argument contains a | or starts with load.
+     */
+    static bool isExpression(const char *argument);
+};
@@ -0,0 +1,42 @@
+// Lost responses cost a bounded number of retries each and slow the link down in proportion, none fails a command.
+
+#include <stdio.h>
+#include "mhs5200test.hpp"
+
+int main() {
+    MHS5200TestLink link;
+    CHECK(link.open());
+    MHS5200Driver &driver = link.driver;
+    const int attemptTimeoutMs = 50, backoffMaxMs = 40;
+    driver.setRetryPolicy(6, attemptTimeoutMs, 5, backoffMaxMs);
+    
+    // A set and a read of it per pair, the read tells whether the set really took.
+    const int pairs = 100;
+    const double rates[] = { 0, 0.01, 0.05, 0.1, 0.2 };
+    double cleanMicros = 0;
+    printf("loss   ops/s  retries  timeouts  failures\n");
+    for ( double rate : rates ) {
+        driver.setFaultInjection(rate, 7);
+        driver.resetStatistics();
+        int64_t start = MHS5200Driver::monotonicMicros();
+        int wrong = 0;
+        for ( int i = 0; i < pairs; i++ ) {
+            double hz = 1000 + i;
+            CHECK(driver.setFrequency(1, hz));
+            if ( driver.getFrequency(1) != hz ) wrong++;
+        }
+        double micros = (double)(MHS5200Driver::monotonicMicros() - start);
+        if ( rate == 0 ) cleanMicros = micros;
+        const MHS5200Driver::LinkStatistics &stats = driver.getStatistics();
+        printf("%4.2f  %6.1f  %7llu  %8llu  %8llu\n", rate, 2*pairs * 1000000.0 / micros, (unsigned long long)stats.retries,
+               (unsigned long long)stats.timeouts, (unsigned long long)stats.failures);
+        
+        CHECK(wrong == 0);
+        CHECK(stats.failures == 0);
+        // Each dropped response costs one retry, one attempt timeout and at most the longest backoff.
+        CHECK(stats.retries <= stats.injectedFaults);
+        CHECK(micros <= cleanMicros + stats.injectedFaults * (attemptTimeoutMs + backoffMaxMs) * 1000.0 + 50000);
+    }
+    
+    return 0;
+}
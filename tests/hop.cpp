@@ -0,0 +1,33 @@
+// The hop engine hands the link back in order and its frequencies are not taken as known by the driver afterwards.
+
+#include "mhs5200hop.hpp"
+#include "mhs5200test.hpp"
+
+int main() {
+    MHS5200TestLink link;
+    CHECK(link.open());
+    MHS5200Driver &driver = link.driver;
+    
+    unsigned frequency = MHS5200Driver::fieldMask(1, MHS5200Driver::FieldFrequency);
+    MHS5200Driver::DeviceState known;
+    known.channels[0].frequency = 1000;
+    CHECK(driver.applyProfile(known, frequency));
+    CHECK(driver.knownState(known) & frequency);
+    
+    MHS5200HopEngine hop(driver);
+    const double outOfRange[] = { 2000, 1e12 };
+    CHECK(!hop.setAlphabet(1, outOfRange, 2));
+    const double alphabet[] = { 2000, 3000 };
+    const int symbols[] = { 0, 1, 0, 1 };
+    MHS5200HopEngine::Report report;
+    CHECK(hop.setAlphabet(1, alphabet, 2));
+    CHECK(hop.run(symbols, 4, 200, false, report));
+    CHECK(!(driver.knownState(known) & frequency));
+    CHECK(driver.getFrequency(1) == 3000);
+    
+    // A profile with the frequency the driver knew before the run must still be sent.
+    CHECK(driver.applyProfile(known, frequency));
+    CHECK(driver.getFrequency(1) == 1000);
+    
+    return 0;
+}
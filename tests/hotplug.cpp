@@ -0,0 +1,52 @@
+// A generator unplugged and plugged in again is found through its link, reopened and given the settings it had.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include <thread>
+#include <unistd.h>
+#include "mhs5200test.hpp"
+
+int main() {
+    // The node stands in for a /dev/serial/by-id link, the fakes are the adapter before and after the replug.
+    char directory[] = "/tmp/mhs5200hotplugXXXXXX";
+    CHECK(mkdtemp(directory));
+    std::string node = std::string(directory) + "/generator";
+    
+    MHS5200TestLink link;
+    CHECK(link.start());
+    CHECK(symlink(link.fake.deviceName(), node.c_str()) == 0);
+    MHS5200Driver &driver = link.driver;
+    driver.setAutoReconnect(5000);
+    CHECK(link.connect(node.c_str()));
+    CHECK(driver.setFrequency(1, 1234.5));
+    CHECK(driver.setAmplitude(1, 3.0));
+    CHECK(driver.setWaveType(2, MHS5200Driver::WaveType::Square));
+    
+    // Unplugged: the node goes away and the tty hangs up.
+    CHECK(unlink(node.c_str()) == 0);
+    link.fake.stop();
+    link.fake.close();
+    
+    MHS5200FakeDevice after;
+    CHECK(after.open());
+    CHECK(after.start());
+    std::thread plug([&]() {
+        usleep(300000);
+        symlink(after.deviceName(), node.c_str());
+    });
+    
+    // The query finds the link lost, waits for the node and is answered by the new device after the replay.
+    double frequency = driver.getFrequency(1);
+    plug.join();
+    CHECK(frequency == 1234.5);
+    CHECK(driver.getAmplitude(1) == 3.0);
+    CHECK(driver.getWaveType(2) == MHS5200Driver::WaveType::Square);
+    CHECK(driver.getStatistics().reconnects == 1);
+    
+    driver.disconnect();
+    after.stop();
+    unlink(node.c_str());
+    rmdir(directory);
+    return 0;
+}
@@ -0,0 +1,57 @@
+#pragma once
+#include <stdio.h>
+#include "mhs5200.hpp"
+#include "mhs5200loadtest.hpp"
+
+/**
+ * Fail the test, from main() or a function returning int, when a condition does not hold.
+ */
+#define CHECK(condition) \
+    do { \
+        if ( !(condition) ) { \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #condition); \
+            return 1; \
+        } \
+    } while ( 0 )
+
+/**
+ * A fake generator on a pseudo terminal at MHS5200_FAKE_BAUD with a driver connected to it, disconnected and
+ * stopped when it goes out of scope.
+ */
+struct MHS5200TestLink {
+    MHS5200FakeDevice fake;
+    MHS5200Driver driver;
+    
+    /**
+     * Start the fake device.
+     * 
+     * @return True if successful.
+     */
+    bool start() {
+        return fake.open() && fake.start();
+    }
+    
+    /**
+     * Connect the driver.
+     * 
+     * @param deviceName TTY to connect to, nullptr for the fake's.
+     * @return True if successful.
+     */
+    bool connect(const char *deviceName = nullptr) {
+        return driver.connect(deviceName ? deviceName : fake.deviceName());
+    }
+    
+    /**
+     * Start the fake device and connect the driver to it.
+     * 
+     * @return True if successful.
+     */
+    bool open() {
+        return start() && connect();
+    }
+    
+    ~MHS5200TestLink() {
+        driver.disconnect();
+        fake.stop();
+    }
+};
@@ -0,0 +1,35 @@
+// Settings released to several generators at once are handed back to their drivers as sent, not as known.
+
+#include "mhs5200sync.hpp"
+#include "mhs5200test.hpp"
+
+int main() {
+    MHS5200TestLink links[2];
+    MHS5200SyncGroup group;
+    unsigned frequency = MHS5200Driver::fieldMask(1, MHS5200Driver::FieldFrequency);
+    MHS5200Driver::DeviceState state;
+    for ( int i = 0; i < 2; i++ ) {
+        CHECK(links[i].open());
+        state.channels[0].frequency = 1000;
+        CHECK(links[i].driver.applyProfile(state, frequency));
+        group.add(links[i].driver);
+    }
+    
+    state.channels[0].frequency = 2500;
+    for ( int i = 0; i < 2; i++ )
+        CHECK(group.prepare(i, state, frequency));
+    MHS5200SyncGroup::Report report;
+    CHECK(group.trigger(report, false));
+    CHECK(report.acknowledged == 2);
+    
+    for ( int i = 0; i < 2; i++ ) {
+        MHS5200Driver &driver = links[i].driver;
+        CHECK(!(driver.knownState(state) & frequency));
+        CHECK(driver.getFrequency(1) == 2500);
+        // The frequency known before the trigger is no longer taken as reached.
+        state.channels[0].frequency = 1000;
+        CHECK(driver.applyProfile(state, frequency));
+        CHECK(driver.getFrequency(1) == 1000);
+    }
+    return 0;
+}
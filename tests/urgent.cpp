@@ -0,0 +1,55 @@
+// An arbitrary wave upload in progress delays turning the output off by at most the chunk already sent.
+
+#include <atomic>
+#include <thread>
+#include <unistd.h>
+#include "mhs5200test.hpp"
+
+int main() {
+    MHS5200TestLink link;
+    CHECK(link.open());
+    MHS5200Driver &driver = link.driver;
+    
+    // The largest samples give the longest chunks.
+    int values[MHS5200_ARB_VALUES];
+    for ( int i = 0; i < MHS5200_ARB_VALUES; i++ ) values[i] = i % 2 ? 4095 : 1000;
+    char frame[MHS5200_ARB_CHUNK_SIZE];
+    int chunkBytes = 0;
+    for ( int chunk = 0; chunk < MHS5200_ARB_CHUNKS; chunk++ ) {
+        int len = MHS5200Driver::formatArbitraryChunk(frame, 15, chunk, &values[chunk*MHS5200_ARB_CHUNK_VALUES]);
+        if ( len > chunkBytes ) chunkBytes = len;
+    }
+    double perByte = driver.wireMicrosPerByte();
+    double chunkMicros = (chunkBytes + 4) * perByte + 2000;
+    double offMicros = (6 + 4) * perByte + 2000;
+    
+    // Every chunk queued at once is the worst case, the off frame lands at several points within a chunk.
+    double worst = 0;
+    for ( int trial = 0; trial < 4; trial++ ) {
+        CHECK(driver.setCurrentChannelStatus(true));
+        std::atomic<bool> uploading(true);
+        bool uploaded = false;
+        std::thread upload([&]() {
+            uploaded = driver.setArbitrary(15, values, MHS5200_ARB_CHUNKS);
+            uploading = false;
+        });
+        usleep((useconds_t)((3 + trial/4.0) * chunkMicros));
+        
+        int64_t start = MHS5200Driver::monotonicMicros();
+        bool off = driver.setCurrentChannelStatus(false);
+        double took = (double)(MHS5200Driver::monotonicMicros() - start);
+        bool stillUploading = uploading.load();
+        upload.join();
+        printf("Output off acknowledged after %.1fms, one chunk takes %.1fms\n", took/1000, chunkMicros/1000);
+        
+        CHECK(off);
+        CHECK(stillUploading);
+        CHECK(uploaded);
+        CHECK(!driver.getCurrentChannelStatus());
+        if ( took > worst ) worst = took;
+    }
+    // The chunk on the wire, then the off frame itself, with some room for scheduling.
+    CHECK(worst <= chunkMicros + offMicros + 15000);
+    
+    return 0;
+}
@@ -0,0 +1,92 @@
+// Decoder for event dumps written by mhs5200EventsDump() (MHS5200_TRACE=BINARY builds).
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <ctype.h>
+#include <vector>
+#include "mhs5200events.hpp"
+
+static const char *callNames[] = {
+#define MHS5200_TRACE_CALL_NAME(name) #name,
+    MHS5200_TRACE_CALLS(MHS5200_TRACE_CALL_NAME)
+#undef MHS5200_TRACE_CALL_NAME
+};
+
+static const char *eventName(uint16_t id) {
+    switch ( id ) {
+        case EventCall: return "call";
+        case EventWrite: return "write";
+        case EventRead: return "read";
+        case EventTimeout: return "timeout";
+        case EventRetry: return "retry";
+        case EventFlush: return "flush";
+        case EventFailure: return "failure";
+    }
+    return "unknown";
+}
+
+int main( int argc, const char *argv[] ) 
+{
+    if ( argc != 2 ) {
+        printf("Usage: %s <event dump>\n", argv[0]);
+        return 1;
+    }
+    FILE *f = fopen(argv[1], "rb");
+    if ( !f ) {
+        perror(argv[1]);
+        return 1;
+    }
+    
+    MHS5200EventsHeader header;
+    if ( fread(&header, sizeof(header), 1, f) != 1 || header.magic != MHS5200_EVENTS_MAGIC || 
+         header.version != MHS5200_EVENTS_VERSION || header.eventSize != sizeof(MHS5200Event) ) {
+        printf("Error: %s is not an event dump.\n", argv[1]);
+        fclose(f);
+        return 1;
+    }
+    
+    std::vector<MHS5200EventsThread> threads;
+    std::vector< std::vector<MHS5200Event> > events;
+    uint64_t origin = UINT64_MAX;
+    for ( uint32_t t = 0; t < header.threads; t++ ) {
+        MHS5200EventsThread thread;
+        if ( fread(&thread, sizeof(thread), 1, f) != 1 ) break;
+        std::vector<MHS5200Event> list(thread.count);
+        if ( thread.count && fread(list.data(), sizeof(MHS5200Event), thread.count, f) != thread.count ) break;
+        if ( !list.empty() && list[0].nanos < origin ) origin = list[0].nanos;
+        threads.push_back(thread);
+        events.push_back(list);
+    }
+    fclose(f);
+    
+    uint64_t counts[16] = { 0 };
+    for ( size_t t = 0; t < threads.size(); t++ ) {
+        printf("Thread %llx: %llu events, %u kept\n", (unsigned long long)threads[t].threadId, 
+               (unsigned long long)threads[t].total, threads[t].count);
+        for ( auto &e : events[t] ) {
+            counts[e.id & 15]++;
+            printf("%14.3fus %-8s ", (e.nanos - origin)/1000.0, eventName(e.id));
+            if ( e.id == EventCall ) {
+                printf("%s", e.arg < TraceCallCount ? callNames[e.arg] : "?");
+            } else {
+                printf("%u", e.arg);
+            }
+            if ( e.length ) {
+                printf(" \"");
+                for ( int i = 0; i < e.length && i < MHS5200_EVENTS_PAYLOAD; i++ ) {
+                    if ( isprint((unsigned char)e.payload[i]) ) printf("%c", e.payload[i]);
+                    else printf("\\x%02x", (unsigned char)e.payload[i]);
+                }
+                printf("%s\"", e.arg > e.length ? "..." : "");
+            }
+            printf("\n");
+        }
+    }
+    
+    printf("Totals:");
+    for ( uint16_t id = EventCall; id <= EventFailure; id++ )
+        printf(" %s %llu", eventName(id), (unsigned long long)counts[id]);
+    printf("\n");
+    return 0;
+}